@@ -39,30 +39,72 @@
 
 #include "nomxml.h"
 #include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <unordered_set>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define NOMXML_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Lets GCC and Clang compile a function for a wider instruction set
+// than the rest of the module.  Visual C++ needs no such help.
+//
+#if defined(NOMXML_X86) && defined(__GNUC__)
+#define NOMXML_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NOMXML_TARGET(isa)
+#endif
 
 // Define _DUMP to enable debug output to stdio.  Useful for debugging.
 //#define _DUMP
 
+// Define NOMXML_BASELINE_LEXER to build XmlParser's lexer the way it
+// was before it classified characters with a table:  iswspace and a
+// search of the delimiter strings for every character, tokens and text
+// built up one character at a time with no SIMD runs over documents in
+// memory, and comments and marked sections closed by the original
+// character-by-character checks.  Only useful for measuring the
+// current lexer against it, as the xmldump_baseline build does.
+//#define NOMXML_BASELINE_LEXER
+
 namespace nomxml {
 
 //--------------------------------------------------------------------
 // Interface object for reading characters from an XML file on disk.
+// Reads the file a block at a time, so that reading a character is
+// usually just taking the next byte of the block.
 //--------------------------------------------------------------------
 class XmlFileInputInterface : public XmlStreamInputInterface
 {
 public:
-   explicit XmlFileInputInterface(FILE *fp) : m_File(fp) { }
+   explicit XmlFileInputInterface(FILE *fp) : m_File(fp), m_BufferPos(0), m_BufferEnd(0) { }
    ~XmlFileInputInterface() { }
 
+   // A copy shares the file but not the block read from it, and reads
+   // from wherever the file is positioned.
+   XmlFileInputInterface(const XmlFileInputInterface &copy) : m_File(copy.m_File), m_BufferPos(0), m_BufferEnd(0) { }
+
    // Retrieve the total number of characters in the file.
    size_t GetFileLength(void)
    {
       if (!m_File)
          return 0;
-      fseek(m_File, 0, SEEK_END);
-      size_t length = ftell(m_File);
-      fseek(m_File, 0, SEEK_SET);
+      size_t length = XmlFileLength(m_File);
+      XmlSeekFile(m_File, 0);
+      m_BufferPos = m_BufferEnd = 0;
       return length;
    }
 
@@ -75,7 +117,8 @@ public:
 #endif
       if (!m_File)
          return false;
-      return (fseek(m_File, static_cast<long>(offset), SEEK_SET) == 0);   // Zero indicates success.
+      m_BufferPos = m_BufferEnd = 0;
+      return XmlSeekFile(m_File, offset);
    }
 
    // Read the next character from the file.
@@ -83,18 +126,17 @@ public:
    // Returns false if error or past end of file.
    bool ReadChar(wchar_t &c)
    {
-      if (!m_File)
-      {
-         c = 0;
-         return false;
-      }
-      unsigned char cc;
-      if (fread(&cc, 1, 1, m_File) != 1)
+      if (m_BufferPos == m_BufferEnd)
       {
-         c = 0;
-         return false;
+         m_BufferPos = 0;
+         m_BufferEnd = m_File ? fread(m_Buffer, 1, sizeof(m_Buffer), m_File) : 0;
+         if (m_BufferEnd == 0)
+         {
+            c = 0;
+            return false;
+         }
       }
-      c = static_cast<wchar_t>(cc);
+      c = static_cast<wchar_t>(static_cast<unsigned char>(m_Buffer[m_BufferPos++]));
       return true;
    }
 
@@ -103,7 +145,23 @@ public:
    {
       if (!m_File)
          return true;
-      return (feof(m_File) != 0);
+      return m_BufferPos == m_BufferEnd && feof(m_File) != 0;
+   }
+
+   // Read {length} characters starting at {offset} into {block} with
+   // one read of the file, leaving the file positioned after them.
+   // Returns false if error or past end of file.
+   bool ReadBlock(size_t offset, size_t length, std::wstring &block)
+   {
+      if (!Seek(offset))
+         return false;
+      std::vector<char> bytes(length);
+      if (length != 0 && fread(bytes.data(), 1, length, m_File) != length)
+         return false;
+      block.resize(length);
+      for (size_t index = 0; index < length; ++index)
+         block[index] = static_cast<wchar_t>(static_cast<unsigned char>(bytes[index]));
+      return true;
    }
 
    // Close the file immediately.
@@ -112,6 +170,7 @@ public:
       if (m_File)
          fclose(m_File);
       m_File = nullptr;
+      m_BufferPos = m_BufferEnd = 0;
    }
 
    // Return a copy of this interface, allocated on the heap via new.
@@ -120,9 +179,81 @@ public:
       return new XmlFileInputInterface(*this);
    }
 
-private:
+protected:
    FILE *m_File;
-   XmlFileInputInterface() : m_File(nullptr) { }
+
+private:
+   char m_Buffer[4096];    // Block of the file being read.
+   size_t m_BufferPos;     // Offset of the next character in m_Buffer.
+   size_t m_BufferEnd;     // Number of characters in m_Buffer.
+
+   XmlFileInputInterface() : m_File(nullptr), m_BufferPos(0), m_BufferEnd(0) { }
+};
+
+//--------------------------------------------------------------------
+// Interface object for reading characters from an XML file on disk
+// that another program may still be appending to.  When the reader
+// catches up with the end of the file, it waits for more data to be
+// appended instead of reporting the end of the file, so the parser
+// keeps all of its state and resumes exactly where it stopped.
+//--------------------------------------------------------------------
+class XmlFollowInputInterface : public XmlFileInputInterface
+{
+public:
+   XmlFollowInputInterface(FILE *fp, unsigned pollms, unsigned idlems, const std::atomic<bool> *stop) :
+      XmlFileInputInterface(fp), m_PollMs(pollms), m_IdleMs(idlems), m_Stop(stop), m_Ended(false) { }
+
+   // Retrieve the number of characters in the file so far.
+   size_t GetFileLength(void)
+   {
+      if (!m_File)
+         return 0;
+      return XmlFileLength(m_File);
+   }
+
+   // Read the next character from the file, waiting for it to be
+   // appended if necessary.
+   // Returns true if successful.
+   // Returns false if error, or if no data was appended within the
+   // idle time limit, or if the parser was told to stop following.
+   bool ReadChar(wchar_t &c)
+   {
+      unsigned idle = 0;
+      while (!XmlFileInputInterface::ReadChar(c))
+      {
+         if (!m_File || ferror(m_File) || (m_Stop && m_Stop->load()) ||
+             (m_IdleMs != 0 && idle >= m_IdleMs))
+         {
+            m_Ended = true;
+            return false;
+         }
+
+         // Clear the end-of-file condition so the next read will see
+         // any data appended in the meantime.
+         clearerr(m_File);
+         std::this_thread::sleep_for(std::chrono::milliseconds(m_PollMs));
+         idle += m_PollMs;
+      }
+      return true;
+   }
+
+   // Returns true if the reader has stopped waiting for more data.
+   bool EndOfFile(void)
+   {
+      return m_Ended || !m_File;
+   }
+
+   // Return a copy of this interface, allocated on the heap via new.
+   XmlStreamInputInterface *Clone()
+   {
+      return new XmlFollowInputInterface(*this);
+   }
+
+private:
+   unsigned m_PollMs;               // How often to check for appended data.
+   unsigned m_IdleMs;               // How long to wait for appended data, or zero to wait forever.
+   const std::atomic<bool> *m_Stop; // Set to true to stop waiting.
+   bool m_Ended;                    // True once the reader has stopped waiting.
 };
 
 //--------------------------------------------------------------------
@@ -171,7 +302,7 @@ public:
    {
       if (m_Data && m_DataPos < m_DataSize)
       {
-         char cc = m_Data[m_DataPos++];
+         unsigned char cc = static_cast<unsigned char>(m_Data[m_DataPos++]);
          c = static_cast<wchar_t>(cc);
          return true;
       }
@@ -185,767 +316,5547 @@ public:
    }
 };
 
-// Delimiter character sets used with NextToken() calls.
+// Value of XmlParser::m_RangeEnd when parsing the whole document.
+const size_t noRangeEnd = static_cast<size_t>(-1);
+
+// Classes of characters the lexer treats specially, as bit flags.
+// Each character may be in several classes.
 //
-const wchar_t xmlDelimsWithEquals[] = L"=><? \r\n\t";
-const wchar_t xmlDelimsWithSlash [] = L"/><? \r\n\t";
+typedef enum
+{
+   CharClass_Space      = 0x01,  // Whitespace.
+   CharClass_Nul        = 0x02,  // The NUL character, which ends every token.
+   CharClass_NameEnd    = 0x04,  // Ends a tag name:  "/><?" or whitespace.
+   CharClass_AttribEnd  = 0x08,  // Ends an attribute name or value:  "=><?" or whitespace.
+   CharClass_Dash       = 0x10,  // '-', which may begin the "-->" closing a comment.
+   CharClass_Bracket    = 0x20,  // ']', which may begin the "]]>" closing a marked section.
+   CharClass_Close      = 0x40,  // '>'.
+} CharClass;
 
 //--------------------------------------------------------------------
-// Returns true if all characters in {text} are whitespace.
+// Table of the classes of every byte, used to classify characters with
+// one lookup instead of a series of comparisons.  Bytes 0x80 and up
+// aren't in any class.
 //--------------------------------------------------------------------
-static bool IsWhiteSpace(const std::wstring &text)
+static const struct CharClassTable
 {
-   for (auto iter = text.begin(); iter != text.end(); ++iter)
-      if (!iswspace(*iter))
-         return false;
-   return true;
-}
+   unsigned char m_Classes[256];
+
+   CharClassTable()
+   {
+      for (size_t index = 0; index < 256; ++index)
+         m_Classes[index] = 0;
+
+      const char spaces[] = " \t\n\v\f\r";
+      for (const char *c = spaces; *c != 0; ++c)
+         m_Classes[static_cast<unsigned char>(*c)] |= CharClass_Space;
+
+      // Vertical tab and form feed are whitespace but don't end tokens.
+      const char delims[] = " \t\n\r><?";
+      for (const char *c = delims; *c != 0; ++c)
+         m_Classes[static_cast<unsigned char>(*c)] |= CharClass_NameEnd | CharClass_AttribEnd;
+      m_Classes['/'] |= CharClass_NameEnd;
+      m_Classes['='] |= CharClass_AttribEnd;
+
+      m_Classes[0]   |= CharClass_Nul;
+      m_Classes['-'] |= CharClass_Dash;
+      m_Classes[']'] |= CharClass_Bracket;
+      m_Classes['>'] |= CharClass_Close;
+   }
+} charClasses;
 
 //--------------------------------------------------------------------
-// Append {indent} number of spaces onto {text}.
+// Returns the classes of character {c}.  Characters past 7-bit ASCII
+// are only checked for being whitespace.
 //--------------------------------------------------------------------
-static void AddSpaces(std::wstring &text, size_t indent)
+static unsigned CharClassOf(wchar_t c)
 {
-   for (size_t index = 0; index < indent; ++index)
-      text += L" ";
+#ifdef NOMXML_BASELINE_LEXER
+   unsigned classes = iswspace(c) ? CharClass_Space : 0;
+   if (c == 0)
+      return classes | CharClass_Nul;
+   if (wcschr(L"/><? \r\n\t", c))
+      classes |= CharClass_NameEnd;
+   if (wcschr(L"=><? \r\n\t", c))
+      classes |= CharClass_AttribEnd;
+   if (c == '-')
+      classes |= CharClass_Dash;
+   else if (c == ']')
+      classes |= CharClass_Bracket;
+   else if (c == '>')
+      classes |= CharClass_Close;
+   return classes;
+#else
+   if (static_cast<uint32_t>(c) < 0x80)
+      return charClasses.m_Classes[c];
+   return iswspace(c) ? CharClass_Space : 0;
+#endif
 }
 
 //--------------------------------------------------------------------
-// Construct.
+// States of the machine that finds the "-->" closing a comment or the
+// "]]>" closing a marked section.  Indexed by the current state and
+// by whether the character is the repeated one ('-' or ']'), a '>', or
+// anything else.  A third repeated character leaves the machine
+// having matched one, not two, just as "--->" doesn't close a comment.
 //--------------------------------------------------------------------
-XmlParser::XmlParser() :
-   m_PriorTagType(XmlNodeBase::XmlNodeType_Invalid),
-   m_PriorWasEmptyTag(false),
-   m_DataSize(0), m_DataPos(0), m_CurChar('\0')
+#ifndef NOMXML_BASELINE_LEXER
+typedef enum { Closer_None, Closer_One, Closer_Two, Closer_Done } CloserState;
+typedef enum { CloserInput_Other, CloserInput_Repeated, CloserInput_Close } CloserInput;
+static const unsigned char closerStates[3][3] =
 {
-#ifdef _DUMP
-   wprintf(L"XmlParser constructing.\n");
-   fflush(stdout);
+   //  Other        Repeated     Close
+   { Closer_None, Closer_One, Closer_None },    // Closer_None
+   { Closer_None, Closer_Two, Closer_None },    // Closer_One
+   { Closer_None, Closer_One, Closer_Done },    // Closer_Two
+};
 #endif
-}
 
 //--------------------------------------------------------------------
-// Destruct.
+// Returns true if all characters in {text} are whitespace.
 //--------------------------------------------------------------------
-XmlParser::~XmlParser()
+static bool IsWhiteSpace(const std::wstring &text)
 {
-#ifdef _DUMP
-   wprintf(L"XmlParser destructing.\n");
-   fflush(stdout);
-#endif
-   Reset();
+   for (auto iter = text.begin(); iter != text.end(); ++iter)
+      if (!iswspace(*iter))
+         return false;
+   return true;
 }
 
 //--------------------------------------------------------------------
-// Begin parsing the XML document that was just opened.
-// Returns false if error.
+// Mix {value} into the 64-bit FNV-1a hash {hash}.
 //--------------------------------------------------------------------
-bool XmlParser::BeginParsingImpl(void)
+static void HashValue(uint64_t &hash, uint64_t value)
 {
-   if (!m_Reader)
-      return false;
-
-   // Initialize file position tracking.
-   //
-   m_DataSize = m_Reader->GetFileLength();
-
-#ifdef _DUMP
-   wprintf(L"File length:  %Iu characters\n", m_DataSize);
-   fflush(stdout);
-#endif
+   hash ^= value;
+   hash *= 1099511628211ULL;
+}
 
-   // Prime the current character.
-   //
-   if (!NextChar())
-   {
-      m_ErrorInfo = L"Empty document.  No XML tags found.";
-      return false;
-   }
+//--------------------------------------------------------------------
+// Mix the characters of {text} into the 64-bit FNV-1a hash {hash}.
+//--------------------------------------------------------------------
+static void HashText(uint64_t &hash, const wchar_t *text, size_t length)
+{
+   for (size_t index = 0; index < length; ++index)
+      HashValue(hash, static_cast<uint64_t>(text[index]));
 
-   return true;
+   // Mix in a terminator so that "ab"+"c" differs from "a"+"bc".
+   HashValue(hash, 0xFFFFFFFF);
 }
 
 //--------------------------------------------------------------------
-// Begin parsing XML document contained in file {filename}.
-// Returns false if error.
+// Start the fingerprint of the element that begins with {begin}.
 //--------------------------------------------------------------------
-bool XmlParser::BeginParsingFromFile(const wchar_t *filename)
+static uint64_t HashBeginNode(const XmlBeginNode &begin)
 {
-#ifdef _DUMP
-   wprintf(L"XmlParser::BeginParsingFromFile(\"%s\")\n", filename);
-   fflush(stdout);
-#endif
+   uint64_t hash = 14695981039346656037ULL;
+   HashText(hash, begin.m_Name.c_str(), begin.m_Name.size());
 
-   Reset();
-   FILE *fp = nullptr;
-   if (_wfopen_s(&fp, filename, L"rb") || fp == nullptr)
+   std::vector<const XmlAttribute *> sorted;
+   for (auto attribp = begin.m_Attribs.begin(); attribp != begin.m_Attribs.end(); ++attribp)
+      sorted.push_back(&*attribp);
+   std::sort(sorted.begin(), sorted.end(),
+             [](const XmlAttribute *a, const XmlAttribute *b) { return a->m_Name < b->m_Name; });
+   for (auto attribp = sorted.begin(); attribp != sorted.end(); ++attribp)
    {
-      m_ErrorInfo = L"Failed opening input file:  ";
-      m_ErrorInfo += filename;
-      return false;
+      HashText(hash, (*attribp)->m_Name.c_str(), (*attribp)->m_Name.size());
+      HashText(hash, (*attribp)->m_Value.c_str(), (*attribp)->m_Value.size());
    }
-   XmlFileInputInterface reader(fp);
-   m_Reader.reset(reader.Clone());
-
-   return BeginParsingImpl();
+   return hash;
 }
 
 //--------------------------------------------------------------------
-// Begin parsing XML document contained in file {filename}.
-// Returns false if error.
-// Overload of above for callers that want to use a narrow
-// filename string.
+// Mix value text {text} into an element's fingerprint {hash}, ignoring
+// any leading and trailing whitespace.
 //--------------------------------------------------------------------
-bool XmlParser::BeginParsingFromFile(const char *filename)
+static void HashValueText(uint64_t &hash, const std::wstring &text)
 {
-#ifdef _DUMP
-   printf("XmlParser::BeginParsingFromFile(\"%s\")\n", filename);
-   fflush(stdout);
-#endif
-
-   // Note the simple narrow-to-wide conversion doesn't take foreign
-   // character code pages etc. into account.
-   std::wstring filenameW;
-   while (*filename)
-      filenameW += static_cast<wchar_t>(*filename++);
-
-   return BeginParsingFromFile(filenameW.c_str());
+   size_t first = 0, last = text.size();
+   while (first < last && iswspace(text[first]))
+      ++first;
+   while (last > first && iswspace(text[last - 1]))
+      --last;
+   if (first < last)
+      HashText(hash, text.c_str() + first, last - first);
 }
 
 //--------------------------------------------------------------------
-// Begin parsing XML document contained in the memory block pointed
-// to by {data}.
-// The memory block is {numbytes} in size.
-// The memory block must remain accessible until parsing is completed.
-// Returns false if error.
+// Append {indent} number of spaces onto {text}.
 //--------------------------------------------------------------------
-bool XmlParser::BeginParsingFromMemory(void *data, size_t numbytes)
+static void AddSpaces(std::wstring &text, size_t indent)
 {
-#ifdef _DUMP
-   printf("XmlParser::BeginParsingFromMemory(data:%p, numbytes:%Iu)\n", data, numbytes);
-   fflush(stdout);
-#endif
+   for (size_t index = 0; index < indent; ++index)
+      text += L" ";
+}
 
-   Reset();
-   XmlMemoryInputInterface reader(data, numbytes);
-   m_Reader.reset(reader.Clone());
+//--------------------------------------------------------------------
+// Vectorized scanning kernels.  Each kernel scans {length} bytes at
+// {data} and returns the index of the first byte that stops the scan,
+// or {length} if no byte does.  The SIMD versions handle whole vectors
+// and leave the remainder to the next narrower version, so they always
+// give the same answer as the scalar version.
+//--------------------------------------------------------------------
 
-   return BeginParsingImpl();
+//--------------------------------------------------------------------
+// Returns the index of the lowest set bit in {mask}, which must not
+// be zero.
+//--------------------------------------------------------------------
+static unsigned LowestBit(uint64_t mask)
+{
+#ifdef _MSC_VER
+   unsigned long index;
+   if (_BitScanForward(&index, static_cast<unsigned long>(mask)))
+      return index;
+   _BitScanForward(&index, static_cast<unsigned long>(mask >> 32));
+   return index + 32;
+#else
+   return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
 }
 
 //--------------------------------------------------------------------
-// Begin parsing XML document using the specified interface to read
-// the file.  Returns false if error.
+// Returns true if {c} is one of the whitespace characters the
+// whitespace kernels skip:  space, tab, newline, vertical tab, form
+// feed or carriage return.
 //--------------------------------------------------------------------
-bool XmlParser::BeginParsingFromInterface(XmlStreamInputInterface *iface)
+static bool IsSpaceByte(char c)
 {
-#ifdef _DUMP
-   printf("XmlParser::BeginParsingFromInterface(iface:%p)\n", iface);
-   fflush(stdout);
-#endif
+   return c == ' ' || (c >= '\t' && c <= '\r');
+}
 
-   Reset();
-   m_Reader.reset(iface->Clone());
+//--------------------------------------------------------------------
+// Find the first byte that is either {a} or {b}.
+//--------------------------------------------------------------------
+static size_t FindEitherScalar(const char *data, size_t length, char a, char b)
+{
+   for (size_t index = 0; index < length; ++index)
+      if (data[index] == a || data[index] == b)
+         return index;
+   return length;
+}
 
-   return BeginParsingImpl();
+//--------------------------------------------------------------------
+// Find the first byte that isn't whitespace.
+//--------------------------------------------------------------------
+static size_t SkipSpaceScalar(const char *data, size_t length)
+{
+   for (size_t index = 0; index < length; ++index)
+      if (!IsSpaceByte(data[index]))
+         return index;
+   return length;
 }
 
 //--------------------------------------------------------------------
-// Parses the value portion of an XML tag, meaning the text that
-// appears between the begin tag and the end tag.  Caller is
-// assumed to have already determined that it is time to parse
-// the tag value.  If the caller already read some of the
-// characters of the value text, they should be passed in {prefix}.
-//
-// The value node will be added to the current tag on the stack
-// if successful, with a copy of the node being returned in {ptrref}.
-//
-// Returns false if error or no more data.
+// Find the first byte that isn't 7-bit ASCII.
 //--------------------------------------------------------------------
-bool XmlParser::ParseTagValueNode(const std::wstring &prefix, std::unique_ptr<XmlNodeBase> &ptrref)
+static size_t AsciiPrefixScalar(const char *data, size_t length)
 {
-   std::wstring token = prefix;
+   for (size_t index = 0; index < length; ++index)
+      if (static_cast<unsigned char>(data[index]) >= 0x80)
+         return index;
+   return length;
+}
 
-   // Any characters between here and the next tag become part of the current
-   // tag's value.
-   //
-   while (CurChar() != 0 && CurChar() != '<')
+//--------------------------------------------------------------------
+// Find the first byte that might need escaping in XML output:  '&',
+// '<', '>', '"' or a control character.
+//--------------------------------------------------------------------
+static size_t FindSpecialScalar(const char *data, size_t length)
+{
+   for (size_t index = 0; index < length; ++index)
    {
-      token += CurChar();
-      NextChar();
+      char c = data[index];
+      if (c == '&' || c == '<' || c == '>' || c == '"' ||
+          static_cast<unsigned char>(c) < 0x20)
+         return index;
    }
+   return length;
+}
 
-   // If the stack of tags is empty, then the XML document apparently has
-   // garbage text outside any tags.  This is okay if it's just whitespace,
-   // but not okay if it's anything else.
-   //
-   if (m_Stack.empty())
+#ifdef NOMXML_X86
+
+NOMXML_TARGET("sse2")
+static size_t FindEitherSse2(const char *data, size_t length, char a, char b)
+{
+   const __m128i va = _mm_set1_epi8(a);
+   const __m128i vb = _mm_set1_epi8(b);
+   size_t index = 0;
+   for (; index + 16 <= length; index += 16)
    {
-      if (!IsWhiteSpace(token))
-      {
-         m_ErrorInfo = L"Unexpected data outside of all tags:  '";
-         m_ErrorInfo += token;
-         m_ErrorInfo += L"'";
-      }
-      // else we probably just read some whitespace at the end of
-      // the XML document.
-      return false;
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + index));
+      unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+         _mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb))));
+      if (mask != 0)
+         return index + LowestBit(mask);
    }
-   else
+   return index + FindEitherScalar(data + index, length - index, a, b);
+}
+
+NOMXML_TARGET("sse2")
+static size_t SkipSpaceSse2(const char *data, size_t length)
+{
+   const __m128i tab   = _mm_set1_epi8('\t');
+   const __m128i four  = _mm_set1_epi8(4);
+   const __m128i space = _mm_set1_epi8(' ');
+   size_t index = 0;
+   for (; index + 16 <= length; index += 16)
    {
-      XmlElementBase & celm = m_Stack[m_Stack.size() - 1];
-      celm.m_Value.m_Name = celm.m_Begin.m_Name;
-      celm.m_Value.m_Value = token;
-      ptrref.reset(celm.m_Value.Clone());
-      return true;
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + index));
+
+      // Bytes '\t' through '\r' are those no more than 4 past '\t'.
+      __m128i offset  = _mm_sub_epi8(chunk, tab);
+      __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(offset, four), offset);
+      __m128i white   = _mm_or_si128(control, _mm_cmpeq_epi8(chunk, space));
+      unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(white)) & 0xFFFF;
+      if (mask != 0)
+         return index + LowestBit(mask);
    }
+   return index + SkipSpaceScalar(data + index, length - index);
 }
 
-//--------------------------------------------------------------------
-// Parses an end tag from the XML document.  Caller is assumed
-// to have already read the "</" at the beginning of the tag,
-// leaving the "/" in CurChar().
-//
-// If successful, the current tag will be removed from the stack,
-// and a pointer to the end node will be returned in {ptrref}.
+NOMXML_TARGET("sse2")
+static size_t AsciiPrefixSse2(const char *data, size_t length)
+{
+   size_t index = 0;
+   for (; index + 16 <= length; index += 16)
+   {
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + index));
+      unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(chunk));
+      if (mask != 0)
+         return index + LowestBit(mask);
+   }
+   return index + AsciiPrefixScalar(data + index, length - index);
+}
+
+NOMXML_TARGET("sse2")
+static size_t FindSpecialSse2(const char *data, size_t length)
+{
+   const __m128i amp   = _mm_set1_epi8('&');
+   const __m128i lt    = _mm_set1_epi8('<');
+   const __m128i gt    = _mm_set1_epi8('>');
+   const __m128i quot  = _mm_set1_epi8('"');
+   const __m128i ctl   = _mm_set1_epi8(0x1F);
+   size_t index = 0;
+   for (; index + 16 <= length; index += 16)
+   {
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + index));
+      __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, lt)),
+                                     _mm_or_si128(_mm_cmpeq_epi8(chunk, gt), _mm_cmpeq_epi8(chunk, quot)));
+      special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(chunk, ctl), chunk));
+      unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+      if (mask != 0)
+         return index + LowestBit(mask);
+   }
+   return index + FindSpecialScalar(data + index, length - index);
+}
+
+NOMXML_TARGET("avx2")
+static size_t FindEitherAvx2(const char *data, size_t length, char a, char b)
+{
+   const __m256i va = _mm256_set1_epi8(a);
+   const __m256i vb = _mm256_set1_epi8(b);
+   size_t index = 0;
+   for (; index + 32 <= length; index += 32)
+   {
+      __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + index));
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+         _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb))));
+      if (mask != 0)
+         return index + LowestBit(mask);
+   }
+   return index + FindEitherSse2(data + index, length - index, a, b);
+}
+
+NOMXML_TARGET("avx2")
+static size_t SkipSpaceAvx2(const char *data, size_t length)
+{
+   const __m256i tab   = _mm256_set1_epi8('\t');
+   const __m256i four  = _mm256_set1_epi8(4);
+   const __m256i space = _mm256_set1_epi8(' ');
+   size_t index = 0;
+   for (; index + 32 <= length; index += 32)
+   {
+      __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + index));
+      __m256i offset  = _mm256_sub_epi8(chunk, tab);
+      __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, four), offset);
+      __m256i white   = _mm256_or_si256(control, _mm256_cmpeq_epi8(chunk, space));
+      unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(white));
+      if (mask != 0)
+         return index + LowestBit(mask);
+   }
+   return index + SkipSpaceSse2(data + index, length - index);
+}
+
+NOMXML_TARGET("avx2")
+static size_t AsciiPrefixAvx2(const char *data, size_t length)
+{
+   size_t index = 0;
+   for (; index + 32 <= length; index += 32)
+   {
+      __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + index));
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(chunk));
+      if (mask != 0)
+         return index + LowestBit(mask);
+   }
+   return index + AsciiPrefixSse2(data + index, length - index);
+}
+
+NOMXML_TARGET("avx2")
+static size_t FindSpecialAvx2(const char *data, size_t length)
+{
+   const __m256i amp   = _mm256_set1_epi8('&');
+   const __m256i lt    = _mm256_set1_epi8('<');
+   const __m256i gt    = _mm256_set1_epi8('>');
+   const __m256i quot  = _mm256_set1_epi8('"');
+   const __m256i ctl   = _mm256_set1_epi8(0x1F);
+   size_t index = 0;
+   for (; index + 32 <= length; index += 32)
+   {
+      __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + index));
+      __m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, amp), _mm256_cmpeq_epi8(chunk, lt)),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, gt), _mm256_cmpeq_epi8(chunk, quot)));
+      special = _mm256_or_si256(special, _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, ctl), chunk));
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+      if (mask != 0)
+         return index + LowestBit(mask);
+   }
+   return index + FindSpecialSse2(data + index, length - index);
+}
+
+NOMXML_TARGET("avx512f,avx512bw")
+static size_t FindEitherAvx512(const char *data, size_t length, char a, char b)
+{
+   const __m512i va = _mm512_set1_epi8(a);
+   const __m512i vb = _mm512_set1_epi8(b);
+   size_t index = 0;
+   for (; index + 64 <= length; index += 64)
+   {
+      __m512i chunk = _mm512_loadu_si512(data + index);
+      uint64_t mask = _mm512_cmpeq_epi8_mask(chunk, va) | _mm512_cmpeq_epi8_mask(chunk, vb);
+      if (mask != 0)
+         return index + LowestBit(mask);
+   }
+   return index + FindEitherAvx2(data + index, length - index, a, b);
+}
+
+NOMXML_TARGET("avx512f,avx512bw")
+static size_t SkipSpaceAvx512(const char *data, size_t length)
+{
+   const __m512i tab   = _mm512_set1_epi8('\t');
+   const __m512i four  = _mm512_set1_epi8(4);
+   const __m512i space = _mm512_set1_epi8(' ');
+   size_t index = 0;
+   for (; index + 64 <= length; index += 64)
+   {
+      __m512i chunk = _mm512_loadu_si512(data + index);
+      uint64_t white = _mm512_cmple_epu8_mask(_mm512_sub_epi8(chunk, tab), four) |
+                       _mm512_cmpeq_epi8_mask(chunk, space);
+      if (~white != 0)
+         return index + LowestBit(~white);
+   }
+   return index + SkipSpaceAvx2(data + index, length - index);
+}
+
+NOMXML_TARGET("avx512f,avx512bw")
+static size_t AsciiPrefixAvx512(const char *data, size_t length)
+{
+   size_t index = 0;
+   for (; index + 64 <= length; index += 64)
+   {
+      __m512i chunk = _mm512_loadu_si512(data + index);
+      uint64_t mask = _mm512_movepi8_mask(chunk);
+      if (mask != 0)
+         return index + LowestBit(mask);
+   }
+   return index + AsciiPrefixAvx2(data + index, length - index);
+}
+
+NOMXML_TARGET("avx512f,avx512bw")
+static size_t FindSpecialAvx512(const char *data, size_t length)
+{
+   const __m512i amp   = _mm512_set1_epi8('&');
+   const __m512i lt    = _mm512_set1_epi8('<');
+   const __m512i gt    = _mm512_set1_epi8('>');
+   const __m512i quot  = _mm512_set1_epi8('"');
+   const __m512i ctl   = _mm512_set1_epi8(0x1F);
+   size_t index = 0;
+   for (; index + 64 <= length; index += 64)
+   {
+      __m512i chunk = _mm512_loadu_si512(data + index);
+      uint64_t mask = _mm512_cmpeq_epi8_mask(chunk, amp) | _mm512_cmpeq_epi8_mask(chunk, lt) |
+                      _mm512_cmpeq_epi8_mask(chunk, gt) | _mm512_cmpeq_epi8_mask(chunk, quot) |
+                      _mm512_cmple_epu8_mask(chunk, ctl);
+      if (mask != 0)
+         return index + LowestBit(mask);
+   }
+   return index + FindSpecialAvx2(data + index, length - index);
+}
+
+#endif  // NOMXML_X86
+
+//--------------------------------------------------------------------
+// One version of every scanning kernel.
+//--------------------------------------------------------------------
+struct SimdKernels
+{
+   const wchar_t *m_Name;
+   size_t (*m_FindEither)(const char *data, size_t length, char a, char b);
+   size_t (*m_SkipSpace)(const char *data, size_t length);
+   size_t (*m_AsciiPrefix)(const char *data, size_t length);
+   size_t (*m_FindSpecial)(const char *data, size_t length);
+};
+
+// Every version of the kernels, from the most widely supported to the
+// least.  Each CPU supports some number of leading entries.
 //
+static const SimdKernels simdKernels[] =
+{
+   { L"scalar", FindEitherScalar, SkipSpaceScalar, AsciiPrefixScalar, FindSpecialScalar },
+#ifdef NOMXML_X86
+   { L"sse2",   FindEitherSse2,   SkipSpaceSse2,   AsciiPrefixSse2,   FindSpecialSse2   },
+   { L"avx2",   FindEitherAvx2,   SkipSpaceAvx2,   AsciiPrefixAvx2,   FindSpecialAvx2   },
+   { L"avx512", FindEitherAvx512, SkipSpaceAvx512, AsciiPrefixAvx512, FindSpecialAvx512 },
+#endif
+};
+
+//--------------------------------------------------------------------
+// Returns the number of leading entries of simdKernels that the CPU
+// and operating system support.
+//--------------------------------------------------------------------
+static size_t DetectSimdSupport(void)
+{
+   size_t count = 1;
+
+#ifdef NOMXML_X86
+   // regs[] receives eax, ebx, ecx and edx.
+   unsigned regs[4];
+   auto cpuid = [&regs](unsigned leaf)
+   {
+#ifdef _MSC_VER
+      int info[4];
+      __cpuidex(info, static_cast<int>(leaf), 0);
+      for (int index = 0; index < 4; ++index)
+         regs[index] = static_cast<unsigned>(info[index]);
+#else
+      __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+   };
+
+   cpuid(0);
+   unsigned maxleaf = regs[0];
+   cpuid(1);
+   if ((regs[3] & (1u << 26)) == 0)        // SSE2
+      return count;
+   count = 2;
+
+   // AVX2 and AVX-512 also need the operating system to save the wider
+   // registers, which it reports through XCR0.
+   //
+   bool osxsave = (regs[2] & (1u << 27)) != 0;
+   bool avx     = (regs[2] & (1u << 28)) != 0;
+   if (maxleaf < 7 || !osxsave || !avx)
+      return count;
+#ifdef _MSC_VER
+   uint64_t xcr0 = _xgetbv(0);
+#else
+   unsigned xcr0lo, xcr0hi;
+   __asm__ __volatile__("xgetbv" : "=a"(xcr0lo), "=d"(xcr0hi) : "c"(0));
+   uint64_t xcr0 = (static_cast<uint64_t>(xcr0hi) << 32) | xcr0lo;
+#endif
+
+   cpuid(7);
+   if ((xcr0 & 0x06) != 0x06 || (regs[1] & (1u << 5)) == 0)         // AVX2
+      return count;
+   count = 3;
+   if ((xcr0 & 0xE6) != 0xE6 || (regs[1] & (1u << 16)) == 0 ||      // AVX-512F
+       (regs[1] & (1u << 30)) == 0)                                 // AVX-512BW
+      return count;
+   count = 4;
+#endif
+
+   return count;
+}
+
+//--------------------------------------------------------------------
+// Returns the number of leading entries of simdKernels that can be
+// used, checking the CPU the first time only.
+//--------------------------------------------------------------------
+static size_t SimdSupport(void)
+{
+   static const size_t count = DetectSimdSupport();
+   return count;
+}
+
+// Kernels in use, or nullptr until the first time they're needed.
+static std::atomic<const SimdKernels *> activeKernels(nullptr);
+
+//--------------------------------------------------------------------
+// Retrieve the kernels in use, choosing the best ones if none have
+// been chosen yet.
+//--------------------------------------------------------------------
+static const SimdKernels &Simd(void)
+{
+   const SimdKernels *kernels = activeKernels.load();
+   if (kernels == nullptr)
+   {
+      kernels = &simdKernels[SimdSupport() - 1];
+      activeKernels.store(kernels);
+   }
+   return *kernels;
+}
+
+//--------------------------------------------------------------------
+// Returns true if the {length} bytes at {data} are well formed UTF-8,
+// using {kernels} to skip over runs of ASCII.
+//--------------------------------------------------------------------
+static bool ValidUtf8(const SimdKernels &kernels, const unsigned char *data, size_t length)
+{
+   size_t index = 0;
+   for (;;)
+   {
+      index += kernels.m_AsciiPrefix(reinterpret_cast<const char *>(data) + index, length - index);
+      if (index >= length)
+         return true;
+
+      // Work out how many continuation bytes should follow, and the
+      // range the first one must fall in to rule out overlong forms,
+      // surrogates and code points past U+10FFFF.
+      //
+      unsigned char lead = data[index];
+      unsigned char low = 0x80, high = 0xBF;
+      size_t extra;
+      if (lead >= 0xC2 && lead <= 0xDF)
+         extra = 1;
+      else if (lead == 0xE0)
+         extra = 2, low = 0xA0;
+      else if (lead == 0xED)
+         extra = 2, high = 0x9F;
+      else if (lead >= 0xE1 && lead <= 0xEF)
+         extra = 2;
+      else if (lead == 0xF0)
+         extra = 3, low = 0x90;
+      else if (lead >= 0xF1 && lead <= 0xF3)
+         extra = 3;
+      else if (lead == 0xF4)
+         extra = 3, high = 0x8F;
+      else
+         return false;
+
+      if (length - index <= extra)
+         return false;
+      if (data[index + 1] < low || data[index + 1] > high)
+         return false;
+      for (size_t follow = 2; follow <= extra; ++follow)
+         if ((data[index + follow] & 0xC0) != 0x80)
+            return false;
+      index += extra + 1;
+   }
+}
+
+//--------------------------------------------------------------------
+// Retrieve the names of the kernel versions this CPU supports into
+// {names}.
+//--------------------------------------------------------------------
+void XmlSimdSupported(std::vector<std::wstring> &names)
+{
+   names.clear();
+   for (size_t which = 0; which < SimdSupport(); ++which)
+      names.push_back(simdKernels[which].m_Name);
+}
+
+//--------------------------------------------------------------------
+// Returns the name of the kernel version in use.
+//--------------------------------------------------------------------
+const wchar_t *XmlSimdActive(void)
+{
+   return Simd().m_Name;
+}
+
+//--------------------------------------------------------------------
+// Use the kernel version named {name}, or the best one if {name} is
+// nullptr.  Returns false if the CPU doesn't support that version.
+//--------------------------------------------------------------------
+bool XmlSimdForce(const wchar_t *name)
+{
+   size_t supported = SimdSupport();
+   if (name == nullptr)
+   {
+      activeKernels.store(&simdKernels[supported - 1]);
+      return true;
+   }
+   for (size_t which = 0; which < supported; ++which)
+   {
+      if (wcscmp(simdKernels[which].m_Name, name) == 0)
+      {
+         activeKernels.store(&simdKernels[which]);
+         return true;
+      }
+   }
+   return false;
+}
+
+//--------------------------------------------------------------------
+// Check every supported kernel version against the scalar version on
+// {data}.  Returns false and describes the difference in {errorinfo}
+// if any version disagrees.
+//--------------------------------------------------------------------
+bool XmlSimdVerify(const void *data, size_t length, std::wstring &errorinfo)
+{
+   // Every offset near the start of the data is tried, then every
+   // 61st offset so that large documents don't take forever.  Each
+   // offset is scanned with a window long enough to cover several
+   // vectors and with a short one that usually ends mid-vector.
+   //
+   const size_t everyOffset = 65536;
+   const size_t offsetStep = 61;
+   const size_t longWindow = 300;
+   const size_t shortWindows = 67;
+
+   const char *bytes = static_cast<const char *>(data);
+   const SimdKernels &scalar = simdKernels[0];
+   for (size_t which = 1; which < SimdSupport(); ++which)
+   {
+      const SimdKernels &kernels = simdKernels[which];
+      for (size_t offset = 0; offset < length;
+           offset += (offset < everyOffset ? 1 : offsetStep))
+      {
+         size_t windows[2] = { std::min(length - offset, longWindow),
+                               std::min(length - offset, offset % shortWindows) };
+         for (size_t index = 0; index < 2; ++index)
+         {
+            const char *run = bytes + offset;
+            size_t count = windows[index];
+            const wchar_t *kernel = nullptr;
+            if (kernels.m_FindEither(run, count, '<', '\0') != scalar.m_FindEither(run, count, '<', '\0') ||
+                kernels.m_FindEither(run, count, '-', '-') != scalar.m_FindEither(run, count, '-', '-'))
+               kernel = L"find";
+            else if (kernels.m_SkipSpace(run, count) != scalar.m_SkipSpace(run, count))
+               kernel = L"whitespace";
+            else if (kernels.m_AsciiPrefix(run, count) != scalar.m_AsciiPrefix(run, count))
+               kernel = L"ASCII";
+            else if (kernels.m_FindSpecial(run, count) != scalar.m_FindSpecial(run, count))
+               kernel = L"escape";
+
+            if (kernel != nullptr)
+            {
+               errorinfo = L"The ";
+               errorinfo += kernels.m_Name;
+               errorinfo += L" version of the ";
+               errorinfo += kernel;
+               errorinfo += L" kernel disagrees with the scalar version at offset ";
+               errorinfo += std::to_wstring(offset);
+               errorinfo += L", length ";
+               errorinfo += std::to_wstring(count);
+               errorinfo += L".";
+               return false;
+            }
+         }
+      }
+
+      const unsigned char *ubytes = static_cast<const unsigned char *>(data);
+      if (ValidUtf8(kernels, ubytes, length) != ValidUtf8(scalar, ubytes, length))
+      {
+         errorinfo = L"The ";
+         errorinfo += kernels.m_Name;
+         errorinfo += L" version of the UTF-8 check disagrees with the scalar version.";
+         return false;
+      }
+   }
+
+   errorinfo.clear();
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Returns true if the {length} bytes at {data} are well formed UTF-8.
+//--------------------------------------------------------------------
+bool XmlIsValidUtf8(const void *data, size_t length)
+{
+   return ValidUtf8(Simd(), static_cast<const unsigned char *>(data), length);
+}
+
+//--------------------------------------------------------------------
+// Append the {count} bytes at {data} onto {text}, widening each one
+// as a Latin-1 character the same way XmlMemoryInputInterface does.
+//--------------------------------------------------------------------
+static void AppendBytes(std::wstring &text, const char *data, size_t count)
+{
+   size_t start = text.size();
+   text.resize(start + count);
+   for (size_t index = 0; index < count; ++index)
+      text[start + index] = static_cast<unsigned char>(data[index]);
+}
+
+//--------------------------------------------------------------------
+// Construct.
+//--------------------------------------------------------------------
+XmlParser::XmlParser() :
+   m_PriorTagType(XmlNodeBase::XmlNodeType_Invalid),
+   m_PriorWasEmptyTag(false),
+   m_Memory(nullptr), m_MemorySize(0),
+   m_DataSize(0), m_DataPos(0), m_RangeEnd(noRangeEnd),
+   m_PausePos(noRangeEnd), m_PendingCloser(0), m_PendingState(0),
+   m_Cancel(nullptr), m_Deadline(std::chrono::steady_clock::time_point::max()),
+   m_CheckBytes(0), m_CheckPos(0), m_StopReason(nullptr),
+   m_OutsideFrom(0), m_OutsideTo(0), m_CurChar('\0'),
+   m_Fingerprints(false), m_KeepAllText(false), m_StopFollowing(false)
+{
+#ifdef _DUMP
+   wprintf(L"XmlParser constructing.\n");
+   fflush(stdout);
+#endif
+}
+
+//--------------------------------------------------------------------
+// Destruct.
+//--------------------------------------------------------------------
+XmlParser::~XmlParser()
+{
+#ifdef _DUMP
+   wprintf(L"XmlParser destructing.\n");
+   fflush(stdout);
+#endif
+   Reset();
+}
+
+//--------------------------------------------------------------------
+// Begin parsing the XML document that was just opened.
 // Returns false if error.
 //--------------------------------------------------------------------
-bool XmlParser::ParseEndTagNode(std::unique_ptr<XmlNodeBase> &ptrref)
+bool XmlParser::BeginParsingImpl(void)
+{
+   if (!m_Reader)
+      return false;
+
+   // Initialize file position tracking.
+   //
+   m_DataSize = m_Reader->GetFileLength();
+
+#ifdef _DUMP
+   wprintf(L"File length:  %Iu characters\n", m_DataSize);
+   fflush(stdout);
+#endif
+
+   // Prime the current character.
+   //
+   if (!NextChar())
+   {
+      m_ErrorInfo = L"Empty document.  No XML tags found.";
+      return false;
+   }
+
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Begin parsing XML document contained in file {filename}.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::BeginParsingFromFile(const wchar_t *filename)
+{
+#ifdef _DUMP
+   wprintf(L"XmlParser::BeginParsingFromFile(\"%s\")\n", filename);
+   fflush(stdout);
+#endif
+
+   Reset();
+   FILE *fp = nullptr;
+   if (_wfopen_s(&fp, filename, L"rb") || fp == nullptr)
+   {
+      m_ErrorInfo = L"Failed opening input file:  ";
+      m_ErrorInfo += filename;
+      return false;
+   }
+   XmlFileInputInterface reader(fp);
+   m_Reader.reset(reader.Clone());
+
+   return BeginParsingImpl();
+}
+
+//--------------------------------------------------------------------
+// Begin parsing XML document contained in file {filename}, waiting
+// for more data whenever the end of the file is reached.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::BeginFollowingFile(const wchar_t *filename, unsigned pollms, unsigned idlems)
+{
+#ifdef _DUMP
+   wprintf(L"XmlParser::BeginFollowingFile(\"%s\")\n", filename);
+   fflush(stdout);
+#endif
+
+   Reset();
+   FILE *fp = nullptr;
+   if (_wfopen_s(&fp, filename, L"rb") || fp == nullptr)
+   {
+      m_ErrorInfo = L"Failed opening input file:  ";
+      m_ErrorInfo += filename;
+      return false;
+   }
+   m_StopFollowing = false;
+   XmlFollowInputInterface reader(fp, std::max(pollms, 1u), idlems, &m_StopFollowing);
+   m_Reader.reset(reader.Clone());
+
+   return BeginParsingImpl();
+}
+
+//--------------------------------------------------------------------
+// Tell a parser started with BeginFollowingFile to stop waiting for
+// more data.  May be called from any thread.
+//--------------------------------------------------------------------
+void XmlParser::StopFollowing(void)
+{
+   m_StopFollowing = true;
+}
+
+//--------------------------------------------------------------------
+// Make parsing fail once {*cancel} becomes true or {deadline} passes,
+// checking every {checkbytes} bytes.  See nomxml.h for details.
+//--------------------------------------------------------------------
+void XmlParser::SetLimits(const std::atomic<bool> *cancel, std::chrono::steady_clock::time_point deadline,
+                          size_t checkbytes)
+{
+   m_Cancel = cancel;
+   m_Deadline = deadline;
+   m_CheckBytes = std::max(checkbytes, (size_t)1);
+   m_CheckPos = 0;
+}
+
+//--------------------------------------------------------------------
+// Begin parsing XML document contained in file {filename}.
+// Returns false if error.
+// Overload of above for callers that want to use a narrow
+// filename string.
+//--------------------------------------------------------------------
+bool XmlParser::BeginParsingFromFile(const char *filename)
+{
+#ifdef _DUMP
+   printf("XmlParser::BeginParsingFromFile(\"%s\")\n", filename);
+   fflush(stdout);
+#endif
+
+   // Note the simple narrow-to-wide conversion doesn't take foreign
+   // character code pages etc. into account.
+   std::wstring filenameW;
+   while (*filename)
+      filenameW += static_cast<wchar_t>(*filename++);
+
+   return BeginParsingFromFile(filenameW.c_str());
+}
+
+//--------------------------------------------------------------------
+// Begin parsing XML document contained in the memory block pointed
+// to by {data}.
+// The memory block is {numbytes} in size.
+// The memory block must remain accessible until parsing is completed.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::BeginParsingFromMemory(const void *data, size_t numbytes)
+{
+#ifdef _DUMP
+   printf("XmlParser::BeginParsingFromMemory(data:%p, numbytes:%Iu)\n", data, numbytes);
+   fflush(stdout);
+#endif
+
+   Reset();
+   XmlMemoryInputInterface reader(data, numbytes);
+   m_Reader.reset(reader.Clone());
+   m_Memory = static_cast<const char *>(data);
+   m_MemorySize = numbytes;
+
+   return BeginParsingImpl();
+}
+
+//--------------------------------------------------------------------
+// Begin parsing {count} records of {index} starting with record
+// {first}, from the document in memory at {data}, {numbytes} in size.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::BeginParsingRecords(const void *data, size_t numbytes, const XmlRecordIndex &index,
+                                    size_t first, size_t count)
+{
+   if (count == 0 || first >= index.m_Records.size() || count > index.m_Records.size() - first)
+   {
+      Reset();
+      m_ErrorInfo = L"Invalid range of records.";
+      return false;
+   }
+
+   const XmlRecordSpan &begin = index.m_Records[first];
+   const XmlRecordSpan &last = index.m_Records[first + count - 1];
+   if (begin.m_Context >= index.m_Contexts.size())
+   {
+      Reset();
+      m_ErrorInfo = L"Invalid record index.";
+      return false;
+   }
+   return BeginParsingFromMemory(data, numbytes) &&
+          BeginParsingRange(begin.m_Offset, last.m_Offset + last.m_Length, index.m_Contexts[begin.m_Context]);
+}
+
+//--------------------------------------------------------------------
+// Begin parsing XML document using the specified interface to read
+// the file.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::BeginParsingFromInterface(XmlStreamInputInterface *iface)
+{
+#ifdef _DUMP
+   printf("XmlParser::BeginParsingFromInterface(iface:%p)\n", iface);
+   fflush(stdout);
+#endif
+
+   Reset();
+   m_Reader.reset(iface->Clone());
+
+   return BeginParsingImpl();
+}
+
+//--------------------------------------------------------------------
+// Restrict parsing of the document that was just opened to the bytes
+// from {offset} up to {endoffset}, as if the elements in {context}
+// were already open.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::BeginParsingRange(size_t offset, size_t endoffset, const std::vector<XmlBeginNode> &context)
+{
+#ifdef _DUMP
+   wprintf(L"XmlParser::BeginParsingRange(offset:%Iu, endoffset:%Iu)\n", offset, endoffset);
+   fflush(stdout);
+#endif
+
+   if (!m_Reader)
+   {
+      m_ErrorInfo = L"No document is open.";
+      return false;
+   }
+   if (offset > endoffset || !m_Reader->Seek(offset))
+   {
+      m_ErrorInfo = L"Invalid range of document.";
+      return false;
+   }
+
+   m_Stack.clear();
+   for (auto beginp = context.begin(); beginp != context.end(); ++beginp)
+   {
+      XmlElementBase elm;
+      elm.m_Begin = *beginp;
+      elm.m_Begin.m_Depth = elm.m_Value.m_Depth = elm.m_End.m_Depth = m_Stack.size();
+      m_Stack.push_back(elm);
+   }
+   m_PriorWasEmptyTag = false;
+   m_ErrorInfo.clear();
+   m_DataPos = offset;
+   m_RangeEnd = endoffset;
+   m_SkippedEnds.clear();
+   m_PendingCloser = 0;
+   m_CheckPos = 0;
+   m_StopReason = nullptr;
+
+   // Prime the current character.
+   //
+   if (!NextChar())
+   {
+      m_ErrorInfo = L"Empty range.  No XML tags found.";
+      return false;
+   }
+
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Parses the value portion of an XML tag, meaning the text that
+// appears between the begin tag and the end tag.  Caller is
+// assumed to have already determined that it is time to parse
+// the tag value.  If the caller already read some of the
+// characters of the value text, they should be passed in {prefix}.
+//
+// The value node will be added to the current tag on the stack
+// if successful, with a copy of the node being returned in {ptrref}.
+//
+// Returns false if error or no more data.
+//--------------------------------------------------------------------
+bool XmlParser::ParseTagValueNode(const std::wstring &prefix, std::unique_ptr<XmlNodeBase> &ptrref)
+{
+   std::wstring token = prefix;
+
+   // Any characters between here and the next tag become part of the current
+   // tag's value.
+   //
+   while (CurChar() != 0 && CurChar() != '<')
+   {
+      // Take the whole run of text up to the next tag at once if the
+      // document is in memory.
+      const char *run;
+      size_t available = MemoryRun(run);
+      if (available != 0)
+      {
+         size_t count = Simd().m_FindEither(run, available, '<', '\0');
+         AppendBytes(token, run, count);
+         SkipChars(count);
+         continue;
+      }
+
+      token += CurChar();
+      NextChar();
+   }
+
+   // If the stack of tags is empty, then the XML document apparently has
+   // garbage text outside any tags.  This is okay if it's just whitespace,
+   // but not okay if it's anything else.
+   //
+   if (m_Stack.empty())
+   {
+      if (!IsWhiteSpace(token))
+      {
+         m_ErrorInfo = L"Unexpected data outside of all tags:  '";
+         m_ErrorInfo += token;
+         m_ErrorInfo += L"'";
+      }
+      // else we probably just read some whitespace at the end of
+      // the XML document.
+      return false;
+   }
+   else if (CurChar() == 0 && IsWhiteSpace(token))
+   {
+      // Reached the end of the input with elements still open.  That's
+      // expected at the end of a range of the document, but otherwise
+      // the document was cut short.
+      if (m_RangeEnd == noRangeEnd)
+      {
+         m_ErrorInfo = L"Premature end of document, missing end tag for:  ";
+         m_ErrorInfo += m_Stack[m_Stack.size() - 1].m_Begin.m_Name;
+      }
+      return false;
+   }
+   else
+   {
+      XmlElementBase & celm = m_Stack[m_Stack.size() - 1];
+      celm.m_Value.m_Name = celm.m_Begin.m_Name;
+      celm.m_Value.m_Value = token;
+      if (m_Fingerprints)
+         HashValueText(celm.m_End.m_Hash, token);
+      ptrref.reset(celm.m_Value.Clone());
+      return true;
+   }
+}
+
+//--------------------------------------------------------------------
+// Parses an end tag from the XML document.  Caller is assumed
+// to have already read the "</" at the beginning of the tag,
+// leaving the "/" in CurChar().
+//
+// If successful, the current tag will be removed from the stack,
+// and a pointer to the end node will be returned in {ptrref}.
+//
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::ParseEndTagNode(std::unique_ptr<XmlNodeBase> &ptrref)
+{
+   NextChar();    // Eat the '/'
+
+   if (!NextToken(CharClass_AttribEnd))
+   {
+      m_ErrorInfo = L"Unexpected end of input.";
+      return false;
+   }
+   std::wstring token = CurToken();
+
+   if (CurChar() != '>')
+   {
+      m_ErrorInfo = L"Expected '>' at end of tag:  ";
+      m_ErrorInfo += CurToken();
+      return false;
+   }
+   NextChar();    // Eat the '>'
+
+   // When parsing a range, this may end an element that was opened
+   // before the range began.  Skip it.
+   if (m_Stack.empty() && m_RangeEnd != noRangeEnd)
+   {
+      m_SkippedEnds.push_back(token);
+      return NextNode(ptrref);
+   }
+
+   if (m_Stack.empty())
+   {
+      m_ErrorInfo = L"Unexpected end tag outside of all tags:  ";
+      m_ErrorInfo += token;
+      return false;
+   }
+
+   XmlElementBase & celm = m_Stack[m_Stack.size() - 1];
+   if (wcscmp(token.c_str(), celm.m_Begin.m_Name.c_str()) != 0)
+   {
+      m_ErrorInfo = L"Mismatched end tag, found '";
+      m_ErrorInfo += token;
+      m_ErrorInfo += L"', expected '";
+      m_ErrorInfo += celm.m_Begin.m_Name;
+      m_ErrorInfo += L"'";
+      return false;
+   }
+   celm.m_End.m_Name = celm.m_Begin.m_Name;
+   celm.m_End.m_Offset = CurCharOffset();
+   PopElement(ptrref);
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Skips characters up to and including the first closer made of two
+// of the character {repeated} followed by '>', such as "-->".  Runs of
+// text that can't hold a closer are skipped at once if the document is
+// in memory.  Stops early at m_PausePos, setting m_PendingCloser so
+// that a later call carries on from there.  Returns false if the
+// document ends first.
+//--------------------------------------------------------------------
+bool XmlParser::EatThroughCloser(char repeated)
+{
+#ifdef NOMXML_BASELINE_LEXER
+   m_PendingCloser = 0;
+   for (;;)
+   {
+      if (m_DataPos >= m_PausePos)
+      {
+         m_PendingCloser = repeated;
+         return true;
+      }
+      if (CurChar() == repeated)
+      {
+         NextChar();
+         if (CurChar() == repeated)
+         {
+            NextChar();
+            if (CurChar() == '>')
+            {
+               // Found the closer.
+               if (!NextChar()) // Eat the '>'
+                  break;
+               return true;
+            }
+         }
+      }
+      else if (!NextChar())
+         break;
+   }
+
+   m_ErrorInfo = L"Unexpected end of input.";
+   return false;
+#else
+   unsigned repeatedclass = CharClassOf(repeated);
+   unsigned state = (m_PendingCloser != 0) ? m_PendingState : static_cast<unsigned>(Closer_None);
+   bool more = true;
+
+   m_PendingCloser = 0;
+   while (more && state != Closer_Done)
+   {
+      if (m_DataPos >= m_PausePos)
+      {
+         m_PendingCloser = repeated;
+         m_PendingState = static_cast<unsigned char>(state);
+         return true;
+      }
+
+      if (state == Closer_None && CurChar() != repeated)
+      {
+         const char *run;
+         size_t available = std::min(MemoryRun(run), m_PausePos - m_DataPos);
+         if (available != 0)
+         {
+            more = SkipChars(Simd().m_FindEither(run, available, repeated, repeated));
+            continue;
+         }
+      }
+
+      unsigned classes = CharClassOf(CurChar());
+      unsigned input = (classes & repeatedclass) ? CloserInput_Repeated :
+                       (classes & CharClass_Close) ? CloserInput_Close : CloserInput_Other;
+      state = closerStates[state][input];
+      more = NextChar();
+   }
+
+   if (!more)
+   {
+      m_ErrorInfo = L"Unexpected end of input.";
+      return false;
+   }
+   return true;
+#endif
+}
+
+//--------------------------------------------------------------------
+// Skips the remainder of a comment, up to and including the "-->" at
+// the end of the comment.  Assumes the "<!--" at the beginning of the
+// comment has already been processed.
+//--------------------------------------------------------------------
+bool XmlParser::EatComment(void)
+{
+   return EatThroughCloser('-');
+}
+
+//--------------------------------------------------------------------
+// Skips the remainder of a marked section, up to and including the
+// "]]>" at the end of the section.  Assumes the "<![" at the beginning
+// of the section has already been processed.
+//--------------------------------------------------------------------
+bool XmlParser::EatMarkedSection(void)
+{
+   return EatThroughCloser(']');
+}
+
+//--------------------------------------------------------------------
+// Reads the text of a CDATA section into {text}, up to and including
+// the "]]>" at the end of the section.  The characters '&', '<' and
+// '>' are escaped as references, so that {text} reads like any other
+// value text.  Assumes the "<![CDATA[" at the beginning of the section
+// has already been processed.  Returns false if the document ends
+// first.
+//--------------------------------------------------------------------
+bool XmlParser::ReadCData(std::wstring &text)
+{
+   text.clear();
+   size_t brackets = 0;
+   while (CurChar() != 0)
+   {
+      // Take runs of plain text at once if the document is in memory.
+      const char *run;
+      size_t available = MemoryRun(run);
+      size_t count = 0;
+      while (count < available && strchr("]&<>", run[count]) == nullptr)
+         ++count;
+      if (count != 0)
+      {
+         AppendBytes(text, run, count);
+         brackets = 0;
+         if (!SkipChars(count))
+            break;
+      }
+
+      wchar_t c = CurChar();
+      if (c == 0)
+         break;
+      NextChar();
+      if (c == '>' && brackets >= 2)
+      {
+         // Drop the "]]" before the '>'.
+         text.resize(text.size() - 2);
+         return true;
+      }
+      brackets = (c == ']') ? brackets + 1 : 0;
+
+      if (c == '&')
+         text += L"&amp;";
+      else if (c == '<')
+         text += L"&lt;";
+      else if (c == '>')
+         text += L"&gt;";
+      else
+         text += c;
+   }
+
+   m_ErrorInfo = L"Unexpected end of input.";
+   return false;
+}
+
+//--------------------------------------------------------------------
+// Reads the data of a processing instruction into {data} as written,
+// up to the "?>" at the end of the instruction, and eats the '?'.
+// Assumes the instruction's target and the whitespace after it have
+// already been processed.  Returns false if the document ends first.
+//--------------------------------------------------------------------
+bool XmlParser::ReadInstructionData(std::wstring &data)
+{
+   data.clear();
+   while (CurChar() != 0)
+   {
+      wchar_t c = CurChar();
+      NextChar();
+      if (c == '?' && CurChar() == '>')
+         return true;
+      data += c;
+   }
+
+   m_ErrorInfo = L"Unexpected end of input.";
+   return false;
+}
+
+//--------------------------------------------------------------------
+// Parses a tag that starts with "<!" from the XML document.
+// Caller is assumed to have already read the "<!" at the
+// beginning of the tag, leaving the "!" in CurChar().
+//
+// If the tag is a comment, such as "<!--comment-->" the,
+// comment is skipped and the next node after the comment is
+// parsed and returned in {ptrref}.
+//
+// If the tag is a marked section, such as "<![CDATA[...]]>",
+// it is skipped and the next node after the marked section
+// is parsed and returned in {ptrref}.  If KeepAllText is
+// enabled, the text of a CDATA section is instead returned
+// as a value node, along with any value text after it.
+//
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::ParseBangTag(std::unique_ptr<XmlNodeBase> &ptrref)
+{
+   NextChar();       // Eat the '!'
+   wchar_t c1 = CurChar();
+   NextChar();       // Eat the '-' or '['
+
+   if (c1 == '[')
+   {
+      // Check for a CDATA section whose text is wanted.
+      const wchar_t *keyword = L"CDATA[";
+      while (m_KeepAllText && *keyword != 0 && CurChar() == *keyword)
+      {
+         NextChar();
+         ++keyword;
+      }
+
+      if (m_KeepAllText && *keyword == 0)
+      {
+         std::wstring text;
+         if (!ReadCData(text))
+            return false;
+         if (!text.empty() && !m_Stack.empty())
+            return ParseTagValueNode(text, ptrref);
+      }
+      else
+         EatMarkedSection();
+
+      // Leave the rest to a later call if ParseSome's budget ran out.
+      if (m_DataPos >= m_PausePos && m_ErrorInfo.empty())
+         return true;
+
+      // Recursively parse the next node.
+      return NextNode(ptrref);
+   }
+   else if (c1 == '-' && CurChar() == '-')
+   {
+      NextChar();    // Eat the '-'
+      EatComment();
+
+      // Leave the rest to a later call if ParseSome's budget ran out.
+      if (m_DataPos >= m_PausePos && m_ErrorInfo.empty())
+         return true;
+
+      // Recursively parse the next node.
+      return NextNode(ptrref);
+   }
+   else
+   {
+      m_ErrorInfo = L"Malformed tag beginning with '!'";
+      return false;
+   }
+}
+
+//--------------------------------------------------------------------
+// Parses a begin tag from the XML document.  Caller is assumed
+// to have already read the "<" at the beginning of the tag,
+// leaving CurChar() at the next character after the "<".
+// Caller is also assumed to have already handled any possible
+// end tag, comment tag, etc., that could have been initiated
+// by the "<".
+//
+// This handles begin tags of the form:
+//    <name [attrib1[=value1] [attrib2[=value2] ...]] [/]>
+//    <?name [attrib1[=value1] [attrib2[=value2] ...]] ?>
+//
+// Note that due to some malformed XML files, the following form
+// may also be encountered in the real world.  Note the slash
+// at the end that should not be there.
+//    <?name [attrib1[=value1] [attrib2[=value2] ...]] ?/>
+//
+// If KeepAllText is enabled, the data of a processing instruction
+// other than the XML declaration is kept as written instead of
+// being read as attributes.
+//
+// If successful, the a new tag will be added to the stack,
+// and a pointer to the begin node will be returned in {ptrref}.
+//
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::ParseBeginTagNode(std::unique_ptr<XmlNodeBase> &ptrref)
+{
+#ifdef _DUMP
+   wprintf(L"ParseBeginTagNode  m_DataPos=%Iu\n", m_DataPos);
+#endif
+
+   size_t tagoffset = m_DataPos - 2;
+
+   // First check for '?' immediately after the '<'.
+   bool bQuestionMarked = false;
+   if (CurChar() == '?')
+   {
+      bQuestionMarked = true;
+      NextChar();
+   }
+
+   // Get the tag's name.
+   if (!NextToken(CharClass_NameEnd))
+   {
+      m_ErrorInfo = L"Unexpected end of input.";
+      return false;
+   }
+   std::wstring token = CurToken();
+
+   XmlElementBase elm;
+   elm.m_Begin.m_Name = token;
+   elm.m_Begin.m_Offset = tagoffset;
+   elm.m_Begin.m_Instruction = bQuestionMarked;
+
+   // Keep the instruction's data as written if asked, which also
+   // reads the trailing question mark.
+   bool datakept = bQuestionMarked && m_KeepAllText && token != L"xml";
+   if (datakept && !ReadInstructionData(elm.m_Begin.m_Data))
+      return false;
+
+   // Now parse the tag's attributes, if any.
+   while (!datakept && CurChar() != '/' && CurChar() != '>' && CurChar() != '?')
+   {
+      if (CurChar() == 0)
+      {
+         m_ErrorInfo = L"Unexpected end of input.";
+         return false;
+      }
+      if (CurChar() == '<')
+      {
+         // Neither an attribute nor the end of the tag, and NextToken
+         // won't move past it.
+         m_ErrorInfo = L"Unexpected '<' inside tag.";
+         return false;
+      }
+
+      NextToken(CharClass_AttribEnd);
+      std::wstring attribname = CurToken();
+
+      XmlAttribute att;
+      att.m_Name = attribname;
+
+      if (CurChar() == '=')
+      {
+         NextChar();
+         NextToken(CharClass_AttribEnd);
+         att.m_Value = CurToken();
+      }
+
+      elm.m_Begin.m_Attribs.push_back(att);
+   }
+
+   // If there was a starting question mark, check for the ending
+   // question mark.
+   if (bQuestionMarked)
+   {
+      if (!datakept)
+      {
+         if (CurChar() != '?')
+         {
+            // Expected trailing question mark.
+            m_ErrorInfo = L"Expected '?' at end of tag.";
+            return false;
+         }
+         NextChar();
+      }
+
+      // Question marked tag is always empty (has no value portion and no separate end tag).
+      m_PriorWasEmptyTag = true;
+      elm.m_End.m_Name = elm.m_Begin.m_Name;
+   }
+
+   // Check if the tag ends with a slash, which indicates that there
+   // will not be a separate ending tag for this tag.
+   if (CurChar() == '/')
+   {
+      // Tag is empty (has no value portion and no separate end tag).
+      m_PriorWasEmptyTag = true;
+      NextChar();
+      elm.m_End.m_Name = elm.m_Begin.m_Name;
+   }
+
+   // Lastly, check for the trailing marker.
+   if (CurChar() != '>')
+   {
+      m_ErrorInfo = L"Expected '>' at end of tag.";
+      return false;
+   }
+   NextChar(); // Eat the trailing '>'
+   if (m_PriorWasEmptyTag)
+      elm.m_End.m_Offset = CurCharOffset();
+
+   if (m_Fingerprints)
+      elm.m_End.m_Hash = HashBeginNode(elm.m_Begin);
+
+   elm.m_Begin.m_Depth = elm.m_Value.m_Depth = elm.m_End.m_Depth = m_Stack.size();
+   ptrref.reset(elm.m_Begin.Clone());
+   m_Stack.push_back(elm);
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Remove the current element from the stack, returning a copy of its
+// end node in {ptrref}.  If fingerprints are enabled, the element's
+// fingerprint is completed and mixed into its parent's fingerprint.
+//--------------------------------------------------------------------
+void XmlParser::PopElement(std::unique_ptr<XmlNodeBase> &ptrref)
+{
+   XmlElementBase & celm = m_Stack[m_Stack.size() - 1];
+   if (m_Fingerprints)
+   {
+      // Mark the end of the element so that a child's contents can't
+      // be confused with the contents of its following sibling.
+      HashValue(celm.m_End.m_Hash, 0xFFFFFFFE);
+      if (m_Stack.size() > 1)
+         HashValue(m_Stack[m_Stack.size() - 2].m_End.m_Hash, celm.m_End.m_Hash);
+   }
+   ptrref.reset(celm.m_End.Clone());
+   m_Stack.erase(m_Stack.begin() + m_Stack.size() - 1);
+}
+
+//--------------------------------------------------------------------
+// Parse the next XmlNode from the XML document.
+// Returns false if parsing error or no more nodes in document.
+//--------------------------------------------------------------------
+bool XmlParser::NextNode(std::unique_ptr<XmlNodeBase> &ptrref)
+{
+   bool result = ParseNextNode(ptrref);
+
+   // If the limits stopped parsing part way through, the node may be
+   // incomplete, and whatever error the parsing ran into at the
+   // missing characters is beside the point.
+   if (m_StopReason != nullptr)
+   {
+      ptrref.reset(nullptr);
+      m_ErrorInfo = m_StopReason;
+      return false;
+   }
+   return result;
+}
+
+//--------------------------------------------------------------------
+// Parse nodes into {handler} until {maxnodes} nodes or {maxbytes} bytes
+// have been parsed, with zero meaning no limit.  Returns whether the
+// document has more nodes, is finished, or failed.
+//--------------------------------------------------------------------
+XmlParser::ParseStatus XmlParser::ParseSome(XmlParseHandler &handler, size_t maxnodes, size_t maxbytes)
+{
+   size_t start = m_DataPos;
+   if (maxbytes != 0 && maxbytes < noRangeEnd - start)
+      m_PausePos = start + maxbytes;
+
+   // NextNode returns no node if it stopped part way through a comment
+   // or marked section at m_PausePos.
+   ParseStatus status = ParseStatus_More;
+   std::unique_ptr<XmlNodeBase> node;
+   size_t count = 0;
+   while ((maxnodes == 0 || count < maxnodes) && m_DataPos < m_PausePos)
+   {
+      if (!NextNode(node))
+      {
+         status = m_ErrorInfo.empty() ? ParseStatus_Done : ParseStatus_Error;
+         break;
+      }
+      if (!node)
+         continue;
+      ++count;
+      if (!handler.Node(*node))
+      {
+         m_ErrorInfo = L"Parsing was stopped by the handler.";
+         status = ParseStatus_Error;
+         break;
+      }
+   }
+
+   m_PausePos = noRangeEnd;
+   return status;
+}
+
+//--------------------------------------------------------------------
+// Does the work of NextNode.
+//--------------------------------------------------------------------
+bool XmlParser::ParseNextNode(std::unique_ptr<XmlNodeBase> &ptrref)
+{
+   ptrref.reset(nullptr);
+
+   // Finish any comment or marked section that ParseSome left part way
+   // through, unless its budget runs out again first.
+   if (m_PendingCloser != 0)
+   {
+      EatThroughCloser(m_PendingCloser);
+      if (m_DataPos >= m_PausePos && m_ErrorInfo.empty())
+         return true;
+   }
+
+   // If prior begin tag was actually an empty tag (begin and end in one tag),
+   // we now have to generate the end tag node for it.
+   if (m_PriorWasEmptyTag && !m_Stack.empty())
+   {
+      m_PriorWasEmptyTag = false;
+      PopElement(ptrref);
+      return true;
+   }
+
+   // Accumulate any leading whitespace.
+   //
+   std::wstring token;
+   while (CharClassOf(CurChar()) & CharClass_Space)
+   {
+      const char *run;
+      size_t available = MemoryRun(run);
+      size_t count = (available != 0 ? Simd().m_SkipSpace(run, available) : 0);
+      if (count != 0)
+      {
+         AppendBytes(token, run, count);
+         SkipChars(count);
+         continue;
+      }
+
+      token += CurChar();
+      NextChar();
+   }
+
+   // Whitespace right before a tag is normally dropped, but may be
+   // wanted as a value node of its own.
+   //
+   if (CurChar() == '<' && m_KeepAllText && !token.empty() && !m_Stack.empty())
+      return ParseTagValueNode(token, ptrref);
+
+   // Determine if we're parsing a tag or value.
+   //
+   if (CurChar() == '<')
+   {
+      // We're parsing a tag.
+      // It should be in one of the following formats:
+      //
+      //    <name [attrib1[=value1] [attrib2[=value2] ...]] [/]>
+      //    <?name [attrib1[=value1] [attrib2[=value2] ...]] ?>
+      //    </name>
+      //    <!-- comment -->
+      //
+      // Anything else is assumed to be the value text that comes between
+      // a begin tag and an end tag.
+
+      NextChar();
+      if (CurChar() == '/')
+      {
+         // Parse end tag.
+         return ParseEndTagNode(ptrref);
+      }
+
+      // Check for possible comment tag.
+      if (CurChar() == '!')
+      {
+         // Note that this actually parses the comment and the
+         // node that comes after the comment.
+         //
+         return ParseBangTag(ptrref);
+      }
+
+      // Must be a begin tag.
+      //
+      return ParseBeginTagNode(ptrref);
+   }
+   else
+   {
+      // This must be the value portion a.k.a. the content between
+      // a start tag and end tag.
+      //
+      return ParseTagValueNode(token, ptrref);
+   }
+}
+
+//--------------------------------------------------------------------
+// Parse the remainder of the XML document into a tree of elements.
+// The top-level elements of the document become children of {root}.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::ParseTree(XmlElementTree &root)
+{
+   // Chain of elements currently open in the tree.  Each entry lives
+   // in the m_Children of the entry before it, and children are only
+   // ever added to the last entry, so the pointers stay valid.
+   std::vector<XmlElementTree *> open;
+   open.push_back(&root);
+
+   std::unique_ptr<XmlNodeBase> node;
+   while (NextNode(node))
+   {
+      XmlElementTree *celm = open[open.size() - 1];
+      switch (node->m_Type)
+      {
+         case XmlNodeBase::XmlNodeType_Begin:
+            celm->m_Children.push_back(XmlElementTree());
+            celm->m_Children[celm->m_Children.size() - 1].m_Begin = *static_cast<XmlBeginNode *>(node.get());
+            celm->m_Children[celm->m_Children.size() - 1].m_Value.m_Depth = node->m_Depth;
+            open.push_back(&celm->m_Children[celm->m_Children.size() - 1]);
+            break;
+
+         case XmlNodeBase::XmlNodeType_Value:
+            // Text interrupted by child elements arrives as several
+            // value nodes, so keep all of it.
+            celm->m_Value.m_Name = node->m_Name;
+            celm->m_Value.m_Depth = node->m_Depth;
+            celm->m_Value.m_Value += static_cast<XmlValueNode *>(node.get())->m_Value;
+            break;
+
+         case XmlNodeBase::XmlNodeType_End:
+            celm->m_End = *static_cast<XmlEndNode *>(node.get());
+            if (open.size() > 1)
+               open.erase(open.begin() + open.size() - 1);
+            break;
+
+         default:
+            m_ErrorInfo = L"Invalid node type.";
+            return false;
+      }
+   }
+
+   if (!m_ErrorInfo.empty())
+      return false;
+
+   if (open.size() > 1)
+   {
+      m_ErrorInfo = L"Premature end of document, missing end tag for:  ";
+      m_ErrorInfo += open[open.size() - 1]->m_Begin.m_Name;
+      return false;
+   }
+
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Add {delta} to every offset in {elm} and its descendants.
+//--------------------------------------------------------------------
+static void ShiftOffsets(XmlElementTree &elm, ptrdiff_t delta)
+{
+   elm.m_Begin.m_Offset += delta;
+   elm.m_End.m_Offset += delta;
+   for (auto childp = elm.m_Children.begin(); childp != elm.m_Children.end(); ++childp)
+      ShiftOffsets(*childp, delta);
+}
+
+//--------------------------------------------------------------------
+// Reparse the {length} bytes at {offset} in the memory block {data},
+// which must hold exactly one complete element, into {result}.  The
+// element is parsed inside the elements whose begin nodes are in
+// {context}, so its nodes have their real depths and offsets.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::ReparseElement(XmlElementTree &result, const void *data, size_t numbytes, size_t offset, size_t length,
+                               const std::vector<XmlBeginNode> &context)
+{
+   if (offset + length > numbytes)
+      return false;
+
+   XmlElementTree fragment;
+   if (!BeginParsingFromMemory(data, numbytes) ||
+       !BeginParsingRange(offset, offset + length, context) ||
+       !ParseTree(fragment))
+      return false;
+   if (fragment.m_Children.size() != 1 || fragment.m_Children[0].m_End.m_Offset != offset + length)
+      return false;
+
+   result = std::move(fragment.m_Children[0]);
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Bring {root} up to date after an edit to the XML document in
+// memory, reparsing only the smallest element enclosing the edit.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::ReparseEdit(XmlElementTree &root, const void *data, size_t numbytes,
+                            size_t editoffset, size_t oldlength, size_t newlength)
+{
+   // Find the chain of elements that strictly enclose the edited bytes.
+   size_t editend = editoffset + oldlength;
+   std::vector<XmlElementTree *> chain;
+   XmlElementTree *celm = &root;
+   for (;;)
+   {
+      XmlElementTree *found = nullptr;
+      for (auto childp = celm->m_Children.begin(); childp != celm->m_Children.end(); ++childp)
+      {
+         if (childp->m_Begin.m_Offset < editoffset && editend < childp->m_End.m_Offset)
+         {
+            found = &*childp;
+            break;
+         }
+      }
+      if (!found)
+         break;
+      chain.push_back(found);
+      celm = found;
+   }
+
+   // Try the innermost element first.  If the edit broke that element's
+   // own tags, its range won't parse as one element, so move outward.
+   ptrdiff_t delta = static_cast<ptrdiff_t>(newlength) - static_cast<ptrdiff_t>(oldlength);
+   while (!chain.empty())
+   {
+      XmlElementTree &elm = *chain[chain.size() - 1];
+      size_t oldend = elm.m_End.m_Offset;
+      size_t offset = elm.m_Begin.m_Offset;
+
+      std::vector<XmlBeginNode> context;
+      for (size_t index = 0; index + 1 < chain.size(); ++index)
+         context.push_back(chain[index]->m_Begin);
+
+      XmlElementTree replacement;
+      if (ReparseElement(replacement, data, numbytes, offset, oldend + delta - offset, context))
+      {
+         // Only what follows the element moves:  the siblings after it
+         // and after each of its ancestors, and the ends of the
+         // ancestors.  The replacement already has correct offsets.
+         for (size_t index = 0; index < chain.size(); ++index)
+         {
+            XmlElementTree &parent = (index == 0) ? root : *chain[index - 1];
+            size_t next = static_cast<size_t>(chain[index] - &parent.m_Children[0]) + 1;
+            for (; next < parent.m_Children.size(); ++next)
+               ShiftOffsets(parent.m_Children[next], delta);
+            if (index + 1 < chain.size())
+               chain[index]->m_End.m_Offset += delta;
+         }
+         elm = std::move(replacement);
+         return true;
+      }
+      chain.erase(chain.begin() + chain.size() - 1);
+   }
+
+   // No single element encloses the edit, so reparse everything.
+   root.m_Children.clear();
+   return BeginParsingFromMemory(data, numbytes) && ParseTree(root);
+}
+
+//--------------------------------------------------------------------
+// Parse the remainder of the XML document, recording the location of
+// every element named {recordname} into {index}.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::IndexRecords(const wchar_t *recordname, XmlRecordIndex &index)
+{
+   index.clear();
+
+   // Stack depth of the record being parsed, or zero if between records.
+   size_t recorddepth = 0;
+
+   std::unique_ptr<XmlNodeBase> node;
+   while (NextNode(node))
+   {
+      if (recorddepth == 0 && node->m_Type == XmlNodeBase::XmlNodeType_Begin &&
+          node->m_Name == recordname)
+      {
+         recorddepth = m_Stack.size();
+
+         // Check whether this record has the same ancestors as the
+         // previous one.  Each ancestor's offset identifies it.
+         size_t numancestors = m_Stack.size() - 1;
+         bool samecontext = !index.m_Contexts.empty() &&
+                            index.m_Contexts[index.m_Contexts.size() - 1].size() == numancestors;
+         for (size_t level = 0; samecontext && level < numancestors; ++level)
+            samecontext = (index.m_Contexts[index.m_Contexts.size() - 1][level].m_Offset == m_Stack[level].m_Begin.m_Offset);
+         if (!samecontext)
+         {
+            std::vector<XmlBeginNode> context;
+            for (size_t level = 0; level < numancestors; ++level)
+               context.push_back(m_Stack[level].m_Begin);
+            index.m_Contexts.push_back(context);
+         }
+
+         XmlRecordSpan span;
+         span.m_Offset = static_cast<XmlBeginNode *>(node.get())->m_Offset;
+         span.m_Length = 0;
+         span.m_Context = index.m_Contexts.size() - 1;
+         index.m_Records.push_back(span);
+      }
+      else if (recorddepth != 0 && node->m_Type == XmlNodeBase::XmlNodeType_End &&
+               m_Stack.size() < recorddepth)
+      {
+         XmlRecordSpan &span = index.m_Records[index.m_Records.size() - 1];
+         span.m_Length = static_cast<XmlEndNode *>(node.get())->m_Offset - span.m_Offset;
+         recorddepth = 0;
+      }
+   }
+
+   if (m_ErrorInfo.empty() && recorddepth != 0)
+      m_ErrorInfo = L"Premature end of document inside record.";
+
+   return m_ErrorInfo.empty();
+}
+
+//--------------------------------------------------------------------
+// Save where the parse stands into {state}.
+//--------------------------------------------------------------------
+void XmlParser::SaveState(ParseState &state)
+{
+   state.m_Stack = m_Stack;
+   state.m_PriorTagType = m_PriorTagType;
+   state.m_PriorWasEmptyTag = m_PriorWasEmptyTag;
+   state.m_PriorName = m_PriorName;
+   state.m_DataPos = m_DataPos;
+   state.m_RangeEnd = m_RangeEnd;
+   state.m_SkippedEnds = m_SkippedEnds;
+   state.m_PendingCloser = m_PendingCloser;
+   state.m_PendingState = m_PendingState;
+   state.m_CheckPos = m_CheckPos;
+   state.m_StopReason = m_StopReason;
+   state.m_ErrorInfo = m_ErrorInfo;
+   state.m_CurChar = m_CurChar;
+   state.m_CurToken = m_CurToken;
+}
+
+//--------------------------------------------------------------------
+// Put the parse back where it stood when {state} was saved, moving
+// the contents of {state} rather than copying them.
+//--------------------------------------------------------------------
+void XmlParser::RestoreState(ParseState &state)
+{
+   m_Stack.swap(state.m_Stack);
+   m_PriorTagType = state.m_PriorTagType;
+   m_PriorWasEmptyTag = state.m_PriorWasEmptyTag;
+   m_PriorName.swap(state.m_PriorName);
+   m_DataPos = state.m_DataPos;
+   m_RangeEnd = state.m_RangeEnd;
+   m_SkippedEnds.swap(state.m_SkippedEnds);
+   m_PendingCloser = state.m_PendingCloser;
+   m_PendingState = state.m_PendingState;
+   m_CheckPos = state.m_CheckPos;
+   m_StopReason = state.m_StopReason;
+   m_ErrorInfo.swap(state.m_ErrorInfo);
+   m_CurChar = state.m_CurChar;
+   m_CurToken.swap(state.m_CurToken);
+
+   // The reader's next character follows the current one.
+   m_Reader->Seek(m_DataPos);
+}
+
+//--------------------------------------------------------------------
+// Read {length} characters starting at {offset} from the document into
+// {block}, leaving the reader where the current parse needs it.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::ReadBlock(size_t offset, size_t length, std::wstring &block)
+{
+   // Copy the whole block at once where the reader allows it, since
+   // scans for records read a lot of blocks.
+   if (m_Memory != nullptr)
+   {
+      if (offset > m_MemorySize || length > m_MemorySize - offset)
+         return false;
+      block.clear();
+      AppendBytes(block, m_Memory + offset, length);
+      return true;
+   }
+   bool ok = true;
+   XmlFileInputInterface *file = dynamic_cast<XmlFileInputInterface *>(m_Reader.get());
+   if (file != nullptr)
+      ok = file->ReadBlock(offset, length, block);
+   else
+   {
+      block.resize(length);
+      ok = m_Reader->Seek(offset);
+      for (size_t index = 0; ok && index < length; ++index)
+         ok = m_Reader->ReadChar(block[index]);
+   }
+
+   m_Reader->Seek(m_DataPos);
+   return ok;
+}
+
+//--------------------------------------------------------------------
+// Parse the single element that begins at {offset}, retrieving its
+// length in bytes into {length}.  The parse in progress is left where
+// it was.  Returns false if the element isn't well formed.
+//--------------------------------------------------------------------
+bool XmlParser::MeasureRecord(size_t offset, size_t filelength, size_t &length)
+{
+   ParseState state;
+   SaveState(state);
+
+   bool measured = false;
+   if (BeginParsingRange(offset, filelength, std::vector<XmlBeginNode>()))
+   {
+      std::unique_ptr<XmlNodeBase> node;
+      while (!measured && NextNode(node))
+      {
+         if (node->m_Type == XmlNodeBase::XmlNodeType_End && m_Stack.empty())
+         {
+            length = static_cast<XmlEndNode *>(node.get())->m_Offset - offset;
+            measured = true;
+         }
+      }
+   }
+
+   RestoreState(state);
+   return measured;
+}
+
+//--------------------------------------------------------------------
+// Given the names of the elements enclosing character offset {mark},
+// innermost first, in {enclosing}, replace them with the names of those
+// enclosing {offset}, which must come before {mark}, by parsing the
+// document between the two.  Elements that end between them enclose
+// {offset} inside the ones still open at {mark}, less any that begin
+// between them.  The parse in progress is left where it was.
+//--------------------------------------------------------------------
+void XmlParser::EnclosingAt(size_t offset, size_t mark, std::vector<std::wstring> &enclosing)
+{
+   ParseState state;
+   SaveState(state);
+
+   if (BeginParsingRange(offset, mark, std::vector<XmlBeginNode>()))
+   {
+      std::unique_ptr<XmlNodeBase> node;
+      while (NextNode(node))
+         ;
+   }
+   size_t opened = std::min(m_Stack.size(), enclosing.size());
+   enclosing.erase(enclosing.begin(), enclosing.begin() + opened);
+   enclosing.insert(enclosing.begin(), m_SkippedEnds.begin(), m_SkippedEnds.end());
+
+   RestoreState(state);
+}
+
+//--------------------------------------------------------------------
+// Returns true if {block} holds the start tag {opener} at {pos}.
+//--------------------------------------------------------------------
+static bool IsOpenerAt(const std::wstring &block, size_t pos, const std::wstring &opener)
+{
+   return block.size() - pos > opener.size() &&
+          block.compare(pos, opener.size(), opener) == 0 &&
+          wcschr(L"/> \r\n\t", block[pos + opener.size()]) != nullptr;
+}
+
+// How far back IsSectionEnd looks for the start of a comment or CDATA
+// section.  Bounds the time taken by a stray "-->" in a large file.
+//
+const size_t maxSectionLookBack = 1024 * 1024;
+
+//--------------------------------------------------------------------
+// Returns true if the "-->" (if {comment} is true) or "]]>" at character
+// offset {closer} really ends a comment or CDATA section, rather than
+// being text or part of an attribute value.  Since a comment can't
+// contain "--" and a CDATA section can't contain "]]>", the closer is
+// only real if the section's begin marker comes before either of those
+// when looking back from it.  Looks back at most maxSectionLookBack
+// characters, and takes the closer as text if the begin marker isn't
+// found by then.  Returns false if error, too.
+//--------------------------------------------------------------------
+bool XmlParser::IsSectionEnd(size_t closer, bool comment)
+{
+   const wchar_t *opener = comment ? L"<!--" : L"<![CDATA[";
+   const wchar_t *stop = comment ? L"--" : L"]]>";
+   const size_t openerlen = wcslen(opener);
+   const size_t stoplen = wcslen(stop);
+   const size_t limit = (closer > maxSectionLookBack) ? closer - maxSectionLookBack : 0;
+
+   // Each block is read with the start of the following block, as far
+   // as the closer, so that markers split between blocks are found.
+   size_t blocksize = 4096;
+   std::wstring block;
+   size_t blockend = closer;
+   while (blockend > limit)
+   {
+      size_t blockstart = (blockend - limit > blocksize) ? blockend - blocksize : limit;
+      size_t readend = std::min(blockend + openerlen, closer);
+      if (!ReadBlock(blockstart, readend - blockstart, block))
+         return false;
+
+      for (size_t pos = blockend - blockstart; pos-- > 0; )
+      {
+         size_t avail = block.size() - pos;
+         if (avail >= openerlen && block.compare(pos, openerlen, opener) == 0)
+            return true;
+         if (avail >= stoplen && block.compare(pos, stoplen, stop) == 0)
+         {
+            // The "--" that ends "<!--" is met before the "<!" that
+            // starts it.
+            size_t at = blockstart + pos;
+            std::wstring before;
+            return comment && at >= 2 && ReadBlock(at - 2, 2, before) && before == L"<!";
+         }
+      }
+
+      blockend = blockstart;
+      blocksize = std::min<size_t>(blocksize * 2, 65536);
+   }
+   return false;
+}
+
+//--------------------------------------------------------------------
+// Scan backward from character offset {before} for up to {count}
+// well formed elements that begin with the tag {opener}, appending
+// them to {found} last to first.  When scanning from the end of the
+// file, elements nested inside another element of the same name are
+// skipped, as IndexRecords treats them as part of the outer record.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::ScanBackward(const std::wstring &opener, size_t before, size_t count,
+                             std::vector<XmlRecordSpan> &found)
+{
+   // Blocks start small, since the element sought is usually near.
+   size_t blocksize = 4096;
+   const size_t filelength = m_Reader->GetFileLength();
+
+   // Each block is read with a few extra characters from the start of
+   // the following block, so that markers split across the boundary
+   // between blocks are still found.
+   const size_t overlap = std::max<size_t>(opener.size() + 1, 9);
+
+   // True while scanning backward through a comment or CDATA section,
+   // and the marker that begins it.
+   bool inside = false;
+   const wchar_t *insidestart = nullptr;
+
+   // The names of the elements enclosing {mark}, innermost first, where
+   // {mark} is the start of the last element checked.  These are only
+   // known when the scan starts at the end of the file, where nothing
+   // encloses it.
+   const bool fromend = (before >= filelength);
+   const std::wstring name = opener.substr(1);
+   std::vector<std::wstring> enclosing;
+   size_t mark = filelength;
+
+   size_t wanted = found.size() + count;
+   std::wstring block;
+   size_t blockend = std::min(before, filelength);
+   while (blockend > 0 && found.size() < wanted)
+   {
+      size_t blockstart = (blockend > blocksize) ? blockend - blocksize : 0;
+      size_t readend = std::min(blockend + overlap, filelength);
+      if (!ReadBlock(blockstart, readend - blockstart, block))
+      {
+         m_ErrorInfo = L"Failed reading document.";
+         return false;
+      }
+
+      for (size_t pos = blockend - blockstart; pos-- > 0 && found.size() < wanted; )
+      {
+         size_t avail = block.size() - pos;
+         if (inside)
+         {
+            // Look for the marker that begins the comment or section.
+            size_t len = wcslen(insidestart);
+            if (avail >= len && block.compare(pos, len, insidestart) == 0)
+               inside = false;
+            continue;
+         }
+
+         // Scanning backward, the end marker of a comment or CDATA section
+         // is seen before its begin marker.  Nothing in between counts.
+         // The same characters may also appear in text or an attribute
+         // value, so check the marker before skipping back to the start.
+         if (avail >= 3 && block.compare(pos, 3, L"-->") == 0 && IsSectionEnd(blockstart + pos, true))
+         {
+            inside = true;
+            insidestart = L"<!--";
+            continue;
+         }
+         if (avail >= 3 && block.compare(pos, 3, L"]]>") == 0 && IsSectionEnd(blockstart + pos, false))
+         {
+            inside = true;
+            insidestart = L"<![CDATA[";
+            continue;
+         }
+
+         if (IsOpenerAt(block, pos, opener))
+         {
+            // Confirm the candidate by parsing it.
+            XmlRecordSpan span;
+            span.m_Offset = blockstart + pos;
+            span.m_Context = 0;
+            if (MeasureRecord(span.m_Offset, filelength, span.m_Length))
+            {
+               bool nested = false;
+               if (fromend)
+               {
+                  EnclosingAt(span.m_Offset, mark, enclosing);
+                  mark = span.m_Offset;
+                  nested = (std::find(enclosing.begin(), enclosing.end(), name) != enclosing.end());
+               }
+               if (!nested)
+                  found.push_back(span);
+            }
+         }
+      }
+
+      blockend = blockstart;
+      blocksize = std::min<size_t>(blocksize * 2, 65536);
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Scan forward from character offset {from} for the first well formed
+// element that begins with the tag {opener}, retrieving its location
+// into {span}.  Returns false if there is none or error.
+//--------------------------------------------------------------------
+bool XmlParser::ScanForward(const std::wstring &opener, size_t from, XmlRecordSpan &span)
+{
+   // Blocks start small, since the element sought is usually near.
+   size_t blocksize = 4096;
+   const size_t filelength = m_Reader->GetFileLength();
+   const size_t overlap = std::max<size_t>(opener.size() + 1, 9);
+
+   // The marker that ends the comment or CDATA section being skipped,
+   // or null if not inside one.
+   const wchar_t *insideend = nullptr;
+
+   // True once an element has been found and measured, but not yet
+   // shown to lie outside any comment or CDATA section.  The scan may
+   // have started inside one, so an element is only accepted once the
+   // scan reaches the end of the file or a marker that begins a comment
+   // or section before any marker that ends one.
+   bool pending = false;
+
+   std::wstring block;
+   for (size_t blockstart = from; blockstart < filelength; )
+   {
+      size_t blockend = std::min(blockstart + blocksize, filelength);
+      size_t readend = std::min(blockend + overlap, filelength);
+      if (!ReadBlock(blockstart, readend - blockstart, block))
+      {
+         m_ErrorInfo = L"Failed reading document.";
+         return false;
+      }
+
+      for (size_t pos = 0; pos < blockend - blockstart; ++pos)
+      {
+         // Skip straight to the end of the comment or CDATA section, or
+         // else to the next character that could begin a marker or an
+         // element.  The overlap lets markers that start in this block
+         // be found whole.
+         pos = insideend ? block.find(insideend, pos) : block.find_first_of(L"<-]", pos);
+         if (pos >= blockend - blockstart)
+            break;
+         if (insideend)
+         {
+            pos += wcslen(insideend) - 1;
+            insideend = nullptr;
+            continue;
+         }
+
+         size_t avail = block.size() - pos;
+         const wchar_t *begins = nullptr;
+         if (avail >= 4 && block.compare(pos, 4, L"<!--") == 0)
+            begins = L"<!--";
+         else if (avail >= 9 && block.compare(pos, 9, L"<![CDATA[") == 0)
+            begins = L"<![CDATA[";
+         if (begins)
+         {
+            if (pending)
+            {
+               m_OutsideFrom = span.m_Offset;
+               m_OutsideTo = blockstart + pos;
+               return true;
+            }
+            insideend = (begins[2] == '-') ? L"-->" : L"]]>";
+            pos += wcslen(begins) - 1;
+            continue;
+         }
+
+         // An end marker seen first means the scan started inside a
+         // comment or CDATA section, so nothing found so far counts.
+         if (avail >= 3 && (block.compare(pos, 3, L"-->") == 0 || block.compare(pos, 3, L"]]>") == 0))
+         {
+            pending = false;
+            pos += 2;
+            continue;
+         }
+
+         if (!pending && IsOpenerAt(block, pos, opener))
+         {
+            span.m_Offset = blockstart + pos;
+            span.m_Context = 0;
+            if (MeasureRecord(span.m_Offset, filelength, span.m_Length))
+            {
+               // An earlier scan may already have shown where the next
+               // marker is.
+               if (span.m_Offset >= m_OutsideFrom && span.m_Offset < m_OutsideTo)
+                  return true;
+               pending = true;
+            }
+         }
+      }
+
+      blockstart = blockend;
+      blocksize = std::min<size_t>(blocksize * 2, 65536);
+   }
+
+   if (pending)
+   {
+      m_OutsideFrom = span.m_Offset;
+      m_OutsideTo = filelength;
+   }
+   return pending;
+}
+
+//--------------------------------------------------------------------
+// Find the last {count} elements named {recordname} in the document by
+// scanning backward from the end of the file.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::FindLastRecords(const wchar_t *recordname, size_t count, XmlRecordIndex &index)
+{
+   index.clear();
+   index.m_Contexts.push_back(std::vector<XmlBeginNode>());
+   if (!m_Reader)
+   {
+      m_ErrorInfo = L"No document is open.";
+      return false;
+   }
+
+   std::vector<XmlRecordSpan> found;
+   if (!ScanBackward(std::wstring(L"<") + recordname, m_Reader->GetFileLength(), count, found))
+      return false;
+
+   // The records were found last to first.
+   index.m_Records.assign(found.rbegin(), found.rend());
+   m_ErrorInfo.clear();
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Choose {count} records at random from the document without parsing
+// all of it, storing their locations into {sample} in document order.
+// Random character offsets are probed and each is moved forward to the
+// next element named {recordname}.  A probe finds a record in
+// proportion to the record's distance from the preceding record, so
+// each probe is kept only with probability {shortest gap}/{its gap},
+// which makes every record equally likely to be kept.  The shortest
+// gap is estimated from the probes themselves, so the result is
+// approximately uniform.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlParser::SampleRecords(const wchar_t *recordname, size_t count, unsigned seed,
+                              XmlRecordIndex &sample)
+{
+   sample.clear();
+   sample.m_Contexts.push_back(std::vector<XmlBeginNode>());
+   if (!m_Reader)
+   {
+      m_ErrorInfo = L"No document is open.";
+      return false;
+   }
+
+   const std::wstring opener = std::wstring(L"<") + recordname;
+   const size_t filelength = m_Reader->GetFileLength();
+   if (count == 0 || filelength == 0)
+      return true;
+
+   struct Probe
+   {
+      XmlRecordSpan m_Span;
+      size_t m_Gap;     // Distance from the start of the preceding record.
+      double m_Unit;    // Uniform random number for accepting the probe.
+   };
+   std::vector<Probe> probes;
+   size_t mingap = static_cast<size_t>(-1);
+   double inversegaps = 0.0;     // Sum of the inverses of the probes' gaps.
+   std::mt19937_64 random(seed);
+   std::uniform_int_distribution<size_t> anyoffset(0, filelength - 1);
+   std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+   // Gather the accepted records into {chosen}, in the order they were
+   // probed, with the offsets of the records in {seen}.  Accepting the
+   // probes from {first} on only adds to the records already chosen.
+   // The shortest gap can only shrink as probes are added, and only
+   // then are the earlier probes reconsidered, which happens about
+   // log(probes) times.
+   std::vector<XmlRecordSpan> chosen;
+   std::unordered_set<size_t> seen;
+   auto choose = [&](size_t first)
+   {
+      if (first == 0)
+      {
+         chosen.clear();
+         seen.clear();
+      }
+      for (size_t index = first; index < probes.size() && chosen.size() < count; ++index)
+      {
+         const Probe &probe = probes[index];
+         if (probe.m_Unit * probe.m_Gap <= mingap && seen.insert(probe.m_Span.m_Offset).second)
+            chosen.push_back(probe.m_Span);
+      }
+   };
+
+   // Always make enough probes to estimate the shortest gap.  Give up
+   // after a generous number of probes, such as when the document holds
+   // fewer than {count} records.
+   const size_t minprobes = 64;
+   const size_t maxprobes = count * 256 + 256;
+   while (probes.size() < maxprobes && (probes.size() < minprobes || chosen.size() < count))
+   {
+      Probe probe;
+      if (!ScanForward(opener, anyoffset(random), probe.m_Span))
+      {
+         if (!m_ErrorInfo.empty())
+            return false;
+
+         // Landed after the last record.  Treat that as landing before
+         // the first record, as if the file wrapped around.
+         if (!ScanForward(opener, 0, probe.m_Span))
+            return m_ErrorInfo.empty();
+      }
+
+      // The probe landed somewhere between the start of the preceding
+      // record and the start of this one.  For the first record, the
+      // space after the last record also leads here.
+      std::vector<XmlRecordSpan> previous;
+      if (!ScanBackward(opener, probe.m_Span.m_Offset, 1, previous))
+         return false;
+      if (!previous.empty())
+      {
+         probe.m_Gap = probe.m_Span.m_Offset - previous[0].m_Offset;
+      }
+      else
+      {
+         if (!ScanBackward(opener, filelength, 1, previous))
+            return false;
+         probe.m_Gap = probe.m_Span.m_Offset + filelength - previous[0].m_Offset;
+      }
+
+      probe.m_Unit = unit(random);
+      probes.push_back(probe);
+      bool shrunk = (probe.m_Gap < mingap);
+      mingap = std::min(mingap, probe.m_Gap);
+      inversegaps += 1.0 / static_cast<double>(std::max<size_t>(probe.m_Gap, 1));
+      choose(shrunk ? 0 : probes.size() - 1);
+
+      // Records are probed in proportion to their gaps, so the file
+      // length times the mean of the inverse gaps estimates how many
+      // records there are.  If the sample would take a large share of
+      // them, indexing the whole document is quicker than probing.
+      if (probes.size() >= minprobes && chosen.size() < count &&
+          static_cast<double>(filelength) * inversegaps / static_cast<double>(probes.size()) < 2.0 * count)
+         break;
+   }
+
+   // If the probes didn't turn up enough records, whether because the
+   // document has few of them or because most sit far apart, sample an
+   // index of the whole document instead, so that the caller never gets
+   // fewer records than the document can supply.
+   if (chosen.size() < count)
+   {
+      XmlRecordIndex index;
+      if (!BeginParsingRange(0, filelength, std::vector<XmlBeginNode>()) || !IndexRecords(recordname, index))
+         return false;
+      XmlSampleIndex(index, count, seed, sample);
+      m_ErrorInfo.clear();
+      return true;
+   }
+
+   sample.m_Records = chosen;
+   std::sort(sample.m_Records.begin(), sample.m_Records.end(),
+             [](const XmlRecordSpan &a, const XmlRecordSpan &b) { return a.m_Offset < b.m_Offset; });
+
+   m_ErrorInfo.clear();
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Find the first element named {recordname} that begins at or after
+// byte {offset}, placing its location into {span}.
+// Returns false if there is no such element or error.
+//--------------------------------------------------------------------
+bool XmlParser::FindNextRecord(const wchar_t *recordname, size_t offset, XmlRecordSpan &span)
+{
+   if (!m_Reader)
+   {
+      m_ErrorInfo = L"No document is open.";
+      return false;
+   }
+
+   m_ErrorInfo.clear();
+   return ScanForward(std::wstring(L"<") + recordname, offset, span);
+}
+
+//--------------------------------------------------------------------
+// Choose {count} records uniformly at random from {index}, storing
+// them into {sample} in document order.  If {index} holds {count}
+// records or fewer, all of them are chosen.
+//--------------------------------------------------------------------
+void XmlSampleIndex(const XmlRecordIndex &index, size_t count, unsigned seed,
+                    XmlRecordIndex &sample)
+{
+   sample.clear();
+   sample.m_Contexts = index.m_Contexts;
+
+   // Partial shuffle of the record numbers.
+   std::vector<size_t> order(index.m_Records.size());
+   for (size_t pos = 0; pos < order.size(); ++pos)
+      order[pos] = pos;
+   count = std::min(count, order.size());
+   std::mt19937_64 random(seed);
+   for (size_t pos = 0; pos < count; ++pos)
+   {
+      std::uniform_int_distribution<size_t> pick(pos, order.size() - 1);
+      std::swap(order[pos], order[pick(random)]);
+   }
+   order.resize(count);
+   std::sort(order.begin(), order.end());
+
+   for (size_t pos = 0; pos < order.size(); ++pos)
+      sample.m_Records.push_back(index.m_Records[order[pos]]);
+}
+
+//--------------------------------------------------------------------
+// Copy {length} bytes starting at byte offset {offset} in file {in}
+// to the current position in file {out}.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlCopyBytes(FILE *in, size_t offset, size_t length, FILE *out)
+{
+   if (!in || !out || !XmlSeekFile(in, offset))
+      return false;
+
+   char buffer[65536];
+   while (length > 0)
+   {
+      size_t chunk = std::min(length, sizeof(buffer));
+      if (fread(buffer, 1, chunk, in) != chunk || fwrite(buffer, 1, chunk, out) != chunk)
+         return false;
+      length -= chunk;
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Move file {fp} to byte offset {offset}.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlSeekFile(FILE *fp, size_t offset)
+{
+#ifdef _MSC_VER
+   return _fseeki64(fp, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+   return fseeko(fp, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+//--------------------------------------------------------------------
+// Returns the current byte offset of file {fp}, or zero if error.
+//--------------------------------------------------------------------
+size_t XmlTellFile(FILE *fp)
+{
+#ifdef _MSC_VER
+   __int64 offset = _ftelli64(fp);
+#else
+   off_t offset = ftello(fp);
+#endif
+   return (offset < 0) ? 0 : static_cast<size_t>(offset);
+}
+
+//--------------------------------------------------------------------
+// Returns the length of file {fp} in bytes, or zero if error, leaving
+// the file at the same offset.
+//--------------------------------------------------------------------
+size_t XmlFileLength(FILE *fp)
+{
+   size_t offset = XmlTellFile(fp);
+#ifdef _MSC_VER
+   bool ended = _fseeki64(fp, 0, SEEK_END) == 0;
+#else
+   bool ended = fseeko(fp, 0, SEEK_END) == 0;
+#endif
+   size_t length = ended ? XmlTellFile(fp) : 0;
+   XmlSeekFile(fp, offset);
+   return length;
+}
+
+//--------------------------------------------------------------------
+// Enable or disable computing a fingerprint of each element as it is
+// parsed.
+//--------------------------------------------------------------------
+void XmlParser::EnableFingerprints(bool enable)
+{
+   m_Fingerprints = enable;
+}
+
+//--------------------------------------------------------------------
+// Enable or disable reporting whitespace between tags, CDATA text and
+// the data of processing instructions as they are written.
+//--------------------------------------------------------------------
+void XmlParser::KeepAllText(bool enable)
+{
+   m_KeepAllText = enable;
+}
+
+//--------------------------------------------------------------------
+// Retrieve a description of the most recent error into {errorinfo}.
+// If no error, {errorinfo} will be empty string.
+//--------------------------------------------------------------------
+void XmlParser::ErrorInfo(std::wstring &errorinfo)
+{
+   errorinfo = m_ErrorInfo;
+}
+
+// Discard all allocated memory and close all files.
+//
+void XmlParser::Reset(void)
+{
+   m_Stack.clear();
+   m_ErrorInfo.clear();
+   m_PriorWasEmptyTag = false;
+   m_PriorName = L"";
+
+   XmlFileInputInterface *p = dynamic_cast<XmlFileInputInterface *>(m_Reader.get());
+   if (p != nullptr)
+      p->ForceClose();
+   m_Reader.reset();
+   m_Memory = nullptr;
+   m_MemorySize = 0;
+
+   m_DataSize = m_DataPos = 0;
+   m_RangeEnd = noRangeEnd;
+   m_SkippedEnds.clear();
+   m_PendingCloser = 0;
+   m_CheckPos = 0;
+   m_StopReason = nullptr;
+   m_OutsideFrom = m_OutsideTo = 0;
+}
+
+//--------------------------------------------------------------------
+// Returns true if the end of the XML document has been reached.
+//--------------------------------------------------------------------
+bool XmlParser::EndOfDocument(void)
+{
+   if (!m_Reader)
+      return true;
+   return m_Reader->EndOfFile();
+}
+
+//--------------------------------------------------------------------
+// Retrieves the current character position in the XML document.
+//--------------------------------------------------------------------
+size_t XmlParser::CurPosition(void)
+{
+   return m_DataPos;
+}
+
+//--------------------------------------------------------------------
+// Retrieve the number of elements that have begun but not ended.
+//--------------------------------------------------------------------
+size_t XmlParser::OpenElements(void)
+{
+   return m_Stack.size();
+}
+
+//--------------------------------------------------------------------
+// Retrieve the tag name of the open element at depth {depth}.
+//--------------------------------------------------------------------
+const std::wstring &XmlParser::AncestorName(size_t depth)
+{
+   return m_Stack[depth].m_Begin.m_Name;
+}
+
+//--------------------------------------------------------------------
+// Retrieve the current character from the XML document.
+// Returns zero if no character available.
+//--------------------------------------------------------------------
+wchar_t XmlParser::CurChar(void)
+{
+   return m_CurChar;
+}
+
+//--------------------------------------------------------------------
+// Retrieve the offset of the current character in the XML document,
+// which is also the offset just past the last character consumed.
+//--------------------------------------------------------------------
+size_t XmlParser::CurCharOffset(void)
+{
+   // At the end of the document there is no current character, and
+   // m_DataPos already counts every character consumed.
+   return (m_CurChar != 0) ? m_DataPos - 1 : m_DataPos;
+}
+
+//--------------------------------------------------------------------
+// Advance to next character in XML document.
+// Returns false if no more characters available.
+//--------------------------------------------------------------------
+bool XmlParser::NextChar(void)
+{
+   m_CurChar = 0;
+   if (!m_Reader || (m_DataPos >= m_CheckPos && !CheckLimits()))
+      return false;
+
+   wchar_t c;
+   if (!m_Reader->ReadChar(c))
+   {
+      return false;
+   }
+   m_CurChar = c;
+   m_DataPos++;
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Called by NextChar on reaching m_CheckPos.  Returns false if parsing
+// must stop there, either at the end of the range or because of the
+// limits set by SetLimits.  Otherwise moves m_CheckPos to the next
+// point at which to check.
+//--------------------------------------------------------------------
+bool XmlParser::CheckLimits(void)
+{
+   if (m_DataPos >= m_RangeEnd || m_StopReason != nullptr)
+      return false;
+
+   bool limited = m_Deadline != std::chrono::steady_clock::time_point::max();
+   if (m_Cancel != nullptr)
+   {
+      limited = true;
+      if (*m_Cancel)
+         m_StopReason = L"Parsing was cancelled.";
+   }
+   if (m_StopReason == nullptr && limited && std::chrono::steady_clock::now() >= m_Deadline)
+      m_StopReason = L"Parsing ran past its deadline.";
+   if (m_StopReason != nullptr)
+   {
+      m_ErrorInfo = m_StopReason;
+      return false;
+   }
+
+   m_CheckPos = m_RangeEnd;
+   if (limited && m_RangeEnd - m_DataPos > m_CheckBytes)
+      m_CheckPos = m_DataPos + m_CheckBytes;
+   return true;
+}
+
+//--------------------------------------------------------------------
+// If the document is being parsed from memory, point {run} at the
+// current character and return the number of characters from there to
+// the end of the document or range.  Otherwise returns zero.  The run
+// also ends at the next point at which NextChar checks the limits set
+// by SetLimits, so that a long run of text can't skip the check.
+// The baseline lexer never takes runs, so it always returns zero.
+//--------------------------------------------------------------------
+size_t XmlParser::MemoryRun(const char *&run)
+{
+#ifdef NOMXML_BASELINE_LEXER
+   (void)run;
+   return 0;
+#else
+   if (m_Memory == nullptr || m_CurChar == 0)
+      return 0;
+
+   size_t cur = m_DataPos - 1;
+   size_t end = std::min(std::min(m_MemorySize, m_RangeEnd), m_CheckPos);
+   if (cur >= end)
+      return 0;
+   run = m_Memory + cur;
+   return end - cur;
+#endif
+}
+
+//--------------------------------------------------------------------
+// Advance {count} characters past the current character, which must
+// all be within the run retrieved by MemoryRun.  Returns false if no
+// character is available there, like NextChar.
+//--------------------------------------------------------------------
+bool XmlParser::SkipChars(size_t count)
+{
+   m_DataPos += count - 1;
+   m_Reader->Seek(m_DataPos);
+   return NextChar();
+}
+
+//--------------------------------------------------------------------
+// Retrieve a reference to the current token from the XML document.
+//--------------------------------------------------------------------
+const std::wstring & XmlParser::CurToken(void)
+{
+   return m_CurToken;
+}
+
+//--------------------------------------------------------------------
+// Extract next token from XML document, where token is delimited
+// by double quotes or by any character in the classes {delims}.
+// Returns false if no more tokens.
+//--------------------------------------------------------------------
+bool XmlParser::NextToken(unsigned delims)
+{
+   m_CurToken = L"";
+
+   // Eat any leading whitespace.
+   while (CharClassOf(CurChar()) & CharClass_Space)
+   {
+      const char *run;
+      size_t available = MemoryRun(run);
+      size_t count = (available != 0 ? Simd().m_SkipSpace(run, available) : 0);
+      if (count != 0)
+         SkipChars(count);
+      else
+         NextChar();
+   }
+
+   // How we scan the token depends on if it's quoted or not.
+   wchar_t quote = CurChar();
+   if (quote == '"' || quote == '\'')
+   {
+      // Accumulate the quoted token.
+      NextChar();
+      while (CurChar() != 0 && CurChar() != quote)
+      {
+         const char *run;
+         size_t available = MemoryRun(run);
+         if (available != 0)
+         {
+            size_t count = Simd().m_FindEither(run, available, static_cast<char>(quote), '\0');
+            AppendBytes(m_CurToken, run, count);
+            SkipChars(count);
+            continue;
+         }
+
+         m_CurToken += CurChar();
+         NextChar();
+      }
+      if (CurChar() == quote)
+         NextChar();
+   }
+   else
+   {
+      // Accumulate the non-quoted token until a delimiter is hit.
+      unsigned stops = delims | CharClass_Nul;
+      while (!(CharClassOf(CurChar()) & stops))
+      {
+         const char *run;
+         size_t available = MemoryRun(run);
+         if (available != 0)
+         {
+            size_t count = 0;
+            while (count < available &&
+                   !(charClasses.m_Classes[static_cast<unsigned char>(run[count])] & stops))
+               ++count;
+            AppendBytes(m_CurToken, run, count);
+            SkipChars(count);
+            continue;
+         }
+
+         m_CurToken += CurChar();
+         NextChar();
+      }
+   }
+
+   // Eat any trailing whitespace.
+   while (CharClassOf(CurChar()) & CharClass_Space)
+      NextChar();
+
+#ifdef _DUMP
+   wprintf(L"token \"%s\"\n", m_CurToken.c_str());
+   fflush(stdout);
+#endif
+
+   if (m_CurToken.empty() && EndOfDocument())
+      return false;
+
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Append the bytes of {text} onto {wide}, treating each byte as a
+// Latin-1 character.
+//--------------------------------------------------------------------
+static void AppendLatin1(std::wstring &wide, const std::string &text)
+{
+   AppendBytes(wide, text.data(), text.size());
+}
+
+//--------------------------------------------------------------------
+// Replace {text} with the characters of {wide} as bytes.  The parser
+// widens each byte of a document in memory as a Latin-1 character, so
+// this gives back the bytes of the document.
+//--------------------------------------------------------------------
+static void AssignBytes(std::string &text, const std::wstring &wide)
+{
+   text.resize(wide.size());
+   for (size_t index = 0; index < wide.size(); ++index)
+      text[index] = static_cast<char>(wide[index]);
+}
+
+//--------------------------------------------------------------------
+// Convert to the equivalent wide node in {ptrref}.
+//--------------------------------------------------------------------
+void XmlByteNode::Widen(std::unique_ptr<XmlNodeBase> &ptrref) const
+{
+   switch (m_Type)
+   {
+      case XmlNodeBase::XmlNodeType_Begin:
+      {
+         XmlBeginNode *begin = new XmlBeginNode;
+         ptrref.reset(begin);
+         AppendLatin1(begin->m_Name, m_Name);
+         begin->m_Depth = m_Depth;
+         begin->m_Offset = m_Offset;
+         begin->m_Instruction = m_Instruction;
+         begin->m_Attribs.resize(m_Attribs.size());
+         for (size_t index = 0; index < m_Attribs.size(); ++index)
+         {
+            AppendLatin1(begin->m_Attribs[index].m_Name, m_Attribs[index].m_Name);
+            AppendLatin1(begin->m_Attribs[index].m_Value, m_Attribs[index].m_Value);
+         }
+         AppendLatin1(begin->m_Data, m_Data);
+         break;
+      }
+
+      case XmlNodeBase::XmlNodeType_Value:
+      {
+         XmlValueNode *value = new XmlValueNode;
+         ptrref.reset(value);
+         AppendLatin1(value->m_Name, m_Name);
+         AppendLatin1(value->m_Value, m_Value);
+         value->m_Depth = m_Depth;
+         break;
+      }
+
+      case XmlNodeBase::XmlNodeType_End:
+      {
+         XmlEndNode *end = new XmlEndNode;
+         ptrref.reset(end);
+         AppendLatin1(end->m_Name, m_Name);
+         end->m_Depth = m_Depth;
+         end->m_Offset = m_Offset;
+         end->m_Hash = m_Hash;
+         break;
+      }
+
+      default:
+         ptrref.reset(nullptr);
+         break;
+   }
+}
+
+//--------------------------------------------------------------------
+// Replace the contents of this node with the bytes of {node}.
+//--------------------------------------------------------------------
+void XmlByteNode::Assign(const XmlNodeBase &node)
+{
+   m_Type = node.m_Type;
+   AssignBytes(m_Name, node.m_Name);
+   m_Depth = node.m_Depth;
+   m_Value.clear();
+   m_Attribs.clear();
+   m_Data.clear();
+   m_Offset = 0;
+   m_Hash = 0;
+   m_Instruction = false;
+
+   switch (m_Type)
+   {
+      case XmlNodeBase::XmlNodeType_Begin:
+      {
+         const XmlBeginNode &begin = static_cast<const XmlBeginNode &>(node);
+         m_Offset = begin.m_Offset;
+         m_Instruction = begin.m_Instruction;
+         m_Attribs.resize(begin.m_Attribs.size());
+         for (size_t index = 0; index < begin.m_Attribs.size(); ++index)
+         {
+            AssignBytes(m_Attribs[index].m_Name, begin.m_Attribs[index].m_Name);
+            AssignBytes(m_Attribs[index].m_Value, begin.m_Attribs[index].m_Value);
+         }
+         AssignBytes(m_Data, begin.m_Data);
+         break;
+      }
+
+      case XmlNodeBase::XmlNodeType_Value:
+         AssignBytes(m_Value, static_cast<const XmlValueNode &>(node).m_Value);
+         break;
+
+      case XmlNodeBase::XmlNodeType_End:
+      {
+         const XmlEndNode &end = static_cast<const XmlEndNode &>(node);
+         m_Offset = end.m_Offset;
+         m_Hash = end.m_Hash;
+         break;
+      }
+
+      default:
+         break;
+   }
+}
+
+//--------------------------------------------------------------------
+// Construct.
+//--------------------------------------------------------------------
+XmlByteParser::XmlByteParser()
+{
+}
+
+//--------------------------------------------------------------------
+// Begin parsing the {numbytes} bytes at {data}.  Returns false if
+// error.
+//--------------------------------------------------------------------
+bool XmlByteParser::BeginParsingFromMemory(const void *data, size_t numbytes)
+{
+   Reset();
+   return m_Parser.BeginParsingFromMemory(data, numbytes);
+}
+
+//--------------------------------------------------------------------
+// Begin parsing the file named {filename}, reading all of it into
+// memory first.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlByteParser::BeginParsingFromFile(const wchar_t *filename)
+{
+   Reset();
+   FILE *fp = nullptr;
+   if (_wfopen_s(&fp, filename, L"rb") || fp == nullptr)
+   {
+      m_ErrorInfo = L"Failed opening input file:  ";
+      m_ErrorInfo += filename;
+      return false;
+   }
+
+   char block[65536];
+   size_t numread;
+   while ((numread = fread(block, 1, sizeof(block), fp)) != 0)
+      m_File.insert(m_File.end(), block, block + numread);
+   bool failed = (ferror(fp) != 0);
+   fclose(fp);
+   if (failed)
+   {
+      m_File.clear();
+      m_ErrorInfo = L"Failed reading input file:  ";
+      m_ErrorInfo += filename;
+      return false;
+   }
+
+   return m_Parser.BeginParsingFromMemory(m_File.data(), m_File.size());
+}
+
+//--------------------------------------------------------------------
+// Restrict parsing to a range of the document, as with
+// XmlParser::BeginParsingRange.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlByteParser::BeginParsingRange(size_t offset, size_t endoffset, const std::vector<XmlBeginNode> &context)
+{
+   return m_Parser.BeginParsingRange(offset, endoffset, context);
+}
+
+//--------------------------------------------------------------------
+// Same as XmlParser::SetLimits.
+//--------------------------------------------------------------------
+void XmlByteParser::SetLimits(const std::atomic<bool> *cancel, std::chrono::steady_clock::time_point deadline,
+                              size_t checkbytes)
+{
+   m_Parser.SetLimits(cancel, deadline, checkbytes);
+}
+
+//--------------------------------------------------------------------
+// Same as XmlParser::EnableFingerprints.
+//--------------------------------------------------------------------
+void XmlByteParser::EnableFingerprints(bool enable)
+{
+   m_Parser.EnableFingerprints(enable);
+}
+
+//--------------------------------------------------------------------
+// Same as XmlParser::KeepAllText.
+//--------------------------------------------------------------------
+void XmlByteParser::KeepAllText(bool enable)
+{
+   m_Parser.KeepAllText(enable);
+}
+
+//--------------------------------------------------------------------
+// Retrieve a description of the most recent error.
+//--------------------------------------------------------------------
+void XmlByteParser::ErrorInfo(std::wstring &errorinfo)
+{
+   if (!m_ErrorInfo.empty())
+      errorinfo = m_ErrorInfo;
+   else
+      m_Parser.ErrorInfo(errorinfo);
+}
+
+//--------------------------------------------------------------------
+// Retrieve the current byte position in the document.
+//--------------------------------------------------------------------
+size_t XmlByteParser::CurPosition(void)
+{
+   return m_Parser.CurPosition();
+}
+
+//--------------------------------------------------------------------
+// Retrieve the number of elements that have begun but not ended.
+//--------------------------------------------------------------------
+size_t XmlByteParser::OpenElements(void)
+{
+   return m_Parser.OpenElements();
+}
+
+//--------------------------------------------------------------------
+// Retrieve the tag name of the open element at depth {depth}.  The
+// name is kept as bytes until the next call for the same depth.
+//--------------------------------------------------------------------
+const std::string &XmlByteParser::AncestorName(size_t depth)
+{
+   if (m_Ancestors.size() <= depth)
+      m_Ancestors.resize(depth + 1);
+   AssignBytes(m_Ancestors[depth], m_Parser.AncestorName(depth));
+   return m_Ancestors[depth];
+}
+
+//--------------------------------------------------------------------
+// Discard the document and any allocated memory.
+//--------------------------------------------------------------------
+void XmlByteParser::Reset(void)
+{
+   m_Parser.Reset();
+   std::vector<char>().swap(m_File);
+   m_Ancestors.clear();
+   m_Wide.reset();
+   m_ErrorInfo.clear();
+}
+
+//--------------------------------------------------------------------
+// Parse the next node of the document into {node}.
+// Returns false if parsing error or no more nodes in document.
+//--------------------------------------------------------------------
+bool XmlByteParser::NextNode(XmlByteNode &node)
+{
+   if (!m_Parser.NextNode(m_Wide))
+      return false;
+   node.Assign(*m_Wide);
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Parse the next node of the document into {ptrref} as a wide node.
+// Returns false if parsing error or no more nodes in document.
+//--------------------------------------------------------------------
+bool XmlByteParser::NextNode(std::unique_ptr<XmlNodeBase> &ptrref)
+{
+   return m_Parser.NextNode(ptrref);
+}
+
+//--------------------------------------------------------------------
+// Returns the number of {name}, numbering it if it hasn't been seen
+// before.
+//--------------------------------------------------------------------
+uint32_t XmlEventBatch::NameId(const std::string &name)
+{
+   auto found = m_NameIds.find(name);
+   if (found != m_NameIds.end())
+      return found->second;
+
+   uint32_t id = static_cast<uint32_t>(m_Names.size());
+   m_Names.push_back(name);
+   m_NameIds.emplace(name, id);
+   return id;
+}
+
+//--------------------------------------------------------------------
+// Discard the events and names.
+//--------------------------------------------------------------------
+void XmlEventBatch::Clear(void)
+{
+   m_Events.clear();
+   m_Text.clear();
+   m_Names.clear();
+   m_NameIds.clear();
+}
+
+//--------------------------------------------------------------------
+// Returns true if {length} more bytes of text can be added to {batch}
+// and still be located by the 32-bit offsets and lengths of events.
+//--------------------------------------------------------------------
+static bool TextFitsBatch(const XmlEventBatch &batch, size_t length)
+{
+   return length <= UINT32_MAX && batch.m_Text.size() <= UINT32_MAX - length;
+}
+
+//--------------------------------------------------------------------
+// Parse nodes into {batch} as events until it holds at least
+// {maxevents} events.  Returns false if parsing error or no more
+// events in document.
+//--------------------------------------------------------------------
+bool XmlByteParser::NextBatch(XmlEventBatch &batch, size_t maxevents)
+{
+   batch.m_Events.clear();
+   batch.m_Text.clear();
+
+   // Don't carry on past an error that ended the previous batch.
+   std::wstring errorinfo;
+   ErrorInfo(errorinfo);
+   if (!errorinfo.empty())
+      return false;
+
+   // Consecutive events often share a name, such as the begin, value
+   // and end events of an element, so remember the last one.
+   uint32_t lastid = 0;
+   bool havelast = false;
+
+   XmlEvent event;
+   event.m_Instruction = false;
+   while (batch.m_Events.size() < std::max<size_t>(maxevents, 1))
+   {
+      // A value's text starts at the current character, which
+      // CurPosition counts as already read.
+      size_t start = CurPosition();
+      if (start != 0)
+         --start;
+      if (!NextNode(m_Node))
+         break;
+
+      if (!havelast || batch.m_Names[lastid] != m_Node.m_Name)
+      {
+         lastid = batch.NameId(m_Node.m_Name);
+         havelast = true;
+      }
+      event.m_Type = static_cast<uint8_t>((m_Node.m_Type == XmlNodeBase::XmlNodeType_Begin) ? XmlEvent::XmlEvent_Begin :
+                                          (m_Node.m_Type == XmlNodeBase::XmlNodeType_Value) ? XmlEvent::XmlEvent_Value :
+                                                                                             XmlEvent::XmlEvent_End);
+      event.m_NameId = lastid;
+      event.m_Depth = static_cast<uint32_t>(m_Node.m_Depth);
+      event.m_TextOffset = static_cast<uint32_t>(batch.m_Text.size());
+      event.m_TextLength = 0;
+      event.m_Offset = m_Node.m_Offset;
+
+      if (m_Node.m_Type == XmlNodeBase::XmlNodeType_Value)
+      {
+         if (!TextFitsBatch(batch, m_Node.m_Value.size()))
+         {
+            m_ErrorInfo = L"Text of one batch of events reached 4GB.";
+            return false;
+         }
+         event.m_TextLength = static_cast<uint32_t>(m_Node.m_Value.size());
+         event.m_Offset = start;
+         batch.m_Text += m_Node.m_Value;
+      }
+      else if (m_Node.m_Type == XmlNodeBase::XmlNodeType_Begin)
+      {
+         event.m_Instruction = m_Node.m_Instruction;
+         batch.m_Events.push_back(event);
+         event.m_Instruction = false;
+
+         event.m_Type = XmlEvent::XmlEvent_Attribute;
+         for (auto attribp = m_Node.m_Attribs.begin(); attribp != m_Node.m_Attribs.end(); ++attribp)
+         {
+            if (!TextFitsBatch(batch, attribp->m_Value.size()))
+            {
+               m_ErrorInfo = L"Text of one batch of events reached 4GB.";
+               return false;
+            }
+            event.m_NameId = batch.NameId(attribp->m_Name);
+            event.m_TextOffset = static_cast<uint32_t>(batch.m_Text.size());
+            event.m_TextLength = static_cast<uint32_t>(attribp->m_Value.size());
+            batch.m_Text += attribp->m_Value;
+            batch.m_Events.push_back(event);
+         }
+         continue;
+      }
+      batch.m_Events.push_back(event);
+   }
+
+   return !batch.m_Events.empty();
+}
+
+//--------------------------------------------------------------------
+// Construct.
+//--------------------------------------------------------------------
+XmlMarkupScanner::XmlMarkupScanner() :
+   m_Data(nullptr), m_Size(0), m_Pos(0)
+{
+}
+
+//--------------------------------------------------------------------
+// Begin scanning the {numbytes} bytes at {data}, starting at offset
+// {offset}, which should be the start of text or markup.
+//--------------------------------------------------------------------
+void XmlMarkupScanner::BeginScanning(const void *data, size_t numbytes, size_t offset)
+{
+   m_Data = static_cast<const char *>(data);
+   m_Size = numbytes;
+   m_Pos = std::min(offset, numbytes);
+   m_ErrorInfo.clear();
+}
+
+//--------------------------------------------------------------------
+// Retrieve a description of the most recent error.
+//--------------------------------------------------------------------
+void XmlMarkupScanner::ErrorInfo(std::wstring &errorinfo)
+{
+   errorinfo = m_ErrorInfo;
+}
+
+//--------------------------------------------------------------------
+// Retrieve the offset of the byte after the last span found.
+//--------------------------------------------------------------------
+size_t XmlMarkupScanner::CurPosition(void)
+{
+   return m_Pos;
+}
+
+//--------------------------------------------------------------------
+// Find the {length} bytes of {closer}, which ends with '>', at or
+// after offset {from}.  Returns the offset just past them, or npos if
+// they aren't found.
+//--------------------------------------------------------------------
+size_t XmlMarkupScanner::FindCloser(size_t from, const char *closer, size_t length)
+{
+   const SimdKernels &kernels = Simd();
+   for (size_t pos = from; pos < m_Size; )
+   {
+      pos += kernels.m_FindEither(m_Data + pos, m_Size - pos, '>', '>');
+      if (pos == m_Size)
+         break;
+      ++pos;
+      if (pos - from >= length && memcmp(m_Data + pos - length, closer, length) == 0)
+         return pos;
+   }
+   return std::string::npos;
+}
+
+//--------------------------------------------------------------------
+// Find the '>' that ends a begin tag whose name starts at offset
+// {from}, skipping over any '>' inside quoted attribute values.
+// Returns the offset just past it, or npos if it isn't found.
+//--------------------------------------------------------------------
+size_t XmlMarkupScanner::FindTagEnd(size_t from)
+{
+   const SimdKernels &kernels = Simd();
+   size_t close = 0;
+   for (size_t pos = from; pos < m_Size; )
+   {
+      // The '>' found before a quoted value may have been inside it.
+      if (close < pos)
+      {
+         close = pos + kernels.m_FindEither(m_Data + pos, m_Size - pos, '>', '>');
+         if (close == m_Size)
+            break;
+      }
+      size_t quote = pos + kernels.m_FindEither(m_Data + pos, close - pos, '"', '\'');
+      if (quote == close)
+         return close + 1;
+
+      // Skip the quoted value and look again after it.
+      pos = quote + 1;
+      pos += kernels.m_FindEither(m_Data + pos, m_Size - pos, m_Data[quote], m_Data[quote]);
+      ++pos;
+   }
+   return std::string::npos;
+}
+
+//--------------------------------------------------------------------
+// Find the '>' that ends a declaration such as "<!DOCTYPE ...>" that
+// starts at offset {from}, skipping over any internal subset in
+// square brackets.  Returns the offset just past it, or npos if it
+// isn't found.
+//--------------------------------------------------------------------
+size_t XmlMarkupScanner::FindDeclarationEnd(size_t from)
+{
+   const SimdKernels &kernels = Simd();
+   for (size_t pos = from; pos < m_Size; )
+   {
+      pos += kernels.m_FindEither(m_Data + pos, m_Size - pos, '>', '[');
+      if (pos == m_Size)
+         break;
+      if (m_Data[pos] == '>')
+         return pos + 1;
+      ++pos;
+      pos += kernels.m_FindEither(m_Data + pos, m_Size - pos, ']', ']');
+   }
+   return std::string::npos;
+}
+
+//--------------------------------------------------------------------
+// Find the next span of the document into {span}.  Returns false if
+// the markup is unterminated or there are no more spans.
+//--------------------------------------------------------------------
+bool XmlMarkupScanner::NextSpan(XmlMarkupSpan &span)
+{
+   if (m_Pos >= m_Size)
+      return false;
+
+   const SimdKernels &kernels = Simd();
+   const char *data = m_Data + m_Pos;
+   size_t left = m_Size - m_Pos;
+   span.m_Data = data;
+   span.m_WhiteSpace = false;
+
+   if (*data != '<')
+   {
+      span.m_Type = XmlMarkupSpan::XmlSpan_Text;
+      span.m_Length = kernels.m_FindEither(data, left, '<', '<');
+      span.m_WhiteSpace = (kernels.m_SkipSpace(data, span.m_Length) == span.m_Length);
+      m_Pos += span.m_Length;
+      return true;
+   }
+
+   size_t end;
+   if (left >= 4 && memcmp(data, "<!--", 4) == 0)
+   {
+      span.m_Type = XmlMarkupSpan::XmlSpan_Comment;
+      end = FindCloser(m_Pos + 4, "-->", 3);
+   }
+   else if (left >= 9 && memcmp(data, "<![CDATA[", 9) == 0)
+   {
+      span.m_Type = XmlMarkupSpan::XmlSpan_CData;
+      end = FindCloser(m_Pos + 9, "]]>", 3);
+   }
+   else if (left >= 2 && data[1] == '?')
+   {
+      span.m_Type = XmlMarkupSpan::XmlSpan_Instruction;
+      end = FindCloser(m_Pos + 2, "?>", 2);
+   }
+   else if (left >= 2 && data[1] == '!')
+   {
+      span.m_Type = XmlMarkupSpan::XmlSpan_Declaration;
+      end = FindDeclarationEnd(m_Pos + 2);
+   }
+   else if (left >= 2 && data[1] == '/')
+   {
+      span.m_Type = XmlMarkupSpan::XmlSpan_EndTag;
+      end = FindCloser(m_Pos + 2, ">", 1);
+   }
+   else
+   {
+      span.m_Type = XmlMarkupSpan::XmlSpan_BeginTag;
+      end = FindTagEnd(m_Pos + 1);
+      if (end != std::string::npos && end - m_Pos >= 3 && m_Data[end - 2] == '/')
+         span.m_Type = XmlMarkupSpan::XmlSpan_EmptyTag;
+   }
+
+   if (end == std::string::npos)
+   {
+      m_ErrorInfo = L"Unterminated markup at end of document.";
+      return false;
+   }
+   span.m_Length = end - m_Pos;
+   m_Pos = end;
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Dump contents of this tree to caller-provided string {text},
+// for human viewing.
+//--------------------------------------------------------------------
+void XmlElementTree::dump(std::wstring &text, size_t indent)
+{
+   if (m_Begin.m_Type == XmlNodeBase::XmlNodeType_Begin)
+   {
+      AddSpaces(text, indent);
+      text += L"Begin:  ";
+      text += m_Begin.m_Name;
+      text += L"\n";
+      for (auto attribp = m_Begin.m_Attribs.begin(); attribp != m_Begin.m_Attribs.end(); ++attribp)
+      {
+         text += L"  Attrib:  ";
+         text += attribp->m_Name;
+         text += L"=";
+         text += attribp->m_Value;
+         text += L"\n";
+      }
+   }
+   if (m_Value.m_Type == XmlNodeBase::XmlNodeType_Value)
+   {
+      AddSpaces(text, indent + 4);
+      text += L"Value:  ";
+      text += m_Value.m_Value;
+      text += L"\n";
+   }
+   if (m_End.m_Type == XmlNodeBase::XmlNodeType_End)
+   {
+      AddSpaces(text, indent);
+      text += L"End:  ";
+      text += m_End.m_Name;
+      text += L"\n";
+   }
+   if (!m_Children.empty())
+   {
+      for (auto childp = m_Children.begin(); childp != m_Children.end(); ++childp)
+         childp->dump(text, indent + 4);
+   }
+}
+
+//--------------------------------------------------------------------
+// Build a new persistent tree from a copy of {tree}.  If {shareidentical}
+// is true, identical subtrees are only stored once.
+//--------------------------------------------------------------------
+XmlSharedTree::Ptr XmlSharedTree::FromTree(const XmlElementTree &tree, bool shareidentical)
+{
+   SubtreeMap subtrees;
+   return FromTreeImpl(tree, shareidentical ? &subtrees : nullptr);
+}
+
+//--------------------------------------------------------------------
+// Returns true if {tree1} and {tree2} have the same contents, not
+// counting the offsets of their nodes.
+//--------------------------------------------------------------------
+bool XmlSharedTree::SameTree(const XmlSharedTree &tree1, const XmlElementTree &tree2)
+{
+   if (tree1.m_Begin.m_Name != tree2.m_Begin.m_Name ||
+       tree1.m_Value.m_Value != tree2.m_Value.m_Value ||
+       tree1.m_Begin.m_Attribs.size() != tree2.m_Begin.m_Attribs.size() ||
+       tree1.m_Children.size() != tree2.m_Children.size())
+      return false;
+
+   for (size_t index = 0; index < tree1.m_Begin.m_Attribs.size(); ++index)
+   {
+      if (tree1.m_Begin.m_Attribs[index].m_Name != tree2.m_Begin.m_Attribs[index].m_Name ||
+          tree1.m_Begin.m_Attribs[index].m_Value != tree2.m_Begin.m_Attribs[index].m_Value)
+         return false;
+   }
+
+   for (size_t index = 0; index < tree1.m_Children.size(); ++index)
+      if (!SameTree(*tree1.m_Children[index], tree2.m_Children[index]))
+         return false;
+
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Build a new persistent tree from a copy of {tree}.  If {subtrees} is
+// not nullptr, it holds the subtrees built so far by fingerprint, and
+// any subtree identical to one of those is shared instead of copied.
+//--------------------------------------------------------------------
+XmlSharedTree::Ptr XmlSharedTree::FromTreeImpl(const XmlElementTree &tree, SubtreeMap *subtrees)
+{
+   uint64_t hash = tree.m_End.m_Hash;
+   if (subtrees && hash != 0)
+   {
+      // Fingerprints can collide, so confirm the match before sharing.
+      auto range = subtrees->equal_range(hash);
+      for (auto iter = range.first; iter != range.second; ++iter)
+         if (SameTree(*iter->second, tree))
+            return iter->second;
+   }
+
+   std::shared_ptr<XmlSharedTree> node(new XmlSharedTree);
+   node->m_Begin = tree.m_Begin;
+   node->m_Value = tree.m_Value;
+   node->m_End = tree.m_End;
+   node->m_Children.reserve(tree.m_Children.size());
+   for (auto childp = tree.m_Children.begin(); childp != tree.m_Children.end(); ++childp)
+      node->m_Children.push_back(FromTreeImpl(*childp, subtrees));
+
+   if (subtrees && hash != 0)
+      subtrees->insert(std::make_pair(hash, node));
+   return node;
+}
+
+//--------------------------------------------------------------------
+// Copy the contents of this tree into an ordinary tree {tree}.
+//--------------------------------------------------------------------
+void XmlSharedTree::ToTree(XmlElementTree &tree) const
+{
+   tree.m_Begin = m_Begin;
+   tree.m_Value = m_Value;
+   tree.m_End = m_End;
+   tree.m_Children.clear();
+   tree.m_Children.resize(m_Children.size());
+   for (size_t index = 0; index < m_Children.size(); ++index)
+      m_Children[index]->ToTree(tree.m_Children[index]);
+}
+
+//--------------------------------------------------------------------
+// Returns the element at {path} below {root}, or nullptr if the path
+// doesn't exist.
+//--------------------------------------------------------------------
+XmlSharedTree::Ptr XmlSharedTree::Find(const Ptr &root, const std::vector<size_t> &path)
+{
+   Ptr node = root;
+   for (auto iter = path.begin(); node && iter != path.end(); ++iter)
+   {
+      if (*iter >= node->m_Children.size())
+         return nullptr;
+      node = node->m_Children[*iter];
+   }
+   return node;
+}
+
+//--------------------------------------------------------------------
+// Returns a copy of {node} in which the descendant at {path}, starting
+// from level {depth} of the path, is replaced by {replacement}.  Only
+// the elements along the path are copied; every other child pointer
+// is shared with {node}.  Returns nullptr if the path doesn't exist.
+//--------------------------------------------------------------------
+XmlSharedTree::Ptr XmlSharedTree::ReplaceImpl(const Ptr &node, const std::vector<size_t> &path, size_t depth, const Ptr &replacement)
+{
+   if (depth == path.size())
+      return replacement;
+   if (!node || path[depth] >= node->m_Children.size())
+      return nullptr;
+
+   Ptr newchild = ReplaceImpl(node->m_Children[path[depth]], path, depth + 1, replacement);
+   if (!newchild)
+      return nullptr;
+
+   std::shared_ptr<XmlSharedTree> copy(new XmlSharedTree(*node));
+   copy->m_Children[path[depth]] = newchild;
+   return copy;
+}
+
+//--------------------------------------------------------------------
+// Returns a new version of {root} with the element at {path} replaced
+// by {replacement}, or nullptr if the path doesn't exist.
+//--------------------------------------------------------------------
+XmlSharedTree::Ptr XmlSharedTree::Replace(const Ptr &root, const std::vector<size_t> &path, const Ptr &replacement)
+{
+   if (!replacement)
+      return nullptr;
+   return ReplaceImpl(root, path, 0, replacement);
+}
+
+//--------------------------------------------------------------------
+// Returns a new version of {root} with the value text of the element
+// at {path} set to {value}, or nullptr if the path doesn't exist.
+//--------------------------------------------------------------------
+XmlSharedTree::Ptr XmlSharedTree::SetValue(const Ptr &root, const std::vector<size_t> &path, const std::wstring &value)
+{
+   Ptr node = Find(root, path);
+   if (!node)
+      return nullptr;
+
+   std::shared_ptr<XmlSharedTree> copy(new XmlSharedTree(*node));
+   copy->m_Value.m_Name = copy->m_Begin.m_Name;
+   copy->m_Value.m_Value = value;
+   return Replace(root, path, copy);
+}
+
+//--------------------------------------------------------------------
+// Returns a new version of {root} with {child} inserted before child
+// number {index} of the element at {path}, or nullptr if the path
+// doesn't exist.
+//--------------------------------------------------------------------
+XmlSharedTree::Ptr XmlSharedTree::InsertChild(const Ptr &root, const std::vector<size_t> &path, size_t index, const Ptr &child)
+{
+   Ptr node = Find(root, path);
+   if (!node || !child)
+      return nullptr;
+
+   std::shared_ptr<XmlSharedTree> copy(new XmlSharedTree(*node));
+   index = std::min(index, copy->m_Children.size());
+   copy->m_Children.insert(copy->m_Children.begin() + index, child);
+   return Replace(root, path, copy);
+}
+
+//--------------------------------------------------------------------
+// Returns a new version of {root} with child number {index} removed
+// from the element at {path}, or nullptr if the path or child doesn't
+// exist.
+//--------------------------------------------------------------------
+XmlSharedTree::Ptr XmlSharedTree::RemoveChild(const Ptr &root, const std::vector<size_t> &path, size_t index)
+{
+   Ptr node = Find(root, path);
+   if (!node || index >= node->m_Children.size())
+      return nullptr;
+
+   std::shared_ptr<XmlSharedTree> copy(new XmlSharedTree(*node));
+   copy->m_Children.erase(copy->m_Children.begin() + index);
+   return Replace(root, path, copy);
+}
+
+//--------------------------------------------------------------------
+// Construct from the contents of {root}.
+//--------------------------------------------------------------------
+XmlFrozenDocument::XmlFrozenDocument(XmlElementTree &&root) :
+   m_Root(std::move(root)), m_Index(nullptr)
+{
+}
+
+//--------------------------------------------------------------------
+// Destruct.
+//--------------------------------------------------------------------
+XmlFrozenDocument::~XmlFrozenDocument()
+{
+   delete m_Index.load();
+}
+
+//--------------------------------------------------------------------
+// Add {elm} and all of its descendants to {index}, in document order.
+//--------------------------------------------------------------------
+void XmlFrozenDocument::AddToIndex(NameIndex &index, const XmlElementTree &elm)
+{
+   for (auto childp = elm.m_Children.begin(); childp != elm.m_Children.end(); ++childp)
+   {
+      index[childp->m_Begin.m_Name].push_back(&*childp);
+      AddToIndex(index, *childp);
+   }
+}
+
+//--------------------------------------------------------------------
+// Retrieve the name index, building it first if no thread has done
+// so yet.  Safe to call from any number of threads at once.
+//--------------------------------------------------------------------
+const XmlFrozenDocument::NameIndex & XmlFrozenDocument::Index(void) const
+{
+   const NameIndex *index = m_Index.load(std::memory_order_acquire);
+   if (index != nullptr)
+      return *index;
+
+   std::unique_ptr<NameIndex> built(new NameIndex);
+   AddToIndex(*built, m_Root);
+
+   // Publish our copy unless another thread beat us to it, in which
+   // case {index} receives the winner's copy and ours is discarded.
+   if (m_Index.compare_exchange_strong(index, built.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+      return *built.release();
+   return *index;
+}
+
+//--------------------------------------------------------------------
+// Retrieve pointers to all elements named {name} into {elements},
+// in document order.
+//--------------------------------------------------------------------
+void XmlFrozenDocument::FindElements(const std::wstring &name, std::vector<const XmlElementTree *> &elements) const
+{
+   elements.clear();
+   const NameIndex &index = Index();
+   auto iter = index.find(name);
+   if (iter != index.end())
+      elements = iter->second;
+}
+
+//--------------------------------------------------------------------
+// Returns the first element named {name} in document order, or
+// nullptr if there is no such element.
+//--------------------------------------------------------------------
+const XmlElementTree * XmlFrozenDocument::FindFirst(const std::wstring &name) const
+{
+   const NameIndex &index = Index();
+   auto iter = index.find(name);
+   if (iter == index.end() || iter->second.empty())
+      return nullptr;
+   return iter->second[0];
+}
+
+//--------------------------------------------------------------------
+// Round constants of SHA-256.
+//--------------------------------------------------------------------
+static const uint32_t sha256Constants[64] =
+{
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+   0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+   0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+   0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+   0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+   0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+//--------------------------------------------------------------------
+// Rotate {value} right by {count} bits.
+//--------------------------------------------------------------------
+static uint32_t RotateRight(uint32_t value, unsigned count)
+{
+   return (value >> count) | (value << (32 - count));
+}
+
+//--------------------------------------------------------------------
+// Construct.
+//--------------------------------------------------------------------
+XmlSha256::XmlSha256()
+{
+   Reset();
+}
+
+//--------------------------------------------------------------------
+// Discard anything written and start a new digest.
+//--------------------------------------------------------------------
+void XmlSha256::Reset(void)
+{
+   static const uint32_t initial[8] =
+   {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+   };
+   for (size_t index = 0; index < 8; ++index)
+      m_State[index] = initial[index];
+   m_BlockLength = 0;
+   m_TotalLength = 0;
+}
+
+//--------------------------------------------------------------------
+// Mix the 64 bytes at {block} into the hash.
+//--------------------------------------------------------------------
+void XmlSha256::Transform(const unsigned char *block)
+{
+   uint32_t w[64];
+   for (size_t index = 0; index < 16; ++index)
+      w[index] = (static_cast<uint32_t>(block[index * 4]) << 24) |
+                 (static_cast<uint32_t>(block[index * 4 + 1]) << 16) |
+                 (static_cast<uint32_t>(block[index * 4 + 2]) << 8) |
+                 static_cast<uint32_t>(block[index * 4 + 3]);
+   for (size_t index = 16; index < 64; ++index)
+   {
+      uint32_t s0 = RotateRight(w[index - 15], 7) ^ RotateRight(w[index - 15], 18) ^ (w[index - 15] >> 3);
+      uint32_t s1 = RotateRight(w[index - 2], 17) ^ RotateRight(w[index - 2], 19) ^ (w[index - 2] >> 10);
+      w[index] = w[index - 16] + s0 + w[index - 7] + s1;
+   }
+
+   uint32_t a = m_State[0], b = m_State[1], c = m_State[2], d = m_State[3];
+   uint32_t e = m_State[4], f = m_State[5], g = m_State[6], h = m_State[7];
+   for (size_t index = 0; index < 64; ++index)
+   {
+      uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+      uint32_t choose = (e & f) ^ (~e & g);
+      uint32_t temp1 = h + s1 + choose + sha256Constants[index] + w[index];
+      uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+      uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t temp2 = s0 + majority;
+      h = g;
+      g = f;
+      f = e;
+      e = d + temp1;
+      d = c;
+      c = b;
+      b = a;
+      a = temp1 + temp2;
+   }
+   m_State[0] += a;
+   m_State[1] += b;
+   m_State[2] += c;
+   m_State[3] += d;
+   m_State[4] += e;
+   m_State[5] += f;
+   m_State[6] += g;
+   m_State[7] += h;
+}
+
+//--------------------------------------------------------------------
+// Add the {length} bytes at {data} to the digest.
+//--------------------------------------------------------------------
+bool XmlSha256::Write(const char *data, size_t length)
+{
+   const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+   m_TotalLength += length;
+
+   // Top up a partial block first, then hash whole blocks straight
+   // from the caller's data.
+   if (m_BlockLength != 0)
+   {
+      size_t count = std::min(length, sizeof(m_Block) - m_BlockLength);
+      memcpy(m_Block + m_BlockLength, bytes, count);
+      m_BlockLength += count;
+      bytes += count;
+      length -= count;
+      if (m_BlockLength < sizeof(m_Block))
+         return true;
+      Transform(m_Block);
+      m_BlockLength = 0;
+   }
+   for (; length >= sizeof(m_Block); bytes += sizeof(m_Block), length -= sizeof(m_Block))
+      Transform(bytes);
+   memcpy(m_Block, bytes, length);
+   m_BlockLength = length;
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Finish the digest, retrieving it into {digest}, and start a new one.
+//--------------------------------------------------------------------
+void XmlSha256::Finish(unsigned char digest[32])
+{
+   // Pad with a 1 bit, zeros, and the length in bits.
+   uint64_t bits = m_TotalLength * 8;
+   unsigned char padding[72] = { 0x80 };
+   size_t padlength = ((m_BlockLength < 56) ? 56 : 120) - m_BlockLength;
+   for (size_t index = 0; index < 8; ++index)
+      padding[padlength + index] = static_cast<unsigned char>(bits >> (56 - index * 8));
+   Write(reinterpret_cast<const char *>(padding), padlength + 8);
+
+   for (size_t index = 0; index < 8; ++index)
+   {
+      digest[index * 4]     = static_cast<unsigned char>(m_State[index] >> 24);
+      digest[index * 4 + 1] = static_cast<unsigned char>(m_State[index] >> 16);
+      digest[index * 4 + 2] = static_cast<unsigned char>(m_State[index] >> 8);
+      digest[index * 4 + 3] = static_cast<unsigned char>(m_State[index]);
+   }
+   Reset();
+}
+
+//--------------------------------------------------------------------
+// Finish the digest, retrieving it into {hex} as hexadecimal digits,
+// and start a new one.
+//--------------------------------------------------------------------
+void XmlSha256::Finish(std::wstring &hex)
+{
+   static const wchar_t digits[] = L"0123456789abcdef";
+   unsigned char digest[32];
+   Finish(digest);
+   hex.clear();
+   for (size_t index = 0; index < sizeof(digest); ++index)
+   {
+      hex += digits[digest[index] >> 4];
+      hex += digits[digest[index] & 0x0F];
+   }
+}
+
+// Amount of canonical output XmlCanonicalWriter collects before
+// writing it out.
+//
+const size_t canonicalBlockSize = 65536;
+
+//--------------------------------------------------------------------
+// Construct.
+//--------------------------------------------------------------------
+XmlCanonicalWriter::XmlCanonicalWriter(XmlStreamOutputInterface &out) :
+   m_Out(out), m_Latin1(false), m_SeenRoot(false), m_SkipEnd(false)
+{
+}
+
+//--------------------------------------------------------------------
+// Retrieve a description of the most recent error.
+//--------------------------------------------------------------------
+void XmlCanonicalWriter::ErrorInfo(std::wstring &errorinfo)
+{
+   errorinfo = m_ErrorInfo;
+}
+
+//--------------------------------------------------------------------
+// Append character {c} to {out} as UTF-8.  Characters below 256 in a
+// document that isn't ISO-8859-1 are bytes of UTF-8 already, as the
+// parser read them, and are appended unchanged.
+//--------------------------------------------------------------------
+void XmlCanonicalWriter::AppendChar(std::string &out, uint32_t c)
+{
+   if (c < 0x80 || (c < 0x100 && !m_Latin1))
+      out += static_cast<char>(c);
+   else if (c < 0x800)
+   {
+      out += static_cast<char>(0xC0 | (c >> 6));
+      out += static_cast<char>(0x80 | (c & 0x3F));
+   }
+   else if (c < 0x10000)
+   {
+      out += static_cast<char>(0xE0 | (c >> 12));
+      out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (c & 0x3F));
+   }
+   else
+   {
+      out += static_cast<char>(0xF0 | (c >> 18));
+      out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (c & 0x3F));
+   }
+}
+
+//--------------------------------------------------------------------
+// Returns the character at {index} in {text}, joining a UTF-16
+// surrogate pair into one character and advancing {index} past the
+// second half of the pair.
+//--------------------------------------------------------------------
+static uint32_t NextCodePoint(const std::wstring &text, size_t &index)
+{
+   uint32_t c = static_cast<uint32_t>(text[index]);
+   if (sizeof(wchar_t) == 2 && c >= 0xD800 && c < 0xDC00 && index + 1 < text.size())
+   {
+      uint32_t low = static_cast<uint32_t>(text[index + 1]);
+      if (low >= 0xDC00 && low < 0xE000)
+      {
+         ++index;
+         c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+      }
+   }
+   return c;
+}
+
+//--------------------------------------------------------------------
+// Append {text}, such as a tag name, to the output as UTF-8 without
+// expanding or escaping anything.
+//--------------------------------------------------------------------
+void XmlCanonicalWriter::AppendText(const std::wstring &text)
+{
+   for (size_t index = 0; index < text.size(); ++index)
+      AppendChar(m_Buffer, NextCodePoint(text, index));
+}
+
+//--------------------------------------------------------------------
+// Expand the entity and character references in {text} into
+// m_Expanded as UTF-8, normalizing line endings to LF.  Attribute
+// values also have their literal whitespace normalized to spaces.
+// Returns false if {text} has a bad reference.
+//--------------------------------------------------------------------
+bool XmlCanonicalWriter::Expand(const std::wstring &text, bool attribute)
+{
+   static const struct { const wchar_t *m_Name; wchar_t m_Char; } entities[] =
+   {
+      { L"lt", '<' }, { L"gt", '>' }, { L"amp", '&' }, { L"quot", '"' }, { L"apos", '\'' },
+   };
+
+   m_Expanded.clear();
+   for (size_t index = 0; index < text.size(); ++index)
+   {
+      uint32_t c = NextCodePoint(text, index);
+      if (c == '&')
+      {
+         size_t end = text.find(';', index);
+         if (end == std::wstring::npos)
+         {
+            m_ErrorInfo = L"Unterminated reference:  " + text.substr(index);
+            return false;
+         }
+         std::wstring name = text.substr(index + 1, end - index - 1);
+         index = end;
+
+         if (name.size() > 1 && name[0] == '#')
+         {
+            // Character reference, decimal or hexadecimal.
+            bool hex = (name[1] == 'x');
+            const wchar_t *digits = name.c_str() + (hex ? 2 : 1);
+            wchar_t *stop = nullptr;
+            errno = 0;
+            unsigned long code = wcstoul(digits, &stop, hex ? 16 : 10);
+            if (*digits == 0 || *stop != 0 || errno != 0 || code == 0 || code > 0x10FFFF ||
+                (code >= 0xD800 && code < 0xE000))
+            {
+               m_ErrorInfo = L"Bad character reference:  &" + name + L";";
+               return false;
+            }
+
+            // Referenced characters are real code points, even below 256.
+            bool latin1 = m_Latin1;
+            m_Latin1 = true;
+            AppendChar(m_Expanded, static_cast<uint32_t>(code));
+            m_Latin1 = latin1;
+            continue;
+         }
+
+         size_t which = 0;
+         while (which < sizeof(entities) / sizeof(entities[0]) && name != entities[which].m_Name)
+            ++which;
+         if (which == sizeof(entities) / sizeof(entities[0]))
+         {
+            m_ErrorInfo = L"Unknown entity reference:  &" + name + L";";
+            return false;
+         }
+         m_Expanded += static_cast<char>(entities[which].m_Char);
+         continue;
+      }
+
+      // A CR LF pair or a lone CR is a line ending, which becomes LF.
+      if (c == '\r')
+      {
+         if (index + 1 < text.size() && text[index + 1] == '\n')
+            continue;
+         c = '\n';
+      }
+      if (attribute && (c == '\n' || c == '\t'))
+         c = ' ';
+      AppendChar(m_Expanded, c);
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Append m_Expanded to the output, escaping the characters canonical
+// XML requires to be escaped in text, or in attribute values if
+// {attribute} is true.  Runs of characters that don't need escaping
+// are found with the vectorized kernels and copied whole.
+//--------------------------------------------------------------------
+void XmlCanonicalWriter::AppendEscaped(bool attribute)
+{
+   const char *data = m_Expanded.data();
+   size_t length = m_Expanded.size();
+   size_t index = 0;
+   while (index < length)
+   {
+      size_t count = Simd().m_FindSpecial(data + index, length - index);
+      m_Buffer.append(data + index, count);
+      index += count;
+      if (index == length)
+         break;
+
+      char c = data[index++];
+      switch (c)
+      {
+         case '&':   m_Buffer += "&amp;"; break;
+         case '<':   m_Buffer += "&lt;";  break;
+         case '\r':  m_Buffer += "&#xD;"; break;
+         case '>':   m_Buffer += (attribute ? ">" : "&gt;"); break;
+         case '"':   m_Buffer += (attribute ? "&quot;" : "\""); break;
+         case '\t':  m_Buffer += (attribute ? "&#x9;" : "\t"); break;
+         case '\n':  m_Buffer += (attribute ? "&#xA;" : "\n"); break;
+         default:    m_Buffer += c; break;
+      }
+   }
+}
+
+//--------------------------------------------------------------------
+// Write m_Buffer out once a block has been collected, or regardless
+// if {all} is true.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlCanonicalWriter::Flush(bool all)
+{
+   if (m_Buffer.empty() || (!all && m_Buffer.size() < canonicalBlockSize))
+      return true;
+
+   if (!m_Out.Write(m_Buffer.data(), m_Buffer.size()))
+   {
+      m_ErrorInfo = L"Failed writing canonical output.";
+      return false;
+   }
+   m_Buffer.clear();
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Returns the URI that {prefix} is bound to by the open elements, or
+// nullptr if it isn't bound.
+//--------------------------------------------------------------------
+const std::wstring *XmlCanonicalWriter::FindBinding(const std::wstring &prefix)
+{
+   for (auto bindp = m_Bindings.rbegin(); bindp != m_Bindings.rend(); ++bindp)
+      if (bindp->m_Prefix == prefix)
+         return &bindp->m_Uri;
+   return nullptr;
+}
+
+//--------------------------------------------------------------------
+// Write a processing instruction with its data as written.  The XML
+// declaration is dropped after noting the document's encoding.
+// Returns false if error.
+//--------------------------------------------------------------------
+bool XmlCanonicalWriter::WriteInstruction(const XmlBeginNode &begin)
+{
+   m_SkipEnd = true;
+   if (begin.m_Name == L"xml")
+   {
+      for (auto attribp = begin.m_Attribs.begin(); attribp != begin.m_Attribs.end(); ++attribp)
+         if (attribp->m_Name == L"encoding")
+            m_Latin1 = (_wcsicmp(attribp->m_Value.c_str(), L"ISO-8859-1") == 0 ||
+                        _wcsicmp(attribp->m_Value.c_str(), L"latin1") == 0);
+      return true;
+   }
+
+   // Data read as attributes can't be put back as it was written.
+   if (!begin.m_Attribs.empty())
+   {
+      m_ErrorInfo = L"Data of processing instruction wasn't kept:  " + begin.m_Name;
+      return false;
+   }
+
+   if (m_Open.empty() && m_SeenRoot)
+      m_Buffer += '\n';
+   m_Buffer += "<?";
+   AppendText(begin.m_Name);
+   if (!begin.m_Data.empty())
+   {
+      // Line endings are normalized to LF, but nothing is escaped.
+      m_Buffer += ' ';
+      for (size_t index = 0; index < begin.m_Data.size(); ++index)
+      {
+         uint32_t c = NextCodePoint(begin.m_Data, index);
+         if (c == '\r')
+         {
+            if (index + 1 < begin.m_Data.size() && begin.m_Data[index + 1] == '\n')
+               continue;
+            c = '\n';
+         }
+         AppendChar(m_Buffer, c);
+      }
+   }
+   m_Buffer += "?>";
+   if (m_Open.empty() && !m_SeenRoot)
+      m_Buffer += '\n';
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Write the begin tag of an element, with its namespace declarations
+// and attributes in canonical order.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlCanonicalWriter::WriteBegin(const XmlBeginNode &begin)
+{
+   m_SeenRoot = true;
+   m_Open.push_back(begin.m_Name);
+   size_t depth = m_Open.size();
+
+   // Sort the namespace declarations by prefix, and drop those that
+   // don't change what's in effect.  An empty default namespace is
+   // what's in effect when none is declared.
+   //
+   std::vector<Binding> declared;
+   for (auto attribp = begin.m_Attribs.begin(); attribp != begin.m_Attribs.end(); ++attribp)
+   {
+      Binding binding;
+      if (attribp->m_Name == L"xmlns")
+         binding.m_Prefix.clear();
+      else if (attribp->m_Name.compare(0, 6, L"xmlns:") == 0)
+         binding.m_Prefix = attribp->m_Name.substr(6);
+      else
+         continue;
+      if (!Expand(attribp->m_Value, true))
+         return false;
+      binding.m_Uri.clear();
+      for (size_t index = 0; index < m_Expanded.size(); ++index)
+         binding.m_Uri += static_cast<unsigned char>(m_Expanded[index]);
+      binding.m_Depth = depth;
+      declared.push_back(binding);
+   }
+   for (size_t index = 1; index < declared.size(); ++index)
+      for (size_t back = index; back > 0 && declared[back].m_Prefix < declared[back - 1].m_Prefix; --back)
+         std::swap(declared[back], declared[back - 1]);
+
+   m_Buffer += '<';
+   AppendText(begin.m_Name);
+   for (auto bindp = declared.begin(); bindp != declared.end(); ++bindp)
+   {
+      const std::wstring *current = FindBinding(bindp->m_Prefix);
+      bool redundant = (current != nullptr) ? (*current == bindp->m_Uri)
+                                            : (bindp->m_Prefix.empty() && bindp->m_Uri.empty());
+      if (redundant)
+         continue;
+
+      m_Buffer += " xmlns";
+      if (!bindp->m_Prefix.empty())
+      {
+         m_Buffer += ':';
+         AppendText(bindp->m_Prefix);
+      }
+      m_Buffer += "=\"";
+      Expand(bindp->m_Uri, true);
+      AppendEscaped(true);
+      m_Buffer += '"';
+   }
+   m_Bindings.insert(m_Bindings.end(), declared.begin(), declared.end());
+
+   // Sort the other attributes by namespace URI and local name.  There
+   // are usually only a few, so a simple insertion sort does.
+   //
+   static const std::wstring xmlUri = L"http://www.w3.org/XML/1998/namespace";
+   std::vector<SortedAttribute> sorted;
+   for (auto attribp = begin.m_Attribs.begin(); attribp != begin.m_Attribs.end(); ++attribp)
+   {
+      if (attribp->m_Name == L"xmlns" || attribp->m_Name.compare(0, 6, L"xmlns:") == 0)
+         continue;
+
+      SortedAttribute attrib;
+      attrib.m_Attrib = &*attribp;
+      size_t colon = attribp->m_Name.find(':');
+      if (colon == std::wstring::npos)
+         attrib.m_LocalName = attribp->m_Name;
+      else
+      {
+         std::wstring prefix = attribp->m_Name.substr(0, colon);
+         const std::wstring *uri = (prefix == L"xml") ? &xmlUri : FindBinding(prefix);
+         if (uri == nullptr)
+         {
+            m_ErrorInfo = L"Undeclared namespace prefix:  " + attribp->m_Name;
+            return false;
+         }
+         attrib.m_Uri = *uri;
+         attrib.m_LocalName = attribp->m_Name.substr(colon + 1);
+      }
+      sorted.push_back(attrib);
+   }
+   for (size_t index = 1; index < sorted.size(); ++index)
+   {
+      for (size_t back = index; back > 0; --back)
+      {
+         const SortedAttribute &a = sorted[back - 1], &b = sorted[back];
+         int order = a.m_Uri.compare(b.m_Uri);
+         if (order < 0 || (order == 0 && a.m_LocalName.compare(b.m_LocalName) <= 0))
+            break;
+         std::swap(sorted[back], sorted[back - 1]);
+      }
+   }
+
+   for (auto attribp = sorted.begin(); attribp != sorted.end(); ++attribp)
+   {
+      m_Buffer += ' ';
+      AppendText(attribp->m_Attrib->m_Name);
+      m_Buffer += "=\"";
+      if (!Expand(attribp->m_Attrib->m_Value, true))
+         return false;
+      AppendEscaped(true);
+      m_Buffer += '"';
+   }
+   m_Buffer += '>';
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Write the end tag of the innermost open element.  Returns false if
+// error.
+//--------------------------------------------------------------------
+bool XmlCanonicalWriter::WriteEnd(void)
+{
+   if (m_Open.empty())
+   {
+      m_ErrorInfo = L"End tag outside of all elements.";
+      return false;
+   }
+
+   m_Buffer += "</";
+   AppendText(m_Open.back());
+   m_Buffer += '>';
+
+   while (!m_Bindings.empty() && m_Bindings.back().m_Depth == m_Open.size())
+      m_Bindings.pop_back();
+   m_Open.pop_back();
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Write the canonical form of {node}.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlCanonicalWriter::Write(const XmlNodeBase &node)
+{
+   bool ok = true;
+   switch (node.m_Type)
+   {
+      case XmlNodeBase::XmlNodeType_Begin:
+      {
+         const XmlBeginNode &begin = static_cast<const XmlBeginNode &>(node);
+         ok = begin.m_Instruction ? WriteInstruction(begin) : WriteBegin(begin);
+         break;
+      }
+
+      case XmlNodeBase::XmlNodeType_Value:
+      {
+         // Whitespace outside the root element isn't part of the
+         // canonical form.
+         if (!m_Open.empty())
+         {
+            ok = Expand(static_cast<const XmlValueNode &>(node).m_Value, false);
+            if (ok)
+               AppendEscaped(false);
+         }
+         break;
+      }
+
+      case XmlNodeBase::XmlNodeType_End:
+      {
+         if (m_SkipEnd)
+            m_SkipEnd = false;
+         else
+            ok = WriteEnd();
+         break;
+      }
+
+      default:
+         m_ErrorInfo = L"Invalid node type.";
+         ok = false;
+         break;
+   }
+
+   return ok && Flush(false);
+}
+
+//--------------------------------------------------------------------
+// Finish the document and write any remaining output.  Returns false
+// if error.
+//--------------------------------------------------------------------
+bool XmlCanonicalWriter::Finish(void)
+{
+   if (!m_Open.empty())
+   {
+      m_ErrorInfo = L"Document ended with element still open:  " + m_Open.back();
+      return false;
+   }
+   return Flush(true);
+}
+
+//--------------------------------------------------------------------
+// Parse {text} as a number into {number}.  Returns false if {text}
+// isn't a number, ignoring surrounding whitespace.
+//--------------------------------------------------------------------
+bool XmlParseNumber(const std::wstring &text, double &number)
+{
+   const wchar_t *start = text.c_str();
+   wchar_t *end = nullptr;
+   number = wcstod(start, &end);
+   if (end == start)
+      return false;
+   while (*end != 0 && iswspace(*end))
+      ++end;
+   return *end == 0;
+}
+
+//--------------------------------------------------------------------
+// Construction for reading the records named {recordname} from the
+// document being parsed by {xml}.
+//--------------------------------------------------------------------
+XmlRecordReader::XmlRecordReader(XmlParser &xml, const wchar_t *recordname,
+                                 const std::vector<std::wstring> &fieldpaths) :
+   m_Xml(xml), m_RecordName(recordname), m_FieldPaths(fieldpaths)
+{
+}
+
+//--------------------------------------------------------------------
+// Add the {value} of the field at {path} in the current record to
+// each matching entry of {fields}.
+//--------------------------------------------------------------------
+void XmlRecordReader::AddField(const std::wstring &path, const std::wstring &value,
+                               std::vector<std::vector<std::wstring> > &fields)
+{
+   for (size_t index = 0; index < m_FieldPaths.size(); ++index)
+      if (m_FieldPaths[index] == path)
+         fields[index].push_back(value);
+}
+
+//--------------------------------------------------------------------
+// Read the next record, retrieving its location into {span} and its
+// fields into {fields}.  Returns false if error or no more records.
+//--------------------------------------------------------------------
+bool XmlRecordReader::Next(XmlRecordSpan &span, std::vector<std::vector<std::wstring> > &fields)
+{
+   m_ErrorInfo.clear();
+   fields.resize(m_FieldPaths.size());
+   for (auto iter = fields.begin(); iter != fields.end(); ++iter)
+      iter->clear();
+
+   // Path of the element being parsed within the record, and the
+   // length the path had before each of its elements was added.
+   bool inrecord = false;
+   std::wstring path;
+   std::vector<size_t> lengths;
+
+   std::unique_ptr<XmlNodeBase> node;
+   while (m_Xml.NextNode(node))
+   {
+      if (!inrecord)
+      {
+         if (node->m_Type != XmlNodeBase::XmlNodeType_Begin || node->m_Name != m_RecordName)
+            continue;
+
+         inrecord = true;
+         const XmlBeginNode *p = static_cast<XmlBeginNode *>(node.get());
+         span.m_Offset = p->m_Offset;
+         span.m_Length = 0;
+         span.m_Context = 0;
+         for (auto iter = p->m_Attribs.begin(); iter != p->m_Attribs.end(); ++iter)
+            AddField(L"@" + iter->m_Name, iter->m_Value, fields);
+         continue;
+      }
+
+      switch (node->m_Type)
+      {
+         case XmlNodeBase::XmlNodeType_Begin:
+         {
+            lengths.push_back(path.size());
+            if (!path.empty())
+               path += L'/';
+            path += node->m_Name;
+
+            const std::vector<XmlAttribute> &attribs = static_cast<XmlBeginNode *>(node.get())->m_Attribs;
+            for (auto iter = attribs.begin(); iter != attribs.end(); ++iter)
+               AddField(path + L"/@" + iter->m_Name, iter->m_Value, fields);
+            break;
+         }
+
+         case XmlNodeBase::XmlNodeType_Value:
+            if (!path.empty())
+               AddField(path, static_cast<XmlValueNode *>(node.get())->m_Value, fields);
+            break;
+
+         case XmlNodeBase::XmlNodeType_End:
+            if (lengths.empty())
+            {
+               span.m_Length = static_cast<XmlEndNode *>(node.get())->m_Offset - span.m_Offset;
+               return true;
+            }
+            path.resize(lengths.back());
+            lengths.pop_back();
+            break;
+
+         default:
+            break;
+      }
+   }
+
+   m_Xml.ErrorInfo(m_ErrorInfo);
+   if (m_ErrorInfo.empty() && inrecord)
+      m_ErrorInfo = L"Premature end of document inside record.";
+   return false;
+}
+
+//--------------------------------------------------------------------
+// Set which elements are records, which fields group them, and which
+// aggregates to compute.  Returns false if an aggregate isn't
+// recognized.
+//--------------------------------------------------------------------
+bool XmlGroupBy::Configure(const wchar_t *recordname, const std::vector<std::wstring> &keypaths,
+                           const std::vector<std::wstring> &aggregates)
+{
+   m_RecordName = recordname;
+   m_Fields = keypaths;
+   m_NumKeys = keypaths.size();
+   m_Specs.clear();
+   m_Groups.clear();
+   m_ErrorInfo.clear();
+
+   static const struct
+   {
+      const wchar_t *m_Name;
+      Operation m_Operation;
+   } operations[] =
+   {
+      { L"count", Operation_Count },
+      { L"sum",   Operation_Sum },
+      { L"min",   Operation_Min },
+      { L"max",   Operation_Max },
+   };
+
+   for (auto iter = aggregates.begin(); iter != aggregates.end(); ++iter)
+   {
+      size_t colon = iter->find(L':');
+      std::wstring name = iter->substr(0, colon);
+      std::wstring path = (colon == std::wstring::npos) ? std::wstring() : iter->substr(colon + 1);
+
+      size_t index = 0;
+      while (index < sizeof(operations) / sizeof(operations[0]) && name != operations[index].m_Name)
+         ++index;
+      if (index == sizeof(operations) / sizeof(operations[0]) ||
+          (path.empty() && operations[index].m_Operation != Operation_Count))
+      {
+         m_ErrorInfo = L"Unrecognized aggregate:  " + *iter;
+         return false;
+      }
+
+      Spec spec;
+      spec.m_Operation = operations[index].m_Operation;
+      spec.m_Field = noField;
+      if (!path.empty())
+      {
+         spec.m_Field = std::find(m_Fields.begin(), m_Fields.end(), path) - m_Fields.begin();
+         if (spec.m_Field == m_Fields.size())
+            m_Fields.push_back(path);
+      }
+      m_Specs.push_back(spec);
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Add {more} to the running totals in {totals}.
+//--------------------------------------------------------------------
+void XmlGroupBy::AddTotals(Totals &totals, const Totals &more)
+{
+   if (more.m_Numbers != 0)
+   {
+      if (totals.m_Numbers == 0)
+      {
+         totals.m_Min = more.m_Min;
+         totals.m_Max = more.m_Max;
+      }
+      else
+      {
+         totals.m_Min = std::min(totals.m_Min, more.m_Min);
+         totals.m_Max = std::max(totals.m_Max, more.m_Max);
+      }
+   }
+   totals.m_Count += more.m_Count;
+   totals.m_Numbers += more.m_Numbers;
+   totals.m_Sum += more.m_Sum;
+}
+
+//--------------------------------------------------------------------
+// Add one record, whose field values are in {fields}, to its group.
+//--------------------------------------------------------------------
+void XmlGroupBy::AddRecord(const std::vector<std::vector<std::wstring> > &fields)
+{
+   GroupTotals record;
+   std::wstring joined;
+   for (size_t index = 0; index < m_NumKeys; ++index)
+   {
+      record.m_Keys.push_back(fields[index].empty() ? std::wstring() : fields[index][0]);
+
+      // Keys can't contain a null character, so it separates them.
+      joined += record.m_Keys[index];
+      joined += L'\0';
+   }
+
+   const Totals zero = { 0, 0, 0.0, 0.0, 0.0 };
+   record.m_Totals.assign(m_Specs.size(), zero);
+   for (size_t index = 0; index < m_Specs.size(); ++index)
+   {
+      if (m_Specs[index].m_Field == noField)
+      {
+         record.m_Totals[index].m_Count = 1;
+         continue;
+      }
+
+      const std::vector<std::wstring> &values = fields[m_Specs[index].m_Field];
+      for (auto iter = values.begin(); iter != values.end(); ++iter)
+      {
+         Totals more = { 1, 0, 0.0, 0.0, 0.0 };
+         if (XmlParseNumber(*iter, more.m_Sum))
+         {
+            more.m_Numbers = 1;
+            more.m_Min = more.m_Max = more.m_Sum;
+         }
+         AddTotals(record.m_Totals[index], more);
+      }
+   }
+
+   auto iter = m_Groups.find(joined);
+   if (iter == m_Groups.end())
+   {
+      m_Groups[joined] = record;
+      return;
+   }
+   for (size_t index = 0; index < m_Specs.size(); ++index)
+      AddTotals(iter->second.m_Totals[index], record.m_Totals[index]);
+}
+
+//--------------------------------------------------------------------
+// Add the records in the remainder of the document being parsed by
+// {xml} to the groups.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlGroupBy::Aggregate(XmlParser &xml)
+{
+   XmlRecordReader reader(xml, m_RecordName.c_str(), m_Fields);
+   XmlRecordSpan span;
+   std::vector<std::vector<std::wstring> > fields;
+   while (reader.Next(span, fields))
+      AddRecord(fields);
+
+   reader.ErrorInfo(m_ErrorInfo);
+   return m_ErrorInfo.empty();
+}
+
+//--------------------------------------------------------------------
+// Add the groups of {other} to the groups of this object.
+//--------------------------------------------------------------------
+void XmlGroupBy::Merge(const XmlGroupBy &other)
+{
+   for (auto group = other.m_Groups.begin(); group != other.m_Groups.end(); ++group)
+   {
+      auto iter = m_Groups.find(group->first);
+      if (iter == m_Groups.end())
+      {
+         m_Groups.insert(*group);
+         continue;
+      }
+      for (size_t index = 0; index < m_Specs.size(); ++index)
+         AddTotals(iter->second.m_Totals[index], group->second.m_Totals[index]);
+   }
+}
+
+//--------------------------------------------------------------------
+// Retrieve the groups into {groups}, sorted by their keys.
+//--------------------------------------------------------------------
+void XmlGroupBy::Results(std::vector<Group> &groups) const
+{
+   groups.clear();
+   for (auto iter = m_Groups.begin(); iter != m_Groups.end(); ++iter)
+   {
+      Group group;
+      group.m_Keys = iter->second.m_Keys;
+      for (size_t index = 0; index < m_Specs.size(); ++index)
+      {
+         const Totals &totals = iter->second.m_Totals[index];
+         switch (m_Specs[index].m_Operation)
+         {
+            case Operation_Count:
+               group.m_Results.push_back(static_cast<double>(totals.m_Count));
+               break;
+            case Operation_Sum:
+               group.m_Results.push_back(totals.m_Sum);
+               break;
+            case Operation_Min:
+               group.m_Results.push_back(totals.m_Numbers ? totals.m_Min : NAN);
+               break;
+            case Operation_Max:
+               group.m_Results.push_back(totals.m_Numbers ? totals.m_Max : NAN);
+               break;
+         }
+      }
+      groups.push_back(group);
+   }
+
+   std::sort(groups.begin(), groups.end(),
+             [](const Group &a, const Group &b) { return a.m_Keys < b.m_Keys; });
+}
+
+// Number of temporary files used when a hash join spills to disk.
+const size_t numJoinPartitions = 64;
+
+//--------------------------------------------------------------------
+// Returns which partition file the records with {key} belong in.
+// The table's own hash function is not used, so that the keys of one
+// partition still spread across all of the table's buckets.
+//--------------------------------------------------------------------
+static size_t JoinPartition(const std::wstring &key)
+{
+   uint64_t hash = 14695981039346656037ULL;
+   HashText(hash, key.c_str(), key.size());
+   return static_cast<size_t>(hash >> 32) % numJoinPartitions;
+}
+
+//--------------------------------------------------------------------
+// Construction, allowing about {maxbytes} bytes for the table.
+//--------------------------------------------------------------------
+XmlHashJoin::XmlHashJoin(size_t maxbytes) :
+   m_MaxBytes(maxbytes), m_Bytes(0)
 {
-   NextChar();    // Eat the '/'
-
-   if (!NextToken(xmlDelimsWithEquals))
-   {
-      m_ErrorInfo = L"Unexpected end of input.";
-      return false;
-   }
-   std::wstring token = CurToken();
+}
 
-   if (CurChar() != '>')
-   {
-      m_ErrorInfo = L"Expected '>' at end of tag:  ";
-      m_ErrorInfo += CurToken();
-      return false;
-   }
-   NextChar();    // Eat the '>'
+//--------------------------------------------------------------------
+// Destruction.  Closes and removes any temporary files.
+//--------------------------------------------------------------------
+XmlHashJoin::~XmlHashJoin()
+{
+   for (auto partp = m_BuildParts.begin(); partp != m_BuildParts.end(); ++partp)
+      fclose(*partp);
+}
 
-   if (m_Stack.empty())
-   {
-      m_ErrorInfo = L"Unexpected end tag outside of all tags:  ";
-      m_ErrorInfo += token;
-      return false;
-   }
+//--------------------------------------------------------------------
+// Write {key} and {span} to temporary file {fp}.
+// Returns true if successful.
+//--------------------------------------------------------------------
+bool XmlHashJoin::WriteEntry(FILE *fp, const std::wstring &key, const XmlRecordSpan &span)
+{
+   size_t keylen = key.size();
+   return fwrite(&keylen, sizeof(keylen), 1, fp) == 1 &&
+          (keylen == 0 || fwrite(key.data(), sizeof(wchar_t), keylen, fp) == keylen) &&
+          fwrite(&span, sizeof(span), 1, fp) == 1;
+}
 
-   XmlElementBase & celm = m_Stack[m_Stack.size() - 1];
-   if (wcscmp(token.c_str(), celm.m_Begin.m_Name.c_str()) != 0)
-   {
-      m_ErrorInfo = L"Mismatched end tag, found '";
-      m_ErrorInfo += token;
-      m_ErrorInfo += L"', expected '";
-      m_ErrorInfo += celm.m_Begin.m_Name;
-      m_ErrorInfo += L"'";
+//--------------------------------------------------------------------
+// Read the next key and span from temporary file {fp} into {key} and
+// {span}.  Returns false if error or no more entries.
+//--------------------------------------------------------------------
+bool XmlHashJoin::ReadEntry(FILE *fp, std::wstring &key, XmlRecordSpan &span)
+{
+   size_t keylen = 0;
+   if (fread(&keylen, sizeof(keylen), 1, fp) != 1)
       return false;
-   }
-   celm.m_End.m_Name = celm.m_Begin.m_Name;
-   ptrref.reset(celm.m_End.Clone());
-   m_Stack.erase(m_Stack.begin() + m_Stack.size() - 1);
-   return true;
+   key.resize(keylen);
+   return (keylen == 0 || fread(&key[0], sizeof(wchar_t), keylen, fp) == keylen) &&
+          fread(&span, sizeof(span), 1, fp) == 1;
 }
 
 //--------------------------------------------------------------------
-// Skips the remainder of a comment, up to and including the "-->" at
-// the end of the comment.  Assumes the "<!--" at the beginning of the
-// comment has already been processed.
+// Add the record at {span} with {key} to the table.
 //--------------------------------------------------------------------
-bool XmlParser::EatComment(void)
+void XmlHashJoin::AddToTable(const std::wstring &key, const XmlRecordSpan &span)
 {
-   bool done = false;
+   std::vector<XmlRecordSpan> &spans = m_Table[key];
+   if (spans.empty())
+      m_Bytes += sizeof(Table::value_type) + key.size() * sizeof(wchar_t) + 2 * sizeof(void *);
+   spans.push_back(span);
+   m_Bytes += sizeof(XmlRecordSpan);
+}
 
-   while (!done)
+//--------------------------------------------------------------------
+// Move the contents of the table into the partition files, creating
+// them.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlHashJoin::Spill(void)
+{
+   for (size_t part = 0; part < numJoinPartitions; ++part)
    {
-      if (CurChar() == '-')
+      FILE *fp = tmpfile();
+      if (fp == nullptr)
       {
-         NextChar();
-         if (CurChar() == '-')
-         {
-            NextChar();
-            if (CurChar() == '>')
-            {
-               // Found end of comment.
-               done = true;
-               if (!NextChar()) // Eat the '>'
-               {
-                  m_ErrorInfo = L"Unexpected end of input.";
-                  return false;
-               }
-            }
-         }
+         m_ErrorInfo = L"Failed creating temporary file.";
+         return false;
       }
-      else
+      m_BuildParts.push_back(fp);
+   }
+
+   for (auto iter = m_Table.begin(); iter != m_Table.end(); ++iter)
+   {
+      FILE *fp = m_BuildParts[JoinPartition(iter->first)];
+      for (auto spanp = iter->second.begin(); spanp != iter->second.end(); ++spanp)
       {
-         // Still inside the comment.
-         if (!NextChar())
+         if (!WriteEntry(fp, iter->first, *spanp))
          {
-            m_ErrorInfo = L"Unexpected end of input.";
+            m_ErrorInfo = L"Failed writing temporary file.";
             return false;
          }
       }
    }
-
+   m_Table.clear();
+   m_Bytes = 0;
    return true;
 }
 
 //--------------------------------------------------------------------
-// Skips the remainder of a marked section, up to and including the
-// "]>" at the end of the section.  Assumes the "<![" at the beginning
-// of the section has already been processed.
+// Read the build side's records into the table, spilling it to the
+// partition files if it grows too big.  Returns false if error.
 //--------------------------------------------------------------------
-bool XmlParser::EatMarkedSection(void)
+bool XmlHashJoin::Build(XmlParser &xml, const wchar_t *recordname, const wchar_t *keypath)
 {
-   bool done = false;
+   m_ErrorInfo.clear();
 
-   while (!done)
+   XmlRecordReader reader(xml, recordname, std::vector<std::wstring>(1, keypath));
+   XmlRecordSpan span;
+   std::vector<std::vector<std::wstring> > fields;
+   while (reader.Next(span, fields))
    {
-      if (CurChar() == ']')
-      {
-         NextChar();
-         if (CurChar() == ']')
-         {
-            NextChar();
-            if (CurChar() == '>')
-            {
-               // Found end of section.
-               done = true;
-               if (!NextChar()) // Eat the '>'
-               {
-                  m_ErrorInfo = L"Unexpected end of input.";
-                  return false;
-               }
-            }
-         }
-      }
-      else
+      if (fields[0].empty())
+         continue;
+      const std::wstring &key = fields[0][0];
+
+      if (!m_BuildParts.empty())
       {
-         // Still inside the marked section.
-         if (!NextChar())
+         if (!WriteEntry(m_BuildParts[JoinPartition(key)], key, span))
          {
-            m_ErrorInfo = L"Unexpected end of input.";
+            m_ErrorInfo = L"Failed writing temporary file.";
             return false;
          }
+         continue;
       }
+
+      AddToTable(key, span);
+      if (m_Bytes > m_MaxBytes && !Spill())
+         return false;
    }
 
+   reader.ErrorInfo(m_ErrorInfo);
+   return m_ErrorInfo.empty();
+}
+
+//--------------------------------------------------------------------
+// Pass the probe record at {probe} with {key} to {handler} together
+// with each build record in the table that has the same key.
+// Returns false if {handler} stopped the join.
+//--------------------------------------------------------------------
+bool XmlHashJoin::MatchKey(const std::wstring &key, const XmlRecordSpan &probe, XmlJoinHandler &handler)
+{
+   auto iter = m_Table.find(key);
+   if (iter == m_Table.end())
+      return true;
+   for (auto spanp = iter->second.begin(); spanp != iter->second.end(); ++spanp)
+   {
+      if (!handler.Match(key, *spanp, probe))
+      {
+         m_ErrorInfo = L"Join stopped by handler.";
+         return false;
+      }
+   }
    return true;
 }
 
 //--------------------------------------------------------------------
-// Parses a tag that starts with "<!" from the XML document.
-// Caller is assumed to have already read the "<!" at the
-// beginning of the tag, leaving the "!" in CurChar().
-//
-// If the tag is a comment, such as "<!--comment-->" the,
-// comment is skipped and the next node after the comment is
-// parsed and returned in {ptrref}.
-//
-// If the tag is a marked section, such as "<![CDATA[...]]>",
-// it is skipped and the next node after the marked section
-// is parsed and returned in {ptrref}.
-//
-// Returns false if error.
+// Read the probe side's records, passing those that match records in
+// the table to {handler}.  Returns false if error or if {handler}
+// stopped the join.
 //--------------------------------------------------------------------
-bool XmlParser::ParseBangTag(std::unique_ptr<XmlNodeBase> &ptrref)
+bool XmlHashJoin::Probe(XmlParser &xml, const wchar_t *recordname, const wchar_t *keypath, XmlJoinHandler &handler)
 {
-   NextChar();       // Eat the '!'
-   wchar_t c1 = CurChar();
-   NextChar();       // Eat the '-' or '['
+   m_ErrorInfo.clear();
 
-   if (c1 == '[')
+   // Partition files for the probe side, if the build side spilled.
+   // They are closed automatically however this function returns.
+   std::vector<std::unique_ptr<FILE, int (*)(FILE *)> > probeparts;
+   for (size_t part = 0; part < m_BuildParts.size(); ++part)
    {
-      EatMarkedSection();
-
-      // Recursively parse the next node.
-      return NextNode(ptrref);
+      probeparts.push_back(std::unique_ptr<FILE, int (*)(FILE *)>(tmpfile(), fclose));
+      if (!probeparts[part])
+      {
+         m_ErrorInfo = L"Failed creating temporary file.";
+         return false;
+      }
    }
-   else if (c1 == '-' && CurChar() == '-')
+
+   XmlRecordReader reader(xml, recordname, std::vector<std::wstring>(1, keypath));
+   XmlRecordSpan span;
+   std::vector<std::vector<std::wstring> > fields;
+   while (reader.Next(span, fields))
    {
-      NextChar();    // Eat the '-'
-      EatComment();
+      if (fields[0].empty())
+         continue;
+      const std::wstring &key = fields[0][0];
 
-      // Recursively parse the next node.
-      return NextNode(ptrref);
+      if (probeparts.empty())
+      {
+         if (!MatchKey(key, span, handler))
+            return false;
+      }
+      else if (!WriteEntry(probeparts[JoinPartition(key)].get(), key, span))
+      {
+         m_ErrorInfo = L"Failed writing temporary file.";
+         return false;
+      }
    }
-   else
-   {
-      m_ErrorInfo = L"Malformed tag beginning with '!'";
+   reader.ErrorInfo(m_ErrorInfo);
+   if (!m_ErrorInfo.empty())
       return false;
+
+   // Join each pair of partitions in turn.
+   std::wstring key;
+   for (size_t part = 0; part < probeparts.size(); ++part)
+   {
+      m_Table.clear();
+      rewind(m_BuildParts[part]);
+      while (ReadEntry(m_BuildParts[part], key, span))
+         m_Table[key].push_back(span);
+
+      rewind(probeparts[part].get());
+      while (ReadEntry(probeparts[part].get(), key, span))
+         if (!MatchKey(key, span, handler))
+            return false;
    }
+   m_Table.clear();
+   return true;
 }
 
 //--------------------------------------------------------------------
-// Parses a begin tag from the XML document.  Caller is assumed
-// to have already read the "<" at the beginning of the tag,
-// leaving CurChar() at the next character after the "<".
-// Caller is also assumed to have already handled any possible
-// end tag, comment tag, etc., that could have been initiated
-// by the "<".
-//
-// This handles begin tags of the form:
-//    <name [attrib1[=value1] [attrib2[=value2] ...]] [/]>
-//    <?name [attrib1[=value1] [attrib2[=value2] ...]] ?>
-//
-// Note that due to some malformed XML files, the following form
-// may also be encountered in the real world.  Note the slash
-// at the end that should not be there.
-//    <?name [attrib1[=value1] [attrib2[=value2] ...]] ?/>
-//
-// If successful, the a new tag will be added to the stack,
-// and a pointer to the begin node will be returned in {ptrref}.
-//
-// Returns false if error.
+// Returns true if {text} equals {value}, ignoring any whitespace that
+// surrounds {text}.
 //--------------------------------------------------------------------
-bool XmlParser::ParseBeginTagNode(std::unique_ptr<XmlNodeBase> &ptrref)
+static bool TrimmedEquals(const std::wstring &text, const std::wstring &value)
 {
-#ifdef _DUMP
-   wprintf(L"ParseBeginTagNode  m_DataPos=%Iu\n", m_DataPos);
-#endif
+   size_t start = 0;
+   size_t end = text.size();
+   while (start < end && iswspace(text[start]))
+      ++start;
+   while (end > start && iswspace(text[end - 1]))
+      --end;
+   return end - start == value.size() && text.compare(start, end - start, value) == 0;
+}
 
-   size_t tagoffset = m_DataPos - 2;
+//--------------------------------------------------------------------
+// Add a rule that sends messages whose root element is named
+// {rootname} and that meet all of {conditions} to {route}.
+//--------------------------------------------------------------------
+void XmlRouter::AddRule(const std::wstring &route, const std::wstring &rootname,
+                        const std::vector<XmlRouteCondition> &conditions)
+{
+   Rule rule;
+   rule.m_Route = route;
+   rule.m_RootName = rootname;
+   rule.m_NumConditions = conditions.size();
+   m_Rules.push_back(rule);
 
-   // First check for '?' immediately after the '<'.
-   bool bQuestionMarked = false;
-   if (CurChar() == '?')
+   for (auto iter = conditions.begin(); iter != conditions.end(); ++iter)
    {
-      bQuestionMarked = true;
-      NextChar();
+      Test test;
+      test.m_Rule = m_Rules.size() - 1;
+      test.m_Value = iter->m_Value;
+      m_Tests[iter->m_Path].push_back(test);
    }
+}
 
-   // Get the tag's name.
-   if (!NextToken(xmlDelimsWithSlash))
+//--------------------------------------------------------------------
+// Check the field at {path} with {value} against the conditions that
+// name it, updating the rules' {states} and the number of conditions
+// each rule has {remaining}, unless the field was {seen} already.
+//--------------------------------------------------------------------
+void XmlRouter::ApplyField(const std::wstring &path, const std::wstring &value, std::vector<RuleState> &states,
+                           std::vector<size_t> &remaining, std::vector<std::wstring> &seen) const
+{
+   auto tests = m_Tests.find(path);
+   if (tests == m_Tests.end() || std::find(seen.begin(), seen.end(), path) != seen.end())
+      return;
+   seen.push_back(path);
+
+   for (auto test = tests->second.begin(); test != tests->second.end(); ++test)
    {
-      m_ErrorInfo = L"Unexpected end of input.";
-      return false;
+      if (states[test->m_Rule] != RuleState_Undecided)
+         continue;
+      if (!TrimmedEquals(value, test->m_Value))
+         states[test->m_Rule] = RuleState_Failed;
+      else if (--remaining[test->m_Rule] == 0)
+         states[test->m_Rule] = RuleState_Matched;
    }
-   std::wstring token = CurToken();
-
-   XmlElementBase elm;
-   elm.m_Begin.m_Name = token;
-   elm.m_Begin.m_Offset = tagoffset;
+}
 
-   // Now parse the tag's attributes, if any.
-   while (CurChar() != '/' && CurChar() != '>' && CurChar() != '?')
+//--------------------------------------------------------------------
+// If the route is certain given the rules' {states}, retrieve it into
+// {route} and return true.
+//--------------------------------------------------------------------
+bool XmlRouter::Decide(const std::vector<RuleState> &states, std::wstring &route) const
+{
+   for (size_t rule = 0; rule < states.size(); ++rule)
    {
-      NextToken(xmlDelimsWithEquals);
-      std::wstring attribname = CurToken();
-
-      XmlAttribute att;
-      att.m_Name = attribname;
-
-      if (CurChar() == '=')
+      if (states[rule] == RuleState_Undecided)
+         return false;
+      if (states[rule] == RuleState_Matched)
       {
-         NextChar();
-         NextToken(xmlDelimsWithEquals);
-         att.m_Value = CurToken();
+         route = m_Rules[rule].m_Route;
+         return true;
       }
-
-      elm.m_Begin.m_Attribs.push_back(att);
    }
+   route = m_DefaultRoute;
+   return true;
+}
 
-   // If there was a starting question mark, check for the ending
-   // question mark.
-   if (bQuestionMarked)
+//--------------------------------------------------------------------
+// Parse just enough of the document being parsed by {xml} to choose
+// its route, retrieving the route into {route}.
+// Returns false if error before the route could be chosen.
+//--------------------------------------------------------------------
+bool XmlRouter::Route(XmlParser &xml, std::wstring &route) const
+{
+   std::vector<RuleState> states(m_Rules.size(), RuleState_Undecided);
+   std::vector<size_t> remaining(m_Rules.size());
+   for (size_t rule = 0; rule < m_Rules.size(); ++rule)
+      remaining[rule] = m_Rules[rule].m_NumConditions;
+   std::vector<std::wstring> seen;
+
+   // Path of the element being parsed within the root element, and
+   // the length the path had before each of its elements was added.
+   bool inroot = false;
+   std::wstring path;
+   std::vector<size_t> lengths;
+
+   std::unique_ptr<XmlNodeBase> node;
+   while (xml.NextNode(node))
    {
-      if (CurChar() != '?')
+      if (!inroot)
       {
-         // Expected trailing question mark.
-         m_ErrorInfo = L"Expected '?' at end of tag.";
-         return false;
+         // Skip everything before the root element, including the
+         // "<?xml ... ?>" declaration and other processing instructions.
+         if (node->m_Type != XmlNodeBase::XmlNodeType_Begin || static_cast<XmlBeginNode *>(node.get())->m_Instruction)
+            continue;
+
+         inroot = true;
+         for (size_t rule = 0; rule < m_Rules.size(); ++rule)
+         {
+            if (!m_Rules[rule].m_RootName.empty() && m_Rules[rule].m_RootName != node->m_Name)
+               states[rule] = RuleState_Failed;
+            else if (remaining[rule] == 0)
+               states[rule] = RuleState_Matched;
+         }
+
+         const std::vector<XmlAttribute> &attribs = static_cast<XmlBeginNode *>(node.get())->m_Attribs;
+         for (auto iter = attribs.begin(); iter != attribs.end(); ++iter)
+            ApplyField(L"@" + iter->m_Name, iter->m_Value, states, remaining, seen);
       }
+      else
+      {
+         switch (node->m_Type)
+         {
+            case XmlNodeBase::XmlNodeType_Begin:
+            {
+               lengths.push_back(path.size());
+               if (!path.empty())
+                  path += L'/';
+               path += node->m_Name;
 
-      // Question marked tag is always empty (has no value portion and no separate end tag).
-      m_PriorWasEmptyTag = true;
-      NextChar();
-      elm.m_End.m_Name = elm.m_Begin.m_Name;
-   }
+               const std::vector<XmlAttribute> &attribs = static_cast<XmlBeginNode *>(node.get())->m_Attribs;
+               for (auto iter = attribs.begin(); iter != attribs.end(); ++iter)
+                  ApplyField(path + L"/@" + iter->m_Name, iter->m_Value, states, remaining, seen);
+               break;
+            }
 
-   // Check if the tag ends with a slash, which indicates that there
-   // will not be a separate ending tag for this tag.
-   if (CurChar() == '/')
-   {
-      // Tag is empty (has no value portion and no separate end tag).
-      m_PriorWasEmptyTag = true;
-      NextChar();
-      elm.m_End.m_Name = elm.m_Begin.m_Name;
-   }
+            case XmlNodeBase::XmlNodeType_Value:
+               if (!path.empty())
+                  ApplyField(path, static_cast<XmlValueNode *>(node.get())->m_Value, states, remaining, seen);
+               break;
 
-   // Lastly, check for the trailing marker.
-   if (CurChar() != '>')
-   {
-      m_ErrorInfo = L"Expected '>' at end of tag.";
-      return false;
+            case XmlNodeBase::XmlNodeType_End:
+               if (lengths.empty())
+               {
+                  // The root element ended, so any field not seen yet
+                  // never will be.
+                  for (size_t rule = 0; rule < m_Rules.size(); ++rule)
+                     if (states[rule] == RuleState_Undecided)
+                        states[rule] = RuleState_Failed;
+               }
+               else
+               {
+                  path.resize(lengths.back());
+                  lengths.pop_back();
+               }
+               break;
+
+            default:
+               break;
+         }
+      }
+
+      if (Decide(states, route))
+         return true;
    }
-   NextChar(); // Eat the trailing '>'
 
-   ptrref.reset(elm.m_Begin.Clone());
-   m_Stack.push_back(elm);
+   std::wstring errorinfo;
+   xml.ErrorInfo(errorinfo);
+   if (!errorinfo.empty())
+      return false;
+
+   // No root element at all.
+   route = m_DefaultRoute;
    return true;
 }
 
 //--------------------------------------------------------------------
-// Parse the next XmlNode from the XML document.
-// Returns false if parsing error or no more nodes in document.
+// Route each of {messages} on {numthreads} threads, storing each
+// message's route in {routes}.  {errorroute} is the route of any
+// message that couldn't be parsed far enough.
 //--------------------------------------------------------------------
-bool XmlParser::NextNode(std::unique_ptr<XmlNodeBase> &ptrref)
+void XmlRouter::RouteAll(const std::vector<std::vector<char> > &messages, size_t numthreads,
+                         const std::wstring &errorroute, std::vector<std::wstring> &routes) const
 {
-   ptrref.reset(nullptr);
-
-   // If prior begin tag was actually an empty tag (begin and end in one tag),
-   // we now have to generate the end tag node for it.
-   if (m_PriorWasEmptyTag && !m_Stack.empty())
-   {
-      m_PriorWasEmptyTag = false;
-      ptrref.reset(m_Stack[m_Stack.size() - 1].m_End.Clone());
-      m_Stack.erase(m_Stack.begin() + m_Stack.size() - 1);
-      return true;
-   }
-
-   // Accumulate any leading whitespace.
-   //
-   std::wstring token;
-   while (iswspace(CurChar()))
-   {
-      token += CurChar();
-      NextChar();
-   }
+   routes.assign(messages.size(), std::wstring());
 
-   // Determine if we're parsing a tag or value.
-   //
-   if (CurChar() == '<')
+   // Each worker takes the next message not yet taken.
+   std::atomic<size_t> next(0);
+   auto worker = [&]()
    {
-      // We're parsing a tag.
-      // It should be in one of the following formats:
-      //
-      //    <name [attrib1[=value1] [attrib2[=value2] ...]] [/]>
-      //    <?name [attrib1[=value1] [attrib2[=value2] ...]] ?>
-      //    </name>
-      //    <!-- comment -->
-      //
-      // Anything else is assumed to be the value text that comes between
-      // a begin tag and an end tag.
-
-      NextChar();
-      if (CurChar() == '/')
-      {
-         // Parse end tag.
-         return ParseEndTagNode(ptrref);
-      }
-
-      // Check for possible comment tag.
-      if (CurChar() == '!')
+      XmlParser xml;
+      for (size_t index = next++; index < messages.size(); index = next++)
       {
-         // Note that this actually parses the comment and the
-         // node that comes after the comment.
-         //
-         return ParseBangTag(ptrref);
+         if (messages[index].empty() || !xml.BeginParsingFromMemory(messages[index].data(), messages[index].size()) ||
+             !Route(xml, routes[index]))
+            routes[index] = errorroute;
       }
+   };
 
-      // Must be a begin tag.
-      //
-      return ParseBeginTagNode(ptrref);
-   }
-   else
-   {
-      // This must be the value portion a.k.a. the content between
-      // a start tag and end tag.
-      //
-      return ParseTagValueNode(token, ptrref);
-   }
+   std::vector<std::thread> threads;
+   for (size_t count = 1; count < numthreads; ++count)
+      threads.push_back(std::thread(worker));
+   worker();
+   for (auto threadp = threads.begin(); threadp != threads.end(); ++threadp)
+      threadp->join();
 }
 
 //--------------------------------------------------------------------
-// Retrieve a description of the most recent error into {errorinfo}.
-// If no error, {errorinfo} will be empty string.
+// Construct, starting {numthreads} worker threads.  Jobs are checked
+// for cancellation and time limits every {checkbytes} bytes.
 //--------------------------------------------------------------------
-void XmlParser::ErrorInfo(std::wstring &errorinfo)
-{
-   errorinfo = m_ErrorInfo;
-}
-
-// Discard all allocated memory and close all files.
-//
-void XmlParser::Reset(void)
+XmlParsePool::XmlParsePool(size_t numthreads, size_t checkbytes) :
+   m_CheckBytes(checkbytes), m_Stopping(false)
 {
-   m_Stack.clear();
-   m_PriorWasEmptyTag = false;
-   m_PriorName = L"";
-
-   XmlFileInputInterface *p = dynamic_cast<XmlFileInputInterface *>(m_Reader.get());
-   if (p != nullptr)
-      p->ForceClose();
-   m_Reader.reset();
-
-   m_DataSize = m_DataPos = 0;
+   for (size_t count = 0; count < std::max(numthreads, (size_t)1); ++count)
+      m_Threads.push_back(std::thread(&XmlParsePool::Work, this));
 }
 
 //--------------------------------------------------------------------
-// Returns true if the end of the XML document has been reached.
+// Destruct, cancelling the jobs still in the queue and waiting for
+// the workers to finish.
 //--------------------------------------------------------------------
-bool XmlParser::EndOfDocument(void)
+XmlParsePool::~XmlParsePool()
 {
-   if (!m_Reader)
-      return true;
-   return m_Reader->EndOfFile();
+   {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Stopping = true;
+      for (auto taskp = m_Queue.begin(); taskp != m_Queue.end(); ++taskp)
+         taskp->m_Job->m_Cancel = true;
+   }
+   m_Wakeup.notify_all();
+   for (auto threadp = m_Threads.begin(); threadp != m_Threads.end(); ++threadp)
+      threadp->join();
 }
 
 //--------------------------------------------------------------------
-// Retrieves the current character position in the XML document.
+// Submit the document in memory at {data}, {numbytes} in size, to be
+// parsed with its nodes passed to {handler} within {timeoutms}
+// milliseconds.
 //--------------------------------------------------------------------
-size_t XmlParser::CurPosition(void)
+std::shared_ptr<XmlParseJob> XmlParsePool::ParseMemory(const void *data, size_t numbytes, XmlParseHandler &handler,
+                                                       unsigned timeoutms)
 {
-   return m_DataPos;
+   Task task;
+   task.m_Data = data;
+   task.m_NumBytes = numbytes;
+   return Submit(task, handler, timeoutms);
 }
 
 //--------------------------------------------------------------------
-// Retrieve the current character from the XML document.
-// Returns zero if no character available.
+// Submit the document in file {filename} to be parsed with its nodes
+// passed to {handler} within {timeoutms} milliseconds.
 //--------------------------------------------------------------------
-wchar_t XmlParser::CurChar(void)
+std::shared_ptr<XmlParseJob> XmlParsePool::ParseFile(const wchar_t *filename, XmlParseHandler &handler,
+                                                     unsigned timeoutms)
 {
-   return m_CurChar;
+   Task task;
+   task.m_Data = nullptr;
+   task.m_NumBytes = 0;
+   task.m_Filename = filename;
+   return Submit(task, handler, timeoutms);
 }
 
 //--------------------------------------------------------------------
-// Advance to next character in XML document.
-// Returns false if no more characters available.
+// Finish filling in {task} and add it to the queue.  Returns the job
+// for the caller to wait on or cancel.
 //--------------------------------------------------------------------
-bool XmlParser::NextChar(void)
+std::shared_ptr<XmlParseJob> XmlParsePool::Submit(Task &task, XmlParseHandler &handler, unsigned timeoutms)
 {
-   m_CurChar = 0;
-   if (!m_Reader)
-      return false;
+   std::shared_ptr<XmlParseJob> job = std::make_shared<XmlParseJob>();
+   job->m_Result = task.m_Promise.get_future().share();
+   task.m_Job = job;
+   task.m_Handler = &handler;
+   task.m_Deadline = std::chrono::steady_clock::time_point::max();
+   if (timeoutms != 0)
+      task.m_Deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutms);
 
-   wchar_t c;
-   if (!m_Reader->ReadChar(c))
    {
-      return false;
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Queue.push_back(std::move(task));
    }
-   m_CurChar = c;
-   m_DataPos++;
-   return true;
+   m_Wakeup.notify_one();
+   return job;
 }
 
 //--------------------------------------------------------------------
-// Retrieve a reference to the current token from the XML document.
+// Body of each worker thread.  Takes jobs from the queue until the
+// pool is destroyed and the queue is empty.
 //--------------------------------------------------------------------
-const std::wstring & XmlParser::CurToken(void)
+void XmlParsePool::Work(void)
 {
-   return m_CurToken;
+   XmlParser xml;
+   for (;;)
+   {
+      Task task;
+      {
+         std::unique_lock<std::mutex> lock(m_Mutex);
+         m_Wakeup.wait(lock, [this]() { return m_Stopping || !m_Queue.empty(); });
+         if (m_Queue.empty())
+            return;
+         task = std::move(m_Queue.front());
+         m_Queue.pop_front();
+      }
+
+      XmlParseResult result;
+      result.m_Success = false;
+      result.m_NumNodes = 0;
+      try
+      {
+         Run(xml, task, result);
+      }
+      catch (...)
+      {
+         result.m_Success = false;
+         result.m_ErrorInfo = L"Exception while parsing.";
+      }
+
+      // Don't leave the parser pointing at the job's cancel flag, nor
+      // holding the job's file open.
+      xml.SetLimits(nullptr, std::chrono::steady_clock::time_point::max(), m_CheckBytes);
+      xml.Reset();
+      task.m_Promise.set_value(result);
+   }
 }
 
 //--------------------------------------------------------------------
-// Extract next token from XML document, where token is delimited
-// by double quotes or by any of the delimiters given in {delims}.
-// Returns false if no more tokens.
+// Parse the document of {task} with {xml}, filling in {result}.
 //--------------------------------------------------------------------
-bool XmlParser::NextToken(const wchar_t *delims)
+void XmlParsePool::Run(XmlParser &xml, Task &task, XmlParseResult &result)
 {
-   m_CurToken = L"";
-
-   // Eat any leading whitespace.
-   while (iswspace(CurChar()))
-      NextChar();
-
-   // How we scan the token depends on if it's quoted or not.
-   if (CurChar() == '"')
+   // A job cancelled or out of time before its turn isn't started.
+   if (task.m_Job->m_Cancel)
    {
-      // Accumulate the quoted token.
-      NextChar();
-      while (CurChar() != 0 && CurChar() != '"')
-      {
-         m_CurToken += CurChar();
-         NextChar();
-      }
-      if (CurChar() == '"')
-         NextChar();
+      result.m_ErrorInfo = L"Parsing was cancelled.";
+      return;
    }
-   else if (CurChar() == '\'')
+   if (std::chrono::steady_clock::now() >= task.m_Deadline)
    {
-      // Accumulate the single-quoted token.
-      NextChar();
-      while (CurChar() != 0 && CurChar() != '\'')
-      {
-         m_CurToken += CurChar();
-         NextChar();
-      }
-      if (CurChar() == '\'')
-         NextChar();
+      result.m_ErrorInfo = L"Parsing ran past its deadline.";
+      return;
    }
+
+   xml.SetLimits(&task.m_Job->m_Cancel, task.m_Deadline, m_CheckBytes);
+
+   bool ok;
+   if (task.m_Data != nullptr)
+      ok = xml.BeginParsingFromMemory(task.m_Data, task.m_NumBytes);
    else
+      ok = xml.BeginParsingFromFile(task.m_Filename.c_str());
+   if (!ok)
    {
-      // Accumulate the non-quoted token until a delimiter is hit.
-      while (CurChar() != '\0' &&
-             !wcschr((delims == nullptr ? L"" : delims), CurChar()))
+      xml.ErrorInfo(result.m_ErrorInfo);
+      return;
+   }
+
+   std::unique_ptr<XmlNodeBase> node;
+   while (xml.NextNode(node))
+   {
+      result.m_NumNodes++;
+      if (!task.m_Handler->Node(*node))
       {
-         m_CurToken += CurChar();
-         NextChar();
+         result.m_ErrorInfo = L"Parsing was stopped by the handler.";
+         return;
       }
    }
+   xml.ErrorInfo(result.m_ErrorInfo);
+   result.m_Success = result.m_ErrorInfo.empty();
+}
 
-   // Eat any trailing whitespace.
-   while (iswspace(CurChar()))
-      NextChar();
+//--------------------------------------------------------------------
+// Convert the text of a bound field to the type of {value}.
+// Returns false if {text} can't be converted.
+//--------------------------------------------------------------------
+bool XmlConvertValue(const std::wstring &text, std::wstring &value)
+{
+   value = text;
+   return true;
+}
 
-#ifdef _DUMP
-   wprintf(L"token \"%s\"\n", m_CurToken.c_str());
-   fflush(stdout);
-#endif
+bool XmlConvertValue(const std::wstring &text, double &value)
+{
+   return XmlParseNumber(text, value);
+}
 
-   if (m_CurToken.empty() && EndOfDocument())
+bool XmlConvertValue(const std::wstring &text, float &value)
+{
+   double number = 0;
+   if (!XmlParseNumber(text, number))
+      return false;
+   value = static_cast<float>(number);
+   return true;
+}
+
+bool XmlConvertValue(const std::wstring &text, long long &value)
+{
+   const wchar_t *start = text.c_str();
+   wchar_t *end = nullptr;
+   errno = 0;
+   value = wcstoll(start, &end, 10);
+   if (end == start || errno == ERANGE)
+      return false;
+   while (*end != 0 && iswspace(*end))
+      ++end;
+   return *end == 0;
+}
+
+bool XmlConvertValue(const std::wstring &text, int &value)
+{
+   long long number = 0;
+   if (!XmlConvertValue(text, number) || number < INT_MIN || number > INT_MAX)
+      return false;
+   value = static_cast<int>(number);
+   return true;
+}
+
+bool XmlConvertValue(const std::wstring &text, unsigned &value)
+{
+   long long number = 0;
+   if (!XmlConvertValue(text, number) || number < 0 || number > UINT_MAX)
       return false;
+   value = static_cast<unsigned>(number);
+   return true;
+}
 
+bool XmlConvertValue(const std::wstring &text, bool &value)
+{
+   if (TrimmedEquals(text, L"true") || TrimmedEquals(text, L"1"))
+      value = true;
+   else if (TrimmedEquals(text, L"false") || TrimmedEquals(text, L"0"))
+      value = false;
+   else
+      return false;
    return true;
 }
 
 //--------------------------------------------------------------------
-// Dump contents of this tree to caller-provided string {text},
-// for human viewing.
+// Mix the characters of {text} into the FNV-1a hash {hash} the same
+// way XmlNameHash does, so that a path's hash can be built up one
+// element at a time.
 //--------------------------------------------------------------------
-void XmlElementTree::dump(std::wstring &text, size_t indent)
+static uint64_t ExtendNameHash(uint64_t hash, const wchar_t *text)
 {
-   if (m_Begin.m_Type == XmlNodeBase::XmlNodeType_Begin)
+   for ( ; *text != 0; ++text)
+      hash = (hash ^ static_cast<uint64_t>(*text)) * 1099511628211ULL;
+   return hash;
+}
+
+//--------------------------------------------------------------------
+// Construction for filling records named {recordname} from the
+// document being parsed by {xml}.  {hashes} and {paths} give the hash
+// and path of each field.  Builds the perfect hash table that finds
+// each field from its hash:  the smallest power-of-two table, and the
+// shift of the hash bits that index it, in which no two fields land
+// in the same slot.
+//--------------------------------------------------------------------
+XmlBinderBase::XmlBinderBase(XmlParser &xml, const wchar_t *recordname, const std::vector<uint64_t> &hashes,
+                             const std::vector<const wchar_t *> &paths) :
+   m_Xml(xml), m_RecordHash(XmlNameHash(recordname)), m_Hashes(hashes), m_Paths(paths),
+   m_SlotMask(0), m_SlotShift(0)
+{
+   const size_t empty = m_Hashes.size();
+   unsigned bits = 0;
+   while ((static_cast<size_t>(1) << bits) < m_Hashes.size() * 2)
+      ++bits;
+
+   for ( ; ; ++bits)
    {
-      AddSpaces(text, indent);
-      text += L"Begin:  ";
-      text += m_Begin.m_Name;
-      text += L"\n";
-      for (auto attribp = m_Begin.m_Attribs.begin(); attribp != m_Begin.m_Attribs.end(); ++attribp)
+      m_SlotMask = (static_cast<uint64_t>(1) << bits) - 1;
+      for (m_SlotShift = 0; m_SlotShift + bits <= 64; ++m_SlotShift)
       {
-         text += L"  Attrib:  ";
-         text += attribp->m_Name;
-         text += L"=";
-         text += attribp->m_Value;
-         text += L"\n";
+         m_Slots.assign(static_cast<size_t>(m_SlotMask) + 1, empty);
+         bool collided = false;
+         for (size_t field = 0; field < m_Hashes.size() && !collided; ++field)
+         {
+            size_t &slot = m_Slots[static_cast<size_t>((m_Hashes[field] >> m_SlotShift) & m_SlotMask)];
+            if (slot == empty)
+               slot = field;
+            else
+               collided = (m_Hashes[slot] != m_Hashes[field]);  // A field given twice keeps its first slot.
+         }
+         if (!collided)
+            return;
       }
    }
-   if (m_Value.m_Type == XmlNodeBase::XmlNodeType_Value)
-   {
-      AddSpaces(text, indent + 4);
-      text += L"Value:  ";
-      text += m_Value.m_Value;
-      text += L"\n";
-   }
-   if (m_End.m_Type == XmlNodeBase::XmlNodeType_End)
-   {
-      AddSpaces(text, indent);
-      text += L"End:  ";
-      text += m_End.m_Name;
-      text += L"\n";
-   }
-   if (!m_Children.empty())
+}
+
+//--------------------------------------------------------------------
+// Store {text} into the field of {record} whose path has {hash}, if
+// there is such a field.  Returns false if error.
+//--------------------------------------------------------------------
+bool XmlBinderBase::SetField(void *record, SetFunction set, uint64_t hash, const std::wstring &text)
+{
+   size_t field = m_Slots[static_cast<size_t>((hash >> m_SlotShift) & m_SlotMask)];
+   if (field == m_Hashes.size() || m_Hashes[field] != hash)
+      return true;
+   if (set(record, field, text))
+      return true;
+
+   m_ErrorInfo = L"Invalid value for field '";
+   m_ErrorInfo += m_Paths[field];
+   m_ErrorInfo += L"':  ";
+   m_ErrorInfo += text;
+   return false;
+}
+
+//--------------------------------------------------------------------
+// Fill {record} from the next record, using {set}.
+// Returns false if error or no more records.
+//--------------------------------------------------------------------
+bool XmlBinderBase::NextRecord(void *record, SetFunction set)
+{
+   m_ErrorInfo.clear();
+   const uint64_t emptyhash = XmlNameHash(L"");
+
+   // Hash of the path of the element being parsed within the record,
+   // and the hashes of the paths of the elements enclosing it.
+   bool inrecord = false;
+   uint64_t hash = emptyhash;
+   std::vector<uint64_t> hashes;
+
+   std::unique_ptr<XmlNodeBase> node;
+   while (m_Xml.NextNode(node))
    {
-      for (auto childp = m_Children.begin(); childp != m_Children.end(); ++childp)
-         childp->dump(text, indent + 4);
+      if (!inrecord)
+      {
+         if (node->m_Type != XmlNodeBase::XmlNodeType_Begin || XmlNameHash(node->m_Name.c_str()) != m_RecordHash)
+            continue;
+
+         inrecord = true;
+         const std::vector<XmlAttribute> &attribs = static_cast<XmlBeginNode *>(node.get())->m_Attribs;
+         for (auto iter = attribs.begin(); iter != attribs.end(); ++iter)
+            if (!SetField(record, set, ExtendNameHash(ExtendNameHash(emptyhash, L"@"), iter->m_Name.c_str()), iter->m_Value))
+               return false;
+         continue;
+      }
+
+      switch (node->m_Type)
+      {
+         case XmlNodeBase::XmlNodeType_Begin:
+         {
+            hashes.push_back(hash);
+            if (hashes.size() > 1)
+               hash = ExtendNameHash(hash, L"/");
+            hash = ExtendNameHash(hash, node->m_Name.c_str());
+
+            const std::vector<XmlAttribute> &attribs = static_cast<XmlBeginNode *>(node.get())->m_Attribs;
+            for (auto iter = attribs.begin(); iter != attribs.end(); ++iter)
+               if (!SetField(record, set, ExtendNameHash(ExtendNameHash(hash, L"/@"), iter->m_Name.c_str()), iter->m_Value))
+                  return false;
+            break;
+         }
+
+         case XmlNodeBase::XmlNodeType_Value:
+            if (!hashes.empty() && !SetField(record, set, hash, static_cast<XmlValueNode *>(node.get())->m_Value))
+               return false;
+            break;
+
+         case XmlNodeBase::XmlNodeType_End:
+            if (hashes.empty())
+               return true;
+            hash = hashes.back();
+            hashes.pop_back();
+            break;
+
+         default:
+            break;
+      }
    }
+
+   m_Xml.ErrorInfo(m_ErrorInfo);
+   if (m_ErrorInfo.empty() && inrecord)
+      m_ErrorInfo = L"Premature end of document inside record.";
+   return false;
 }
 
 }  // namespace nomxml
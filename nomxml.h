@@ -46,6 +46,45 @@
 //   to parse XML nodes one-by-one from the input data.  NextNode will
 //   return false when there are no more nodes left to parse.
 //
+// * Alternately, call the parser's ParseTree member function to parse
+//   the whole document into an XmlElementTree in one step.  A tree
+//   that will be shared by several threads can be wrapped in an
+//   XmlFrozenDocument.
+//
+// * To fill your own structs from repeating records, describe each
+//   struct's fields with NOMXML_BINDING and read the records with an
+//   XmlBinder.
+//
+// * For ASCII or Latin-1 documents that fit in memory, an XmlByteParser
+//   retrieves the same nodes with their text in bytes instead of
+//   wchar_t.  Its NextBatch member retrieves many nodes per call as an
+//   array of compact events.
+//
+// * Tools that copy most of a document through unchanged, such as to
+//   minify it, can divide it into spans of markup and text with an
+//   XmlMarkupScanner instead of parsing it.
+//
+// * To hash or sign a document, enable the parser's KeepAllText
+//   option and pass each node to an XmlCanonicalWriter, which writes
+//   the canonical form to an XmlSha256 or any other output interface.
+//
+// * To take turns parsing several documents on one thread, such as in
+//   an event loop, parse a few nodes of each at a time with ParseSome.
+//
+// * To parse one large document on several threads, load or map it
+//   into memory, index its records with IndexRecords, and give each
+//   thread its own parser and share of the records with
+//   BeginParsingRecords.
+//
+// * To parse many documents at once, such as in a server, submit them
+//   to an XmlParsePool, which can cancel them or give up on them after
+//   a time limit.  A single XmlParser can be given the same limits
+//   with its SetLimits member.
+//
+// * The parser picks the fastest scanning kernels the CPU supports on
+//   its own.  XmlSimdForce picks others for testing, and XmlSimdVerify
+//   checks them all against the scalar versions.
+//
 // * When finished, destruct the XmlParser object or call the parser's
 //   Reset member to close any open files and discard any allocated
 //   memory.
@@ -54,7 +93,8 @@
 //
 // Limitations / Bugs:
 //
-// * NomXML doesn't work with XML files larger than 2GB in size.
+// * Offsets are size_t, so 32-bit builds of NomXML don't work with XML
+//   files of 4GB or more.
 //
 // * NomXML's built-in file reader and memory reader only work with 8-bit
 //   input files.  They don't support UTF-16 text and don't fully support
@@ -63,8 +103,11 @@
 //   do the UTF-to-ANSI conversion.  Improved support for Unicode may be
 //   added in a future version.
 //
-// * NomXML skips any CDATA chunks in the XML file.  Extracting the
-//   CDATA contents may be added in a future version.
+// * NomXML skips any CDATA chunks in the XML file unless the parser's
+//   KeepAllText option is enabled.  Then the text of a CDATA chunk is
+//   reported in a value node, with '&', '<' and '>' escaped as
+//   references and any text that follows the chunk appended, so it
+//   can't be told apart from ordinary value text.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
@@ -77,7 +120,17 @@
 #include <vector>
 #include <memory>
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <type_traits>
 #include <stdio.h>
+#include <stdint.h>
 
 namespace nomxml {
 
@@ -105,11 +158,12 @@ public:
 
    XmlNodeType m_Type;     // What kind of node is this.
    std::wstring m_Name;    // The node's tag name/title text, if applicable.
+   size_t m_Depth;         // Number of elements enclosing the node's element, so zero for the root element.
 
    // Construction and destruction.
-   explicit XmlNodeBase(XmlNodeType t) : m_Type(t) { }
-   XmlNodeBase(const wchar_t *name, XmlNodeType t) : m_Name(name), m_Type(t) { }
-   XmlNodeBase(const std::wstring &name, XmlNodeType t) : m_Name(name), m_Type(t) { }
+   explicit XmlNodeBase(XmlNodeType t) : m_Type(t), m_Depth(0) { }
+   XmlNodeBase(const wchar_t *name, XmlNodeType t) : m_Name(name), m_Type(t), m_Depth(0) { }
+   XmlNodeBase(const std::wstring &name, XmlNodeType t) : m_Name(name), m_Type(t), m_Depth(0) { }
    XmlNodeBase(const XmlNodeBase &copy) = default;
    virtual ~XmlNodeBase() { }
 
@@ -135,8 +189,10 @@ class XmlBeginNode : public XmlNodeBase
 public:
    std::vector<XmlAttribute> m_Attribs;
    size_t m_Offset;  // Byte offset of the start of this tag in the XML document, or zero if not specified.
+   bool m_Instruction;  // True if this is a processing instruction such as <?xml ... ?> rather than an element.
+   std::wstring m_Data;  // Data of a processing instruction as written, if the parser keeps it.  See XmlParser::KeepAllText.
 
-   XmlBeginNode() : XmlNodeBase(XmlNodeType_Begin), m_Offset(0) { }
+   XmlBeginNode() : XmlNodeBase(XmlNodeType_Begin), m_Offset(0), m_Instruction(false) { }
 
    // Return a copy of this node.
    XmlNodeBase *Clone(void)
@@ -148,8 +204,11 @@ public:
    void clear()
    {
       m_Name.clear();
+      m_Depth = 0;
       m_Offset = 0;
+      m_Instruction = false;
       m_Attribs.clear();
+      m_Data.clear();
    }
 };
 
@@ -174,6 +233,7 @@ public:
    void clear()
    {
       m_Name.clear();
+      m_Depth = 0;
       m_Value.clear();
    }
 };
@@ -186,7 +246,10 @@ public:
 class XmlEndNode : public XmlNodeBase
 {
 public:
-   XmlEndNode() : XmlNodeBase(XmlNodeType_End) { }
+   size_t m_Offset;  // Byte offset just past the '>' that ends this element in the XML document, or zero if not specified.
+   uint64_t m_Hash;  // Fingerprint of the whole element, or zero if fingerprints are not enabled.  See XmlParser::EnableFingerprints.
+
+   XmlEndNode() : XmlNodeBase(XmlNodeType_End), m_Offset(0), m_Hash(0) { }
 
    // Return a copy of this node.
    XmlNodeBase *Clone(void)
@@ -198,6 +261,9 @@ public:
    void clear()
    {
       m_Name.clear();
+      m_Depth = 0;
+      m_Offset = 0;
+      m_Hash = 0;
    }
 };
 
@@ -229,6 +295,66 @@ public:
    void dump(std::wstring &text, size_t indent = 0);
 };
 
+//----------------------------------------------------------
+// Contains an XML element and its children, as one version
+// of a persistent tree.  Nodes are never modified after they
+// are created.  Instead, each edit makes new copies of only
+// the edited element and its ancestors, producing a new root
+// that shares every other node with the prior version.  Any
+// number of prior roots remain valid and unchanged, so old
+// readers keep a consistent view while edits are made.
+//
+// Elements are located by {path}, which holds the index of
+// the child to descend into at each level, starting from
+// the root.  An empty path refers to the root itself.
+//----------------------------------------------------------
+class XmlSharedTree : public XmlElementBase
+{
+public:
+   typedef std::shared_ptr<const XmlSharedTree> Ptr;
+
+   std::vector<Ptr> m_Children;
+
+   // Build a new persistent tree from a copy of {tree}.
+   // If {shareidentical} is true, identical subtrees are stored only
+   // once and shared by every place they occur.  Identical subtrees
+   // are found by their fingerprints, so {tree} must have been parsed
+   // with fingerprints enabled for any sharing to happen.  A shared
+   // subtree keeps the offsets of its first occurrence.
+   static Ptr FromTree(const XmlElementTree &tree, bool shareidentical = false);
+
+   // Copy the contents of this tree into an ordinary tree {tree}.
+   void ToTree(XmlElementTree &tree) const;
+
+   // Returns the element at {path} below {root}, or nullptr if the
+   // path doesn't exist.
+   static Ptr Find(const Ptr &root, const std::vector<size_t> &path);
+
+   // Each of the following returns the root of a new version of
+   // {root} with one edit applied, or nullptr if {path} doesn't
+   // exist.  {root} itself is left unchanged.
+
+   // Replace the element at {path} with {replacement}.
+   static Ptr Replace(const Ptr &root, const std::vector<size_t> &path, const Ptr &replacement);
+
+   // Set the value text of the element at {path}.
+   static Ptr SetValue(const Ptr &root, const std::vector<size_t> &path, const std::wstring &value);
+
+   // Insert {child} into the children of the element at {path},
+   // before the child at {index}.  An {index} past the end appends.
+   static Ptr InsertChild(const Ptr &root, const std::vector<size_t> &path, size_t index, const Ptr &child);
+
+   // Remove the child at {index} from the element at {path}.
+   static Ptr RemoveChild(const Ptr &root, const std::vector<size_t> &path, size_t index);
+
+private:
+   typedef std::unordered_multimap<uint64_t, Ptr> SubtreeMap;
+
+   static Ptr FromTreeImpl(const XmlElementTree &tree, SubtreeMap *subtrees);
+   static bool SameTree(const XmlSharedTree &tree1, const XmlElementTree &tree2);
+   static Ptr ReplaceImpl(const Ptr &node, const std::vector<size_t> &path, size_t depth, const Ptr &replacement);
+};
+
 //---------------------------------------------------------------
 // Base class for file reader interface.  You may provide your
 // own derivative of this if you wish to use your own functions
@@ -260,9 +386,195 @@ public:
    virtual bool EndOfFile(void) = 0;
 };
 
+//---------------------------------------------------------------
+// Base class for output interfaces, which receive the bytes
+// written by XmlCanonicalWriter.  You may provide your own
+// derivative of this to send the bytes wherever you like, such
+// as to a file, a socket or a hash.
+//---------------------------------------------------------------
+class XmlStreamOutputInterface
+{
+public:
+   XmlStreamOutputInterface() { }
+   virtual ~XmlStreamOutputInterface() { }
+
+   // Write the {length} bytes at {data}.
+   // Returns false if error.
+   virtual bool Write(const char *data, size_t length) = 0;
+};
+
+//---------------------------------------------------------------
+// An XML element tree that can no longer be modified, and so
+// may be read by any number of threads at the same time without
+// locking.  The index used for looking up elements by name is
+// built on first use.  If several threads race to build it, the
+// first one to finish publishes its copy through an atomic
+// pointer and the others discard theirs.
+//---------------------------------------------------------------
+class XmlFrozenDocument
+{
+public:
+   // Take ownership of the contents of {root}, which is typically
+   // the tree filled in by XmlParser::ParseTree.
+   explicit XmlFrozenDocument(XmlElementTree &&root);
+   ~XmlFrozenDocument();
+
+   // Retrieve the root of the tree.  The top-level elements of the
+   // document are the children of the root.
+   const XmlElementTree & Root(void) const { return m_Root; }
+
+   // Retrieve pointers to all elements named {name} into {elements},
+   // in document order.  The pointers remain valid for the lifetime
+   // of this object.
+   void FindElements(const std::wstring &name, std::vector<const XmlElementTree *> &elements) const;
+
+   // Returns the first element named {name} in document order, or
+   // nullptr if there is no such element.
+   const XmlElementTree * FindFirst(const std::wstring &name) const;
+
+private:
+   typedef std::unordered_map<std::wstring, std::vector<const XmlElementTree *> > NameIndex;
+
+   const XmlElementTree m_Root;
+
+   // Lazily built index of elements by name, or nullptr if not built yet.
+   mutable std::atomic<const NameIndex *> m_Index;
+
+   // Non-copyable.
+   XmlFrozenDocument(const XmlFrozenDocument &copy);
+
+   // Internal helper functions.  See nomxml.cpp for details.
+   const NameIndex & Index(void) const;
+   static void AddToIndex(NameIndex &index, const XmlElementTree &elm);
+};
+
+//---------------------------------------------------------------
+// Location of one record in an XML document.  A record is an
+// element with a particular tag name, usually one that repeats
+// many times, such as "Placemark" or "gml:featureMember".
+//---------------------------------------------------------------
+struct XmlRecordSpan
+{
+   size_t m_Offset;   // Byte offset of the start of the record's begin tag.
+   size_t m_Length;   // Number of bytes in the record, through the end of its end tag.
+   size_t m_Context;  // Index of the record's ancestors in XmlRecordIndex::m_Contexts.
+};
+
+//---------------------------------------------------------------
+// Locations of all the records in an XML document, as found by
+// XmlParser::IndexRecords.
+//---------------------------------------------------------------
+struct XmlRecordIndex
+{
+   // The records, in document order.
+   std::vector<XmlRecordSpan> m_Records;
+
+   // Each distinct chain of elements that encloses records.  Each
+   // chain holds the begin nodes of the enclosing elements,
+   // outermost first.  Consecutive records usually share a chain.
+   std::vector<std::vector<XmlBeginNode> > m_Contexts;
+
+   // Discard all records and contexts.
+   void clear() { m_Records.clear(); m_Contexts.clear(); }
+};
+
+//---------------------------------------------------------------
+// Copy {length} bytes starting at byte offset {offset} in file
+// {in} to the current position in file {out}.  Useful for
+// copying records verbatim using the spans of an XmlRecordIndex.
+// Returns false if error.
+//---------------------------------------------------------------
+bool XmlCopyBytes(FILE *in, size_t offset, size_t length, FILE *out);
+
+//---------------------------------------------------------------
+// Move file {fp} to byte offset {offset}, retrieve its current
+// offset, or retrieve its length in bytes while leaving it where
+// it was.  Unlike fseek and ftell, these take 64-bit offsets even
+// where long is 32 bits, as on Windows, so files of 2GB and more
+// work.  XmlSeekFile returns false if error, and the others return
+// zero.
+//---------------------------------------------------------------
+bool XmlSeekFile(FILE *fp, size_t offset);
+size_t XmlTellFile(FILE *fp);
+size_t XmlFileLength(FILE *fp);
+
+//---------------------------------------------------------------
+// Choose {count} records uniformly at random from {index},
+// storing them into {sample} in document order along with all
+// of {index}'s contexts.  The same {seed} always chooses the
+// same records.  If {index} has no more than {count} records,
+// all of them are chosen.
+//---------------------------------------------------------------
+void XmlSampleIndex(const XmlRecordIndex &index, size_t count, unsigned seed,
+                    XmlRecordIndex &sample);
+
+//---------------------------------------------------------------
+// The parser scans long runs of text, comments and whitespace in
+// documents parsed from memory with vectorized kernels, and
+// XmlCanonicalWriter finds characters to escape with them.  Each
+// kernel comes in several versions (scalar, SSE2, AVX2 and
+// AVX-512), and the best version the CPU supports is chosen the
+// first time any kernel is needed.
+//
+// Retrieve the names of the kernel versions this CPU supports,
+// from "scalar" up to the best, into {names}.
+//---------------------------------------------------------------
+void XmlSimdSupported(std::vector<std::wstring> &names);
+
+//---------------------------------------------------------------
+// Returns the name of the kernel version in use.
+//---------------------------------------------------------------
+const wchar_t *XmlSimdActive(void);
+
+//---------------------------------------------------------------
+// Use the kernel version named {name} instead of the best one,
+// or go back to the best one if {name} is nullptr.  Useful for
+// testing and benchmarking.  Returns false if the CPU doesn't
+// support that version.  Must not be called while anything is
+// being parsed.
+//---------------------------------------------------------------
+bool XmlSimdForce(const wchar_t *name);
+
+//---------------------------------------------------------------
+// Check every kernel version the CPU supports against the scalar
+// version, scanning {length} bytes of {data} from many starting
+// offsets.  Returns false and describes the first difference in
+// {errorinfo} if any version gives a different answer.
+//---------------------------------------------------------------
+bool XmlSimdVerify(const void *data, size_t length, std::wstring &errorinfo);
+
+//---------------------------------------------------------------
+// Returns true if the {length} bytes at {data} are well formed
+// UTF-8, with no overlong forms, surrogates or code points past
+// U+10FFFF.
+//---------------------------------------------------------------
+bool XmlIsValidUtf8(const void *data, size_t length);
+
+//---------------------------------------------------------------
+// Base class for receiving the nodes of the documents parsed by
+// XmlParser::ParseSome or an XmlParsePool.
+//---------------------------------------------------------------
+class XmlParseHandler
+{
+public:
+   XmlParseHandler() { }
+   virtual ~XmlParseHandler() { }
+
+   // Called for each node of the document in turn, on one of the
+   // pool's threads if parsed by a pool.  Return false to stop
+   // parsing with an error.
+   virtual bool Node(const XmlNodeBase &node) = 0;
+};
+
 //---------------------------------------------------------------
 // Parses an XML document into XmlNodes.
 // The input data may be from a file or a block of memory.
+//
+// A parser must only be used by one thread at a time, except for
+// StopFollowing.  Separate parsers share nothing but constant
+// tables, such as those of character classes and entities, so
+// they may be used on separate threads at once, including on the
+// same document in memory.
 //---------------------------------------------------------------
 class XmlParser
 {
@@ -277,23 +589,228 @@ public:
    bool BeginParsingFromFile(const wchar_t *filename);
    bool BeginParsingFromFile(const char *filename);
 
+   // Begin parsing XML document contained in file {filename}, which
+   // another program may still be appending to, such as a log file.
+   // Whenever the parser reaches the current end of the file, it waits
+   // for more data to be appended, checking every {pollms} milliseconds,
+   // and then resumes exactly where it stopped.  Parsing ends if nothing
+   // is appended for {idlems} milliseconds, or never if {idlems} is
+   // zero, or when StopFollowing is called.
+   // Returns false if error.
+   //
+   bool BeginFollowingFile(const wchar_t *filename, unsigned pollms, unsigned idlems);
+
+   // Tell a parser started with BeginFollowingFile to stop waiting for
+   // more data, so that parsing ends the next time it reaches the end of
+   // the file.  Unlike the other members, this may be called from any
+   // thread while another thread is parsing.
+   //
+   void StopFollowing(void);
+
+   // Make parsing fail once {*cancel} becomes true, unless {cancel} is
+   // nullptr, or once {deadline} has passed.  These are checked each
+   // time another {checkbytes} bytes of the document have been read, so
+   // they cost next to nothing in between, and parsing stops within
+   // about that many bytes of being cancelled.  A node cut short by
+   // the limits is never returned.  The limits stay in effect for later
+   // documents until SetLimits is called again; pass nullptr and
+   // std::chrono::steady_clock::time_point::max() to remove them.
+   //
+   void SetLimits(const std::atomic<bool> *cancel, std::chrono::steady_clock::time_point deadline,
+                  size_t checkbytes = 64 * 1024);
+
    // Begin parsing XML document contained in the memory block pointed to by {data}.
    // The memory block is {numbytes} in size.
    // The memory block must remain accessible until parsing is completed.
+   // The parser only reads the memory block and never copies it, so any
+   // number of parsers on different threads may share one block, such
+   // as a memory-mapped file.
+   // Returns false if error.
+   //
+   bool BeginParsingFromMemory(const void *data, size_t numbytes);
+
+   // Begin parsing records {first} through {first} + {count} - 1 of
+   // {index}, an index of the XML document in the memory block pointed
+   // to by {data}, {numbytes} in size.  The records are parsed as with
+   // BeginParsingRange, from the start of the first one through the end
+   // of the last, as if the first one's enclosing elements were open.
+   // Since parsers only read the memory block and the index, a document
+   // can be divided among any number of threads by giving each its own
+   // parser and its own records of the same block and index.
    // Returns false if error.
    //
-   bool BeginParsingFromMemory(void *data, size_t numbytes);
+   bool BeginParsingRecords(const void *data, size_t numbytes, const XmlRecordIndex &index,
+                            size_t first, size_t count);
 
    // Begin parsing XML document using the specified interface to read the file.
    // Returns false if error.
    //
    bool BeginParsingFromInterface(XmlStreamInputInterface *iface);
 
+   // Restrict parsing of the document that was just opened by one of
+   // the above functions to the bytes from {offset} up to but not
+   // including {endoffset}.  Parsing proceeds as if the elements whose
+   // begin nodes are in {context} (outermost first) were already open,
+   // so a range that starts inside the document, such as one made of
+   // whole records from an XmlRecordIndex, parses without error.  Any
+   // elements still open at the end of the range are not an error, and
+   // end tags of elements opened before the range that aren't in
+   // {context} are skipped.
+   // Node offsets remain relative to the start of the whole document.
+   // Returns false if error.
+   //
+   bool BeginParsingRange(size_t offset, size_t endoffset, const std::vector<XmlBeginNode> &context);
+
    // Parse the next XmlNode from the XML document.
    // Returns false if parsing error or no more nodes in document.
    //
    bool NextNode(std::unique_ptr<XmlNodeBase> &ptrref);
 
+   // Results of ParseSome.
+   typedef enum { ParseStatus_More, ParseStatus_Done, ParseStatus_Error } ParseStatus;
+
+   // Parse nodes as NextNode does, passing each one to {handler}, until
+   // {maxnodes} nodes have been parsed or {maxbytes} bytes of the
+   // document have been read, or either one if both are nonzero.  This
+   // lets one thread, such as an event loop, take turns parsing several
+   // large documents, since the parser keeps its place between calls.
+   // A node is never split between calls, so a call may read past
+   // {maxbytes} to finish its last node.  Comments and marked sections
+   // make no nodes, so a call may stop part way through one of them
+   // and leave the rest for the next call.  Returns ParseStatus_More if
+   // the limit was reached with the document not yet finished,
+   // ParseStatus_Done if it was finished, or ParseStatus_Error if
+   // parsing failed or {handler} stopped it.
+   //
+   ParseStatus ParseSome(XmlParseHandler &handler, size_t maxnodes, size_t maxbytes);
+
+   // Retrieve the number of elements that have begun but not ended.
+   // After a begin node, this includes the node's own element.
+   //
+   size_t OpenElements(void);
+
+   // Retrieve the tag name of the open element at depth {depth}, where
+   // zero is the root element, without copying it.  {depth} must be
+   // less than OpenElements().  With a node's m_Depth, this gives the
+   // names of all of the node's ancestors without keeping a stack of
+   // them alongside the parser.
+   //
+   const std::wstring &AncestorName(size_t depth);
+
+   // Parse the remainder of the XML document into a tree of elements.
+   // The top-level elements of the document become children of {root}.
+   // Returns false if error.
+   //
+   bool ParseTree(XmlElementTree &root);
+
+   // Bring {root} up to date after an edit to the XML document in
+   // memory, reparsing as little of the document as possible.
+   // {root} must have been built by ParseTree from the unedited
+   // document.  {data} and {numbytes} give the edited document, in
+   // which the {oldlength} bytes that started at {editoffset} were
+   // replaced by {newlength} bytes.  Only the smallest element
+   // enclosing the edit is reparsed and spliced into the tree, and
+   // the offsets of what follows it are adjusted.  Falls back to
+   // reparsing the whole document if the edit isn't inside any one
+   // element.  Parsing state is left at the end of whatever portion
+   // was reparsed.  The fingerprints of the elements enclosing the
+   // reparsed element are not updated.  Returns false if error.
+   //
+   bool ReparseEdit(XmlElementTree &root, const void *data, size_t numbytes,
+                    size_t editoffset, size_t oldlength, size_t newlength);
+
+   // Parse the remainder of the XML document, recording the location of
+   // every element named {recordname} into {index}.  Records nested
+   // inside other records are treated as part of the outer record.
+   // Returns false if error.
+   //
+   bool IndexRecords(const wchar_t *recordname, XmlRecordIndex &index);
+
+   // Find the last {count} elements named {recordname} in the document
+   // that was just opened, placing their locations into {index} in
+   // document order.  Rather than parsing the whole document, this
+   // scans backward in blocks from the end of the file for the records'
+   // begin tags, skipping over comments and CDATA sections, and checks
+   // each one found by parsing it.  A "-->" or "]]>" is only taken as
+   // the end of a comment or section if its start is found within 1MB
+   // before it, so the same characters in text or attribute values
+   // don't send the scan back to the start of the file.  The document
+   // from the earliest record found to the end is parsed to find the
+   // elements enclosing each one, so that an element nested inside
+   // another element named {recordname} isn't taken as a record.  The
+   // time taken therefore depends on the size of the records rather
+   // than the size of the file.  The records all share one empty
+   // context.  Use BeginParsingRange with each record's span to parse
+   // the records afterward; the parse in progress, if any, is left
+   // where it was.  Fewer than {count} records are returned if the
+   // document doesn't have that many.
+   // Returns false if error.
+   //
+   bool FindLastRecords(const wchar_t *recordname, size_t count, XmlRecordIndex &index);
+
+   // Choose {count} elements named {recordname} at random from the
+   // document without parsing all of it, storing their locations into
+   // {sample} in document order.  Random offsets in the file are moved
+   // forward to the next record's begin tag, skipping comments and CDATA
+   // sections, and each record found is checked by parsing it.  Since
+   // a record that follows a long record is found more often, records
+   // are kept in inverse proportion to their distance from the
+   // preceding record, making the sample approximately uniform.
+   // Records nested inside other records are not supported, and all the
+   // records share one empty context.  If the probes don't turn up
+   // {count} records, such as when the document holds few of them, the
+   // whole document is indexed and sampled with XmlSampleIndex instead,
+   // so fewer than {count} records are returned only if the document
+   // doesn't have that many.  The same {seed} always chooses the same
+   // records.  If an XmlRecordIndex of the document is already
+   // available, XmlSampleIndex is exact and faster.
+   // Returns false if error.
+   //
+   bool SampleRecords(const wchar_t *recordname, size_t count, unsigned seed, XmlRecordIndex &sample);
+
+   // Find the first element named {recordname} that begins at or after
+   // byte {offset} in the document that was just opened, placing its
+   // location into {span}, without parsing the document up to there.
+   // Comments and CDATA sections are skipped, and the element found is
+   // checked by parsing it.  Since {offset} may fall inside a comment or
+   // CDATA section, an element is only accepted once the scan reaches
+   // the start of a comment or section, or the end of the document,
+   // without passing the end of one.  A "-->" or "]]>" in text or an
+   // attribute value therefore makes the scan pass over the elements
+   // before it, which is harmless when dividing a document.  Useful for
+   // dividing a large document into ranges of whole records to be
+   // parsed on separate threads.
+   // Returns false if there is no such element or error.
+   //
+   bool FindNextRecord(const wchar_t *recordname, size_t offset, XmlRecordSpan &span);
+
+   // Enable or disable computing a fingerprint of each element as it is
+   // parsed.  When enabled, each end node's m_Hash receives a 64-bit
+   // hash of the element's name, its attributes in sorted order, its
+   // value text with surrounding whitespace trimmed, and the hashes of
+   // its children in order.  Equal elements thus have equal hashes no
+   // matter how their attributes are ordered or their text indented,
+   // so consumers can recognize a subtree they have already seen.
+   // Disabled by default.
+   //
+   void EnableFingerprints(bool enable);
+
+   // Enable or disable reporting all of the document's text as it is
+   // written.  When enabled:
+   // * Whitespace between tags, such as the indentation between one
+   //   child element and the next, is reported as value nodes.
+   //   Normally whitespace is only reported when it's part of other
+   //   value text.
+   // * The text of a CDATA section is reported as a value node, with
+   //   '&', '<' and '>' escaped as references so it reads like any
+   //   other value text.  Normally CDATA sections are skipped.
+   // * The data of a processing instruction other than the XML
+   //   declaration is kept as written in m_Data of its begin node
+   //   instead of being read as attributes.
+   // XmlCanonicalWriter needs all of these.  Disabled by default.
+   //
+   void KeepAllText(bool enable);
+
    // Retrieve a description of the most recent error into {errorinfo}.
    // If no error, {errorinfo} will be empty string.
    //
@@ -327,10 +844,50 @@ private:
    // Interface to input file, if m_Reader != nullptr
    std::unique_ptr<XmlStreamInputInterface> m_Reader;
 
+   // Document being parsed, if it was passed to BeginParsingFromMemory.
+   // Lets the parser scan runs of characters without going through
+   // m_Reader one character at a time.
+   //
+   const char *m_Memory;
+   size_t m_MemorySize;
+
    // Used for tracking position in memory block or file
    size_t m_DataSize;
    size_t m_DataPos;
 
+   // Position at which to stop parsing, if BeginParsingRange was used.
+   size_t m_RangeEnd;
+
+   // Names of the end tags skipped since BeginParsingRange because their
+   // elements were opened before the range began, in the order skipped.
+   std::vector<std::wstring> m_SkippedEnds;
+
+   // Position at which ParseSome's byte budget runs out, or noRangeEnd
+   // outside ParseSome.  If a comment or marked section was left part
+   // way through there, m_PendingCloser is its repeated closer character
+   // and m_PendingState how much of the closer had been matched.
+   // Otherwise m_PendingCloser is zero.
+   //
+   size_t m_PausePos;
+   char m_PendingCloser;
+   unsigned char m_PendingState;
+
+   // Limits set by SetLimits.  m_CheckPos is the position at which
+   // NextChar next calls CheckLimits, and m_StopReason describes why
+   // the limits stopped parsing, or is nullptr if they haven't.
+   //
+   const std::atomic<bool> *m_Cancel;
+   std::chrono::steady_clock::time_point m_Deadline;
+   size_t m_CheckBytes;
+   size_t m_CheckPos;
+   const wchar_t *m_StopReason;
+
+   // Offsets that ScanForward has shown to lie outside any comment or
+   // CDATA section, so that later scans of the same document needn't
+   // look ahead for the next marker again.
+   size_t m_OutsideFrom;
+   size_t m_OutsideTo;
+
    // Description of most recent error.
    // Example:  "Premature end of document"
    //
@@ -342,6 +899,17 @@ private:
    //
    wchar_t m_CurChar;
 
+   // True if element fingerprints are being computed.
+   bool m_Fingerprints;
+
+   // True if whitespace between tags, CDATA text and instruction data
+   // are reported.
+   bool m_KeepAllText;
+
+   // Set to true to make a reader started by BeginFollowingFile stop
+   // waiting for more data.
+   std::atomic<bool> m_StopFollowing;
+
    // Current token from XML document.
    // Populated each time NextToken() is called.
    //
@@ -350,18 +918,1033 @@ private:
    // Non-copyable.
    XmlParser(const XmlParser &copy);
 
+   // Where the parse stands, saved by SaveState so that the scans for
+   // records can parse other parts of the document and then carry on
+   // from there with RestoreState.
+   struct ParseState
+   {
+      std::vector<XmlElementBase> m_Stack;
+      XmlNodeBase::XmlNodeType m_PriorTagType;
+      bool m_PriorWasEmptyTag;
+      std::wstring m_PriorName;
+      size_t m_DataPos;
+      size_t m_RangeEnd;
+      std::vector<std::wstring> m_SkippedEnds;
+      char m_PendingCloser;
+      unsigned char m_PendingState;
+      size_t m_CheckPos;
+      const wchar_t *m_StopReason;
+      std::wstring m_ErrorInfo;
+      wchar_t m_CurChar;
+      std::wstring m_CurToken;
+   };
+
    // Internal helper functions.  See nomxml.cpp for details.
    const std::wstring & CurToken(void);
    wchar_t  CurChar(void);
+   size_t   CurCharOffset(void);
    bool     NextChar(void);
-   bool     NextToken(const wchar_t *delims=nullptr);
+   bool     CheckLimits(void);
+   bool     NextToken(unsigned delims=0);
+   size_t   MemoryRun(const char *&run);
+   bool     SkipChars(size_t count);
    bool     ParseTagValueNode(const std::wstring &prefix, std::unique_ptr<XmlNodeBase> &ptrref);
    bool     ParseEndTagNode(std::unique_ptr<XmlNodeBase> &ptrref);
+   bool     EatThroughCloser(char repeated);
    bool     EatComment(void);
    bool     EatMarkedSection(void);
+   bool     ReadCData(std::wstring &text);
+   bool     ReadInstructionData(std::wstring &data);
    bool     ParseBangTag(std::unique_ptr<XmlNodeBase> &ptrref);
    bool     ParseBeginTagNode(std::unique_ptr<XmlNodeBase> &ptrref);
+   bool     ParseNextNode(std::unique_ptr<XmlNodeBase> &ptrref);
    bool     BeginParsingImpl(void);
+   void     PopElement(std::unique_ptr<XmlNodeBase> &ptrref);
+   void     SaveState(ParseState &state);
+   void     RestoreState(ParseState &state);
+   bool     ReadBlock(size_t offset, size_t length, std::wstring &block);
+   bool     MeasureRecord(size_t offset, size_t filelength, size_t &length);
+   void     EnclosingAt(size_t offset, size_t mark, std::vector<std::wstring> &enclosing);
+   bool     IsSectionEnd(size_t closer, bool comment);
+   bool     ScanBackward(const std::wstring &opener, size_t before, size_t count, std::vector<XmlRecordSpan> &found);
+   bool     ScanForward(const std::wstring &opener, size_t from, XmlRecordSpan &span);
+   bool     ReparseElement(XmlElementTree &result, const void *data, size_t numbytes, size_t offset, size_t length,
+                           const std::vector<XmlBeginNode> &context);
+};
+
+//----------------------------------------------------------
+// Describes one attribute from an XML tag, holding the
+// bytes of the document unchanged.  See XmlByteParser.
+//----------------------------------------------------------
+struct XmlByteAttribute
+{
+   std::string m_Name;
+   std::string m_Value;
+};
+
+//----------------------------------------------------------
+// Node retrieved from an XmlByteParser.  One object holds
+// any type of node, so that it can be reused from one call
+// to the next without allocating.
+//----------------------------------------------------------
+class XmlByteNode
+{
+public:
+   XmlNodeBase::XmlNodeType m_Type;         // What kind of node is this.
+   std::string m_Name;                      // The tag name of the node's element.
+   std::string m_Value;                     // Value text, for value nodes.
+   std::vector<XmlByteAttribute> m_Attribs; // Attributes, for begin nodes.
+   std::string m_Data;                      // Same as XmlBeginNode::m_Data.
+   size_t m_Depth;                          // Same as XmlNodeBase::m_Depth.
+   size_t m_Offset;                         // Same as XmlBeginNode::m_Offset or XmlEndNode::m_Offset.
+   uint64_t m_Hash;                         // Same as XmlEndNode::m_Hash.
+   bool m_Instruction;                      // Same as XmlBeginNode::m_Instruction.
+
+   XmlByteNode() : m_Type(XmlNodeBase::XmlNodeType_Invalid), m_Depth(0), m_Offset(0), m_Hash(0), m_Instruction(false) { }
+
+   // Convert this node to the equivalent XmlBeginNode, XmlValueNode or
+   // XmlEndNode in {ptrref}, treating each byte as a Latin-1 character.
+   void Widen(std::unique_ptr<XmlNodeBase> &ptrref) const;
+
+   // Replace the contents of this node with those of {node}, whose
+   // characters must all be Latin-1, as they are when XmlParser reads
+   // a document from memory.
+   void Assign(const XmlNodeBase &node);
+};
+
+//----------------------------------------------------------
+// One event from XmlByteParser::NextBatch.  Events are
+// plain data, so that a batch of them is one contiguous
+// array that can be processed in a tight loop.  A begin
+// event is followed by one attribute event per attribute.
+//----------------------------------------------------------
+struct XmlEvent
+{
+   typedef enum { XmlEvent_Begin, XmlEvent_Attribute,
+                  XmlEvent_Value, XmlEvent_End } XmlEventType;
+
+   uint8_t m_Type;         // What kind of event this is, an XmlEventType.
+   bool m_Instruction;     // Same as XmlBeginNode::m_Instruction, for begin events.
+   uint32_t m_NameId;      // Tag or attribute name, an index into XmlEventBatch::m_Names.
+   uint32_t m_Depth;       // Number of elements enclosing the event's element.
+   uint32_t m_TextOffset;  // Value text, for value and attribute events, in
+   uint32_t m_TextLength;  //    XmlEventBatch::m_Text.
+   uint64_t m_Offset;      // Byte offset in the document, as with XmlBeginNode::m_Offset.
+};
+
+//----------------------------------------------------------
+// A batch of events from XmlByteParser::NextBatch.  The text
+// of all the events is kept together in one arena.  Names are
+// numbered the first time they're seen, and keep their numbers
+// from one batch to the next, so events can be matched by name
+// by comparing numbers.  Call Clear before reusing a batch for
+// another document.
+//----------------------------------------------------------
+class XmlEventBatch
+{
+public:
+   std::vector<XmlEvent> m_Events;     // The events of this batch.
+   std::string m_Text;                 // Text of this batch's events.
+   std::vector<std::string> m_Names;   // Every name seen so far, by number.
+
+   // Returns the first byte of {event}'s text in m_Text.
+   const char *Text(const XmlEvent &event) const
+   {
+      return m_Text.data() + event.m_TextOffset;
+   }
+
+   // Returns the number of {name}, numbering it if it hasn't been seen
+   // before.
+   //
+   uint32_t NameId(const std::string &name);
+
+   // Discard the events and names.
+   void Clear(void);
+
+private:
+   std::unordered_map<std::string, uint32_t> m_NameIds;
+};
+
+//---------------------------------------------------------------
+// Parses an 8-bit XML document, such as an ASCII or Latin-1 one,
+// and retrieves its nodes with their text as the document's bytes
+// rather than as wide characters.  The parsing itself is done by an
+// XmlParser reading the document from memory, so the nodes are
+// exactly those of XmlParser, and ranges, limits, fingerprints and
+// KeepAllText all work the same way.  NextBatch retrieves many
+// nodes per call as one array of compact events.
+//
+// The whole document must be in memory, so there's no following
+// files or custom input interfaces.
+//---------------------------------------------------------------
+class XmlByteParser
+{
+public:
+   XmlByteParser();
+
+   // Begin parsing the {numbytes} bytes at {data}, which must stay
+   // put until parsing is finished.  Returns false if error.
+   //
+   bool BeginParsingFromMemory(const void *data, size_t numbytes);
+
+   // Begin parsing the file named {filename}, which is read into
+   // memory all at once.  Returns false if error.
+   //
+   bool BeginParsingFromFile(const wchar_t *filename);
+
+   // Same as XmlParser::BeginParsingRange, SetLimits,
+   // EnableFingerprints and KeepAllText.
+   //
+   bool BeginParsingRange(size_t offset, size_t endoffset, const std::vector<XmlBeginNode> &context);
+   void SetLimits(const std::atomic<bool> *cancel, std::chrono::steady_clock::time_point deadline,
+                  size_t checkbytes = 64 * 1024);
+   void EnableFingerprints(bool enable);
+   void KeepAllText(bool enable);
+
+   // Parse the next node into {node}.  Returns false if parsing error
+   // or no more nodes in document.
+   //
+   bool NextNode(XmlByteNode &node);
+
+   // Parse the next node into {ptrref} as a wide node, as with
+   // XmlParser::NextNode.
+   //
+   bool NextNode(std::unique_ptr<XmlNodeBase> &ptrref);
+
+   // Parse nodes into {batch} as events, replacing its events and
+   // text, until it holds at least {maxevents} events.  A begin event
+   // is never separated from its attribute events, so there may be a
+   // few more than that.  Returns false if parsing error or no more
+   // events in document.  It's an error for the text of one batch to
+   // reach 4GB, since events locate their text with 32-bit numbers.
+   //
+   bool NextBatch(XmlEventBatch &batch, size_t maxevents);
+
+   // Same as XmlParser::OpenElements and XmlParser::AncestorName.
+   size_t OpenElements(void);
+   const std::string &AncestorName(size_t depth);
+
+   // Retrieve a description of the most recent error.
+   void ErrorInfo(std::wstring &errorinfo);
+
+   // Retrieve the current byte position in the document.
+   size_t CurPosition(void);
+
+   // Discard the document and any allocated memory.
+   void Reset(void);
+
+private:
+   XmlParser m_Parser;                    // Parser doing the work.
+   std::vector<char> m_File;              // Contents of the file, if parsing from a file.
+   std::unique_ptr<XmlNodeBase> m_Wide;   // Node retrieved from m_Parser.
+   XmlByteNode m_Node;                    // Node being added to a batch by NextBatch.
+   std::vector<std::string> m_Ancestors;  // Names retrieved by AncestorName, by depth.
+   std::wstring m_ErrorInfo;              // Errors that aren't m_Parser's.
+
+   // Non-copyable.
+   XmlByteParser(const XmlByteParser &copy);
+   XmlByteParser & operator=(const XmlByteParser &copy);
+};
+
+//----------------------------------------------------------
+// A run of bytes in a document, found by an
+// XmlMarkupScanner.  Points into the document itself, so
+// it's only valid while the document stays put.
+//----------------------------------------------------------
+struct XmlMarkupSpan
+{
+   typedef enum { XmlSpan_Text, XmlSpan_BeginTag, XmlSpan_EndTag,
+                  XmlSpan_EmptyTag, XmlSpan_Comment, XmlSpan_Instruction,
+                  XmlSpan_CData, XmlSpan_Declaration } XmlSpanType;
+
+   XmlSpanType m_Type;     // What kind of markup, or text, this is.
+   const char *m_Data;     // First byte of the span, including any '<'.
+   size_t m_Length;        // Number of bytes, through any '>'.
+   bool m_WhiteSpace;      // True for text that is only whitespace.
+};
+
+//---------------------------------------------------------------
+// Divides an 8-bit document in memory into spans of markup and
+// text without copying or converting anything, for tools that
+// rewrite documents mostly verbatim, such as to minify them.
+// Unlike the parsers, it doesn't check that tags match or split
+// tags into names and attributes, so it's much faster, and it
+// keeps comments, CDATA sections and declarations.
+//
+// Scanning can begin at any '<' that starts markup, so that a
+// large document can be divided among several scanners.
+//---------------------------------------------------------------
+class XmlMarkupScanner
+{
+public:
+   XmlMarkupScanner();
+
+   // Begin scanning the {numbytes} bytes at {data}, which must stay
+   // put until scanning is finished, starting at offset {offset}.
+   //
+   void BeginScanning(const void *data, size_t numbytes, size_t offset = 0);
+
+   // Find the next span into {span}.  Returns false if the markup is
+   // unterminated or there are no more spans.
+   //
+   bool NextSpan(XmlMarkupSpan &span);
+
+   // Retrieve a description of the most recent error.
+   void ErrorInfo(std::wstring &errorinfo);
+
+   // Retrieve the offset of the byte after the last span found.
+   size_t CurPosition(void);
+
+private:
+   const char *m_Data;        // Document being scanned.
+   size_t m_Size;             // Length of the document in bytes.
+   size_t m_Pos;              // Offset of the next span.
+   std::wstring m_ErrorInfo;
+
+   // Internal helper functions.  See nomxml.cpp for details.
+   size_t   FindCloser(size_t from, const char *closer, size_t length);
+   size_t   FindTagEnd(size_t from);
+   size_t   FindDeclarationEnd(size_t from);
+};
+
+//---------------------------------------------------------------
+// Output interface that computes the SHA-256 digest of the bytes
+// written to it.  Only one 64-byte block is held at a time, so
+// any amount of output can be digested.
+//---------------------------------------------------------------
+class XmlSha256 : public XmlStreamOutputInterface
+{
+public:
+   XmlSha256();
+
+   // Add the {length} bytes at {data} to the digest.
+   bool Write(const char *data, size_t length);
+
+   // Finish the digest, retrieving its 32 bytes into {digest}, and
+   // start a new one.
+   //
+   void Finish(unsigned char digest[32]);
+
+   // Finish the digest, retrieving it into {hex} as 64 lowercase
+   // hexadecimal digits, and start a new one.
+   //
+   void Finish(std::wstring &hex);
+
+   // Discard anything written and start a new digest.
+   void Reset(void);
+
+private:
+   uint32_t m_State[8];       // Hash of the blocks so far.
+   unsigned char m_Block[64]; // Partial block not yet hashed.
+   size_t m_BlockLength;      // Number of bytes in m_Block.
+   uint64_t m_TotalLength;    // Number of bytes written.
+
+   void Transform(const unsigned char *block);
+};
+
+//---------------------------------------------------------------
+// Writes an XML document in canonical form, per Canonical XML 1.0
+// without comments ("C14N"), as it is parsed one node at a time.
+// Equivalent documents have the same canonical form byte for byte,
+// which is what gets hashed and signed.  Following the standard:
+//
+// * The output is UTF-8 with line endings normalized to LF.
+// * The XML declaration and comments are dropped.  Other processing
+//   instructions are kept, with a line break between them and the
+//   root element.
+// * Empty tags become a begin tag and an end tag.
+// * Attribute values are double-quoted.  Entity and character
+//   references are expanded in text and attribute values, and only
+//   the characters that must be escaped are.
+// * Namespace declarations come first, sorted by prefix, then the
+//   other attributes sorted by namespace URI and local name.  A
+//   declaration that repeats one already in effect is dropped.
+//
+// The nodes must come from an XmlParser with KeepAllText enabled,
+// since whitespace between tags, the text of CDATA sections and the
+// data of processing instructions are part of the canonical form.
+// Output is written to an XmlStreamOutputInterface, such as an
+// XmlSha256, in blocks, so memory use depends only on how deeply the
+// document's elements nest.
+//
+// CDATA sections become escaped text, as canonical XML requires.
+// Writing fails if a processing instruction arrives with attributes
+// but no data, which means the parser wasn't keeping its data.
+// Documents whose XML declaration says they are ISO-8859-1 are
+// converted to UTF-8; all others are taken to be UTF-8 already.
+//---------------------------------------------------------------
+class XmlCanonicalWriter
+{
+public:
+   // Write the canonical form to {out}.
+   explicit XmlCanonicalWriter(XmlStreamOutputInterface &out);
+
+   // Write the canonical form of {node}, the next node of the
+   // document.  Returns false if error.
+   //
+   bool Write(const XmlNodeBase &node);
+
+   // Finish the document, checking that every element has ended,
+   // and write any remaining output.  Returns false if error.
+   //
+   bool Finish(void);
+
+   // Retrieve a description of the most recent error.
+   void ErrorInfo(std::wstring &errorinfo);
+
+private:
+   // A namespace prefix bound to a URI by an open element.
+   struct Binding
+   {
+      std::wstring m_Prefix;
+      std::wstring m_Uri;
+      size_t m_Depth;            // Nesting depth of the declaring element.
+   };
+
+   // An attribute being sorted into canonical order.
+   struct SortedAttribute
+   {
+      std::wstring m_Uri;
+      std::wstring m_LocalName;
+      const XmlAttribute *m_Attrib;
+   };
+
+   XmlStreamOutputInterface &m_Out;
+   std::string m_Buffer;         // Output not yet written to m_Out.
+   std::string m_Expanded;       // Text with references expanded, before escaping.
+   std::vector<std::wstring> m_Open;   // Names of the open elements.
+   std::vector<Binding> m_Bindings;    // Namespace declarations in effect, innermost last.
+   bool m_Latin1;                // True if the document is in ISO-8859-1.
+   bool m_SeenRoot;              // True once the root element has begun.
+   bool m_SkipEnd;               // True if the next node ends a processing instruction.
+   std::wstring m_ErrorInfo;
+
+   // Non-copyable.
+   XmlCanonicalWriter(const XmlCanonicalWriter &copy);
+   XmlCanonicalWriter & operator=(const XmlCanonicalWriter &copy);
+
+   // Internal helper functions.  See nomxml.cpp for details.
+   void     AppendChar(std::string &out, uint32_t c);
+   void     AppendText(const std::wstring &text);
+   bool     Expand(const std::wstring &text, bool attribute);
+   void     AppendEscaped(bool attribute);
+   bool     WriteInstruction(const XmlBeginNode &begin);
+   bool     WriteBegin(const XmlBeginNode &begin);
+   bool     WriteEnd(void);
+   bool     Flush(bool all);
+   const std::wstring *FindBinding(const std::wstring &prefix);
+};
+
+//---------------------------------------------------------------
+// Parse {text} as a number into {number}, ignoring surrounding
+// whitespace.  Returns false if {text} isn't a number.
+//---------------------------------------------------------------
+bool XmlParseNumber(const std::wstring &text, double &number);
+
+//---------------------------------------------------------------
+// Reads the records of an XML document one at a time, along with
+// the values of chosen fields of each record, without building
+// a tree.  A record is an element with a particular tag name, as
+// with XmlParser::IndexRecords.
+//
+// Fields are named by paths relative to the record element.
+// "name" is the value of the record's child element "name",
+// "Point/coordinates" descends one more level, "@id" is the
+// record's attribute "id", and "Data/@name" is the attribute
+// "name" of the record's child element "Data".
+//---------------------------------------------------------------
+class XmlRecordReader
+{
+public:
+   // Read the records named {recordname} from the remainder of the
+   // document being parsed by {xml}, retrieving the fields named by
+   // {fieldpaths}.
+   XmlRecordReader(XmlParser &xml, const wchar_t *recordname, const std::vector<std::wstring> &fieldpaths);
+
+   // Read the next record, retrieving its location into {span} and
+   // every occurrence of each field, in document order, into the
+   // corresponding entry of {fields}.  Returns false if error or no
+   // more records.
+   //
+   bool Next(XmlRecordSpan &span, std::vector<std::vector<std::wstring> > &fields);
+
+   // Retrieve a description of the most recent error into {errorinfo}.
+   // If no error, {errorinfo} will be empty string.
+   //
+   void ErrorInfo(std::wstring &errorinfo) const { errorinfo = m_ErrorInfo; }
+
+private:
+   XmlParser &m_Xml;
+   std::wstring m_RecordName;
+   std::vector<std::wstring> m_FieldPaths;
+   std::wstring m_ErrorInfo;
+
+   // Non-copyable.
+   XmlRecordReader(const XmlRecordReader &copy);
+   XmlRecordReader & operator=(const XmlRecordReader &copy);
+
+   // Internal helper functions.  See nomxml.cpp for details.
+   void AddField(const std::wstring &path, const std::wstring &value,
+                 std::vector<std::vector<std::wstring> > &fields);
+};
+
+//---------------------------------------------------------------
+// Computes sums, counts, minimums and maximums of the values in
+// the records of an XML document, grouped by the values of key
+// fields, in one streaming pass without building a tree.
+//
+// Fields are named by paths as with XmlRecordReader.  A key is
+// the first occurrence of its field in the record, or empty if
+// the record doesn't have the field.
+//
+// Aggregates are written as "count", "count:path", "sum:path",
+// "min:path" or "max:path".  "count" counts the records in the
+// group.  The others use every occurrence of the field in each
+// record.  Values are parsed as numbers; text that isn't a
+// number is counted by "count:path" but otherwise ignored.
+//
+// Several XmlGroupBy objects with the same configuration may
+// each aggregate a different part of a document, such as ranges
+// of whole records parsed on separate threads, and then be
+// combined with Merge.
+//---------------------------------------------------------------
+class XmlGroupBy
+{
+public:
+   // One group's key values, in the order of the key paths, and
+   // its aggregates, in the order they were configured.  The
+   // minimum or maximum of a group without any numeric values is
+   // NaN.
+   struct Group
+   {
+      std::vector<std::wstring> m_Keys;
+      std::vector<double> m_Results;
+   };
+
+   XmlGroupBy() : m_NumKeys(0) { }
+
+   // Set which elements are records, which fields group them, and
+   // which aggregates to compute, discarding any groups so far.
+   // Returns false if an aggregate isn't recognized.
+   //
+   bool Configure(const wchar_t *recordname, const std::vector<std::wstring> &keypaths,
+                  const std::vector<std::wstring> &aggregates);
+
+   // Add the records in the remainder of the document being parsed
+   // by {xml} to the groups.  Returns false if error.
+   //
+   bool Aggregate(XmlParser &xml);
+
+   // Add the groups of {other}, which must have been configured the
+   // same way, to the groups of this object.
+   //
+   void Merge(const XmlGroupBy &other);
+
+   // Retrieve the groups into {groups}, sorted by their keys.
+   //
+   void Results(std::vector<Group> &groups) const;
+
+   // Retrieve a description of the most recent error into {errorinfo}.
+   // If no error, {errorinfo} will be empty string.
+   //
+   void ErrorInfo(std::wstring &errorinfo) const { errorinfo = m_ErrorInfo; }
+
+private:
+   typedef enum { Operation_Count, Operation_Sum, Operation_Min, Operation_Max } Operation;
+
+   // One aggregate, and the index in m_Fields of the field it uses,
+   // or noField if it counts records.
+   struct Spec
+   {
+      Operation m_Operation;
+      size_t m_Field;
+   };
+   static const size_t noField = static_cast<size_t>(-1);
+
+   // Running totals for one aggregate of one group.
+   struct Totals
+   {
+      size_t m_Count;     // Number of records or values seen.
+      size_t m_Numbers;   // Number of those values that were numeric.
+      double m_Sum;
+      double m_Min;
+      double m_Max;
+   };
+
+   struct GroupTotals
+   {
+      std::vector<std::wstring> m_Keys;
+      std::vector<Totals> m_Totals;
+   };
+
+   // Groups by their keys joined into one string.
+   typedef std::unordered_map<std::wstring, GroupTotals> GroupMap;
+
+   std::wstring m_RecordName;
+   std::vector<std::wstring> m_Fields;   // The key paths, then the other paths used.
+   size_t m_NumKeys;
+   std::vector<Spec> m_Specs;
+   GroupMap m_Groups;
+   std::wstring m_ErrorInfo;
+
+   // Internal helper functions.  See nomxml.cpp for details.
+   void AddRecord(const std::vector<std::vector<std::wstring> > &fields);
+   static void AddTotals(Totals &totals, const Totals &more);
+};
+
+//---------------------------------------------------------------
+// Base class for receiving the pairs of records matched by
+// XmlHashJoin.
+//---------------------------------------------------------------
+class XmlJoinHandler
+{
+public:
+   XmlJoinHandler() { }
+   virtual ~XmlJoinHandler() { }
+
+   // Called for each record {build} from the build document and
+   // record {probe} from the probe document that share the same
+   // {key}.  Return false to stop joining.
+   virtual bool Match(const std::wstring &key, const XmlRecordSpan &build, const XmlRecordSpan &probe) = 0;
+};
+
+//---------------------------------------------------------------
+// Matches the records of two XML documents that have equal keys,
+// such as features in two files that refer to the same "gml:id".
+// The records of the smaller document, the build side, are read
+// first into a hash table of each record's key and location.
+// The records of the other document, the probe side, are then
+// read one at a time and looked up in the table.  Keys are named
+// by field paths as with XmlRecordReader, and records without
+// the key field are never matched.
+//
+// If the build side's table grows past the memory limit, it is
+// spilled into temporary partition files by the hash of each
+// key, and the probe side is partitioned the same way while it
+// is read.  Each pair of partitions is then joined in turn, so
+// matches are reported grouped by partition rather than in the
+// probe document's order.
+//---------------------------------------------------------------
+class XmlHashJoin
+{
+public:
+   // Construction, allowing about {maxbytes} bytes for the table.
+   explicit XmlHashJoin(size_t maxbytes = 64 * 1024 * 1024);
+   ~XmlHashJoin();
+
+   // Read the records named {recordname} from the remainder of the
+   // document being parsed by {xml} into the table, keyed by the
+   // field {keypath}.  Returns false if error.
+   //
+   bool Build(XmlParser &xml, const wchar_t *recordname, const wchar_t *keypath);
+
+   // Read the records named {recordname} from the remainder of the
+   // document being parsed by {xml}, passing each one whose field
+   // {keypath} matches records in the table to {handler}.  The
+   // build records sharing a key are passed in document order.
+   // Returns false if error or if {handler} stopped the join.
+   //
+   bool Probe(XmlParser &xml, const wchar_t *recordname, const wchar_t *keypath, XmlJoinHandler &handler);
+
+   // Retrieve a description of the most recent error into {errorinfo}.
+   // If no error, {errorinfo} will be empty string.
+   //
+   void ErrorInfo(std::wstring &errorinfo) const { errorinfo = m_ErrorInfo; }
+
+private:
+   typedef std::unordered_map<std::wstring, std::vector<XmlRecordSpan> > Table;
+
+   size_t m_MaxBytes;
+   size_t m_Bytes;             // Approximate size of m_Table.
+   Table m_Table;
+   std::vector<FILE *> m_BuildParts;   // Partition files, or empty if not spilled.
+   std::wstring m_ErrorInfo;
+
+   // Non-copyable.
+   XmlHashJoin(const XmlHashJoin &copy);
+   XmlHashJoin & operator=(const XmlHashJoin &copy);
+
+   // Internal helper functions.  See nomxml.cpp for details.
+   void AddToTable(const std::wstring &key, const XmlRecordSpan &span);
+   bool Spill(void);
+   bool MatchKey(const std::wstring &key, const XmlRecordSpan &probe, XmlJoinHandler &handler);
+   static bool WriteEntry(FILE *fp, const std::wstring &key, const XmlRecordSpan &span);
+   static bool ReadEntry(FILE *fp, std::wstring &key, XmlRecordSpan &span);
+};
+
+//---------------------------------------------------------------
+// One condition of an XmlRouter rule.  {m_Path} names a field of
+// the document's root element as with XmlRecordReader, and the
+// condition holds if the first occurrence of that field has the
+// text {m_Value}, ignoring surrounding whitespace.
+//---------------------------------------------------------------
+struct XmlRouteCondition
+{
+   std::wstring m_Path;
+   std::wstring m_Value;
+};
+
+//---------------------------------------------------------------
+// Chooses where to send XML messages according to a list of
+// rules that test each message's root element name, attributes
+// and field values, such as in a message broker.
+//
+// The rules are tried in the order they were added, and the
+// first one whose conditions all hold gives the message's route.
+// The conditions are compiled into a table indexed by field
+// path, so each parsed node is checked only against the rules
+// that name its field.  Parsing stops as soon as the route is
+// certain:  once a rule has matched and every earlier rule has
+// failed.  Rules that only test the root element and its
+// attributes are thus decided by the root's begin tag, usually
+// within the first hundred or so bytes of the message.  A rule
+// waiting on a field the message doesn't have fails when the
+// root element ends.
+//
+// Once the rules are added, Route and RouteAll may be called from
+// any number of threads at the same time.
+//---------------------------------------------------------------
+class XmlRouter
+{
+public:
+   XmlRouter() { }
+
+   // Add a rule that sends messages whose root element is named
+   // {rootname}, or any root element if {rootname} is empty, and
+   // that meet all of {conditions}, to {route}.
+   //
+   void AddRule(const std::wstring &route, const std::wstring &rootname,
+                const std::vector<XmlRouteCondition> &conditions);
+
+   // Set the route for messages that match none of the rules.
+   // The default route is empty.
+   //
+   void SetDefaultRoute(const std::wstring &route) { m_DefaultRoute = route; }
+
+   // Parse just enough of the document being parsed by {xml} to
+   // choose its route, retrieving the route into {route}.
+   // Returns false if error before the route could be chosen.
+   //
+   bool Route(XmlParser &xml, std::wstring &route) const;
+
+   // Route each of the messages in {messages} on a pool of
+   // {numthreads} threads, storing the route of each message in
+   // the corresponding entry of {routes}.  The route of a message
+   // that couldn't be parsed far enough is {errorroute}.
+   //
+   void RouteAll(const std::vector<std::vector<char> > &messages, size_t numthreads,
+                 const std::wstring &errorroute, std::vector<std::wstring> &routes) const;
+
+private:
+   struct Rule
+   {
+      std::wstring m_Route;
+      std::wstring m_RootName;
+      size_t m_NumConditions;
+   };
+
+   // One condition as stored in the table of conditions by path.
+   struct Test
+   {
+      size_t m_Rule;
+      std::wstring m_Value;
+   };
+
+   std::vector<Rule> m_Rules;
+   std::unordered_map<std::wstring, std::vector<Test> > m_Tests;
+   std::wstring m_DefaultRoute;
+
+   // State of each rule while routing one message.
+   typedef enum { RuleState_Undecided, RuleState_Matched, RuleState_Failed } RuleState;
+
+   // Internal helper functions.  See nomxml.cpp for details.
+   void ApplyField(const std::wstring &path, const std::wstring &value, std::vector<RuleState> &states,
+                   std::vector<size_t> &remaining, std::vector<std::wstring> &seen) const;
+   bool Decide(const std::vector<RuleState> &states, std::wstring &route) const;
+};
+
+//---------------------------------------------------------------
+// Outcome of a document parsed by an XmlParsePool.
+//---------------------------------------------------------------
+struct XmlParseResult
+{
+   bool m_Success;              // True if the whole document was parsed.
+   std::wstring m_ErrorInfo;    // Description of the error, if not.
+   size_t m_NumNodes;           // Number of nodes passed to the handler.
+};
+
+//---------------------------------------------------------------
+// A document submitted to an XmlParsePool.  {m_Result} becomes
+// ready when the pool has finished with the document, and
+// setting {m_Cancel} to true makes the pool stop parsing it.
+//---------------------------------------------------------------
+struct XmlParseJob
+{
+   XmlParseJob() : m_Cancel(false) { }
+
+   std::shared_future<XmlParseResult> m_Result;
+   std::atomic<bool> m_Cancel;
+};
+
+//---------------------------------------------------------------
+// Parses documents on a fixed set of worker threads, such as for
+// a server that handles requests containing XML.  Each document
+// is submitted as a job, which the first idle worker parses with
+// the parser it keeps for reuse, passing the nodes to a handler.
+// A job may be cancelled at any time, and may be given a time
+// limit counted from when it was submitted, so that a document
+// that is too large or arrives too slowly can't tie up a worker.
+// Both are checked while parsing every {checkbytes} bytes, as
+// with XmlParser::SetLimits, and a job still waiting in the queue
+// when either happens ends without being parsed at all.
+//
+// Submitting jobs may be done from any number of threads at once.
+//---------------------------------------------------------------
+class XmlParsePool
+{
+public:
+   // Construction, starting {numthreads} worker threads.
+   explicit XmlParsePool(size_t numthreads, size_t checkbytes = 64 * 1024);
+
+   // Cancels the jobs still waiting in the queue, and waits for the
+   // workers to finish the jobs they are parsing.
+   ~XmlParsePool();
+
+   // Submit the XML document contained in the memory block pointed
+   // to by {data}, {numbytes} in size, to be parsed with each node
+   // passed to {handler}.  The job fails if it isn't finished within
+   // {timeoutms} milliseconds, unless {timeoutms} is zero.  The
+   // memory block and the handler must stay put until the job's
+   // result is ready.
+   //
+   std::shared_ptr<XmlParseJob> ParseMemory(const void *data, size_t numbytes, XmlParseHandler &handler,
+                                            unsigned timeoutms = 0);
+
+   // Submit the XML document contained in file {filename}, as above.
+   std::shared_ptr<XmlParseJob> ParseFile(const wchar_t *filename, XmlParseHandler &handler,
+                                          unsigned timeoutms = 0);
+
+private:
+   // A job waiting in the queue.
+   struct Task
+   {
+      std::shared_ptr<XmlParseJob> m_Job;
+      std::promise<XmlParseResult> m_Promise;
+      const void *m_Data;                 // Document in memory, or nullptr.
+      size_t m_NumBytes;
+      std::wstring m_Filename;            // Document file, if m_Data is nullptr.
+      XmlParseHandler *m_Handler;
+      std::chrono::steady_clock::time_point m_Deadline;
+   };
+
+   size_t m_CheckBytes;
+   std::vector<std::thread> m_Threads;
+   std::deque<Task> m_Queue;
+   std::mutex m_Mutex;
+   std::condition_variable m_Wakeup;
+   bool m_Stopping;
+
+   // Non-copyable.
+   XmlParsePool(const XmlParsePool &copy);
+   XmlParsePool & operator=(const XmlParsePool &copy);
+
+   // Internal helper functions.  See nomxml.cpp for details.
+   std::shared_ptr<XmlParseJob> Submit(Task &task, XmlParseHandler &handler, unsigned timeoutms);
+   void Work(void);
+   void Run(XmlParser &xml, Task &task, XmlParseResult &result);
+};
+
+//---------------------------------------------------------------
+// Returns the 64-bit FNV-1a hash of {name}.  Evaluated at compile
+// time when {name} is a constant, so that bindings made with
+// NOMXML_BINDING dispatch on parsed names without comparing any
+// strings.
+//---------------------------------------------------------------
+constexpr uint64_t XmlNameHash(const wchar_t *name, uint64_t hash = 14695981039346656037ULL)
+{
+   return (*name == 0) ? hash : XmlNameHash(name + 1, (hash ^ static_cast<uint64_t>(*name)) * 1099511628211ULL);
+}
+
+//---------------------------------------------------------------
+// Convert the text {text} of a bound field to the type of the
+// struct member {value}.  Numbers may have surrounding
+// whitespace.  Booleans are "true", "false", "1" or "0".  For a
+// vector member, each occurrence of the field is converted and
+// appended.  Returns false if {text} can't be converted.
+//---------------------------------------------------------------
+bool XmlConvertValue(const std::wstring &text, std::wstring &value);
+bool XmlConvertValue(const std::wstring &text, double &value);
+bool XmlConvertValue(const std::wstring &text, float &value);
+bool XmlConvertValue(const std::wstring &text, int &value);
+bool XmlConvertValue(const std::wstring &text, unsigned &value);
+bool XmlConvertValue(const std::wstring &text, long long &value);
+bool XmlConvertValue(const std::wstring &text, bool &value);
+
+template <class T>
+bool XmlConvertValue(const std::wstring &text, std::vector<T> &values)
+{
+   T value = T();
+   if (!XmlConvertValue(text, value))
+      return false;
+   values.push_back(value);
+   return true;
+}
+
+//---------------------------------------------------------------
+// Describes how one field of a record fills one member of the
+// struct {T}.  Made by NOMXML_FIELD.
+//---------------------------------------------------------------
+template <class T>
+struct XmlBindField
+{
+   uint64_t m_Hash;           // XmlNameHash of m_Path.
+   const wchar_t *m_Path;     // Path of the field, as with XmlRecordReader.
+   bool (*m_Set)(T &record, const std::wstring &text);
+};
+
+// Stores {text} into the member {Member} of {record}.
+template <class T, class F, F T::*Member>
+bool XmlSetField(T &record, const std::wstring &text)
+{
+   return XmlConvertValue(text, record.*Member);
+}
+
+// Describes how records fill the struct {T}.  Specialized for
+// each bound struct by NOMXML_BINDING.
+template <class T>
+struct XmlBinding;
+
+//---------------------------------------------------------------
+// Describe how the records named {recordname} fill the struct
+// {type}, giving one NOMXML_FIELD for each member to be filled.
+// Use at global scope, after the struct is defined.  The hash of
+// each field's path is computed at compile time.  For example:
+//
+//    struct Placemark
+//    {
+//       std::wstring name;
+//       std::wstring coords;
+//       std::wstring id;
+//       std::vector<double> values;
+//    };
+//
+//    NOMXML_BINDING(Placemark, L"Placemark",
+//       NOMXML_FIELD(Placemark, name, L"name"),
+//       NOMXML_FIELD(Placemark, coords, L"Point/coordinates"),
+//       NOMXML_FIELD(Placemark, id, L"@id"),
+//       NOMXML_FIELD(Placemark, values, L"ExtendedData/Data/value"))
+//---------------------------------------------------------------
+#define NOMXML_FIELD(type, member, path) \
+   { std::integral_constant<uint64_t, nomxml::XmlNameHash(path)>::value, path, \
+     &nomxml::XmlSetField<type, decltype(type::member), &type::member> }
+
+#define NOMXML_BINDING(type, recordname, ...) \
+   namespace nomxml { \
+   template <> \
+   struct XmlBinding<type> \
+   { \
+      static const wchar_t *RecordName(void) { return recordname; } \
+      static const XmlBindField<type> *Fields(size_t &count) \
+      { \
+         static const XmlBindField<type> fields[] = { __VA_ARGS__ }; \
+         count = sizeof(fields) / sizeof(fields[0]); \
+         return fields; \
+      } \
+   }; \
+   }
+
+//---------------------------------------------------------------
+// The part of XmlBinder that doesn't depend on the bound struct.
+// The fields are found through a perfect hash of their path
+// hashes, built when the binder is constructed, so each parsed
+// node costs one table lookup and no string comparisons.
+//---------------------------------------------------------------
+class XmlBinderBase
+{
+public:
+   // Retrieve a description of the most recent error into {errorinfo}.
+   // If no error, {errorinfo} will be empty string.
+   //
+   void ErrorInfo(std::wstring &errorinfo) const { errorinfo = m_ErrorInfo; }
+
+protected:
+   // Stores {text} into field number {field} of {record}.
+   typedef bool (*SetFunction)(void *record, size_t field, const std::wstring &text);
+
+   XmlBinderBase(XmlParser &xml, const wchar_t *recordname, const std::vector<uint64_t> &hashes,
+                 const std::vector<const wchar_t *> &paths);
+
+   // Fill {record} from the next record, using {set}.
+   // Returns false if error or no more records.
+   bool NextRecord(void *record, SetFunction set);
+
+private:
+   XmlParser &m_Xml;
+   uint64_t m_RecordHash;
+   std::vector<uint64_t> m_Hashes;
+   std::vector<const wchar_t *> m_Paths;
+   std::vector<size_t> m_Slots;     // Field number in each slot, or m_Hashes.size() if empty.
+   uint64_t m_SlotMask;
+   unsigned m_SlotShift;
+   std::wstring m_ErrorInfo;
+
+   // Non-copyable.
+   XmlBinderBase(const XmlBinderBase &copy);
+   XmlBinderBase & operator=(const XmlBinderBase &copy);
+
+   // Internal helper functions.  See nomxml.cpp for details.
+   bool SetField(void *record, SetFunction set, uint64_t hash, const std::wstring &text);
+};
+
+//---------------------------------------------------------------
+// Reads the records of an XML document one at a time directly
+// into the struct {T}, which must have been described with
+// NOMXML_BINDING.  No tree is built.  Each occurrence of a field
+// is converted to its member's type and stored, so the last
+// occurrence wins except for vector members.  Members whose
+// fields aren't in the record are left unchanged.
+//---------------------------------------------------------------
+template <class T>
+class XmlBinder : public XmlBinderBase
+{
+public:
+   // Read the records from the remainder of the document being
+   // parsed by {xml}.
+   explicit XmlBinder(XmlParser &xml) :
+      XmlBinderBase(xml, XmlBinding<T>::RecordName(), Hashes(), Paths())
+   {
+   }
+
+   // Fill {record} from the next record.
+   // Returns false if error or no more records.
+   bool Next(T &record) { return NextRecord(&record, &Set); }
+
+private:
+   static std::vector<uint64_t> Hashes(void)
+   {
+      size_t count = 0;
+      const XmlBindField<T> *fields = XmlBinding<T>::Fields(count);
+      std::vector<uint64_t> hashes;
+      for (size_t index = 0; index < count; ++index)
+         hashes.push_back(fields[index].m_Hash);
+      return hashes;
+   }
+
+   static std::vector<const wchar_t *> Paths(void)
+   {
+      size_t count = 0;
+      const XmlBindField<T> *fields = XmlBinding<T>::Fields(count);
+      std::vector<const wchar_t *> paths;
+      for (size_t index = 0; index < count; ++index)
+         paths.push_back(fields[index].m_Path);
+      return paths;
+   }
+
+   static bool Set(void *record, size_t field, const std::wstring &text)
+   {
+      size_t count = 0;
+      return XmlBinding<T>::Fields(count)[field].m_Set(*static_cast<T *>(record), text);
+   }
 };
 
 }  // End namespace nomxml
@@ -33,3 +33,29 @@ xmldump testdata\sx99sw.gml > sx99sw.gml.out
 
 :skip_large
 
+rem #### Find the last records past literal comment and CDATA closers ####
+xmldump testdata\arrows_text.xml last Placemark 2 > arrows_text.xml.last.out
+xmldump testdata\arrows_attrib.xml last Placemark 2 > arrows_attrib.xml.last.out
+
+rem #### Check the vectorized kernels against the scalar versions ####
+if exist simd_verify.out del simd_verify.out
+for %%f in (testdata\*.kml testdata\*.xml testdata\*.gml) do xmldump %%f verify >> simd_verify.out
+
+rem #### Digest the canonical form of every file ####
+if exist c14n.out del c14n.out
+for %%f in (testdata\*.kml testdata\*.xml testdata\*.gml) do xmldump %%f sha256 >> c14n.out
+
+rem #### Check that parse deadlines and cancellation stop huge nodes ####
+xmldump testdata\note.xml limits > limits.out
+
+rem #### Check that reparsing edits matches parsing afresh ####
+xmldump testdata\books.xml reparse > reparse.out
+
+rem #### Time reading a frozen document on 1 to 4 threads ####
+xmldump testdata\Google_Earth_Community.kml frozen 4 > frozen.out
+
+rem #### Time parsing every file with the table lexer and the baseline lexer ####
+if exist bench.out del bench.out
+for %%f in (testdata\*.kml testdata\*.xml testdata\*.gml) do xmldump %%f bench >> bench.out
+for %%f in (testdata\*.kml testdata\*.xml testdata\*.gml) do xmldump_baseline %%f bench >> bench.out
+
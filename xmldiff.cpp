@@ -0,0 +1,400 @@
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// xmldiff.cpp -- Source code example for using the NomXML library.
+//                This program compares the records of two XML files and
+//                reports which records were inserted, deleted, or
+//                modified.
+//
+// NomXML is a small, minimalist C++ library for extracting tags and data
+// from XML documents.  I wrote this for use in my own educational and
+// experimental programs, but you may also freely use it in yours as long
+// as you abide by the following terms and conditions.
+//
+// (C) Copyright 2008,2015 by Ammon R. Campbell.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * The names of the authors and contributors may not be used to endorse
+//       or promote products derived from this software without specific
+//       prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// A "record" is any element with the tag name given on the command line,
+// such as "gml:featureMember" or "Placemark".  Records are matched between
+// the two files by the value of a key attribute, such as "gml:id".  The
+// parser reduces each record's contents to a 64-bit fingerprint while it
+// is being parsed, so only the key, fingerprint, and byte range of each record are
+// ever kept in memory.
+//
+// If both files list their records in ascending key order, the two files
+// are walked in lockstep and memory use stays constant no matter how big
+// the files are.  Otherwise, pass the "unsorted" option.  The record
+// summaries from both files are then spilled into a set of temporary
+// partition files by key hash, and the partitions are compared one at a
+// time.  Either way, records that share a key are paired in the order
+// they appear in each file.
+//
+// The output looks something like this:
+//
+//    DELETE 'id17', old offset=1023, length=310
+//    INSERT 'id42', new offset=5810, length=298
+//    MODIFY 'id43', old offset=1333, length=290, new offset=6108, length=301
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+#include "nomxml.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <deque>
+#include <unordered_map>
+
+// Number of temporary files used when comparing unsorted files.
+const size_t numPartitions = 64;
+
+//--------------------------------------------------------------------
+// Summary of one record from an XML file.
+//--------------------------------------------------------------------
+struct RecordSummary
+{
+   std::wstring m_Key;     // Value of the record's key attribute.
+   uint64_t m_Hash;        // Fingerprint of the record's contents.
+   size_t m_Offset;        // Byte offset of the record's begin tag.
+   size_t m_Length;        // Length of the record in bytes.
+
+   RecordSummary() : m_Hash(0), m_Offset(0), m_Length(0) { }
+};
+
+//--------------------------------------------------------------------
+// Reads the records from an XML file one at a time.  The record
+// fingerprints are computed by the parser.
+//--------------------------------------------------------------------
+class RecordReader
+{
+public:
+   RecordReader(nomxml::XmlParser &xml, const wchar_t *recordname, const wchar_t *keyattr) :
+      m_Xml(xml), m_RecordName(recordname), m_KeyAttr(keyattr)
+   {
+      m_Xml.EnableFingerprints(true);
+   }
+
+   // Retrieve the summary of the next record into {record}.
+   // Returns false if error or no more records.
+   bool Next(RecordSummary &record)
+   {
+      bool inrecord = false;
+      size_t recorddepth = 0;
+      std::unique_ptr<nomxml::XmlNodeBase> node;
+
+      while (m_Xml.NextNode(node))
+      {
+         if (!inrecord)
+         {
+            // Skip everything until the next record begins.
+            if (node->m_Type != nomxml::XmlNodeBase::XmlNodeType_Begin || node->m_Name != m_RecordName)
+               continue;
+
+            const nomxml::XmlBeginNode *p = static_cast<const nomxml::XmlBeginNode *>(node.get());
+            record = RecordSummary();
+            record.m_Offset = p->m_Offset;
+            for (auto attribp = p->m_Attribs.begin(); attribp != p->m_Attribs.end(); ++attribp)
+               if (attribp->m_Name == m_KeyAttr)
+                  record.m_Key = attribp->m_Value;
+            inrecord = true;
+            recorddepth = p->m_Depth;
+         }
+         else if (node->m_Type == nomxml::XmlNodeBase::XmlNodeType_End && node->m_Depth == recorddepth)
+         {
+            const nomxml::XmlEndNode *p = static_cast<const nomxml::XmlEndNode *>(node.get());
+            record.m_Hash = p->m_Hash;
+            record.m_Length = p->m_Offset - record.m_Offset;
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+private:
+   nomxml::XmlParser &m_Xml;
+   std::wstring m_RecordName;
+   std::wstring m_KeyAttr;
+
+   RecordReader & operator=(const RecordReader &);
+};
+
+//--------------------------------------------------------------------
+// Output a line describing one difference between the files.
+// Either {oldrec} or {newrec} may be nullptr.
+//--------------------------------------------------------------------
+static void ReportDifference(const RecordSummary *oldrec, const RecordSummary *newrec)
+{
+   if (oldrec && newrec)
+   {
+      wprintf(L"MODIFY '%s', old offset=%Iu, length=%Iu, new offset=%Iu, length=%Iu\n",
+              oldrec->m_Key.c_str(), oldrec->m_Offset, oldrec->m_Length, newrec->m_Offset, newrec->m_Length);
+   }
+   else if (oldrec)
+   {
+      wprintf(L"DELETE '%s', old offset=%Iu, length=%Iu\n", oldrec->m_Key.c_str(), oldrec->m_Offset, oldrec->m_Length);
+   }
+   else if (newrec)
+   {
+      wprintf(L"INSERT '%s', new offset=%Iu, length=%Iu\n", newrec->m_Key.c_str(), newrec->m_Offset, newrec->m_Length);
+   }
+}
+
+//--------------------------------------------------------------------
+// Output an error message for the given parser, if it has one.
+// Returns true if there was an error.
+//--------------------------------------------------------------------
+static bool ReportParseError(nomxml::XmlParser &xml, const wchar_t *filename)
+{
+   std::wstring errtext;
+   xml.ErrorInfo(errtext);
+   if (errtext.empty())
+      return false;
+   wprintf(L"Error in file '%s':  %s\n", filename, errtext.c_str());
+   wprintf(L"Near offset:  %Iu\n", xml.CurPosition());
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Compare two files whose records are in ascending key order by
+// walking both in lockstep.  Returns true if successful.
+//--------------------------------------------------------------------
+static bool DiffSorted(nomxml::XmlParser &oldxml, nomxml::XmlParser &newxml,
+                       const wchar_t *recordname, const wchar_t *keyattr)
+{
+   RecordReader oldreader(oldxml, recordname, keyattr);
+   RecordReader newreader(newxml, recordname, keyattr);
+   RecordSummary oldrec, newrec;
+   bool haveold = oldreader.Next(oldrec);
+   bool havenew = newreader.Next(newrec);
+   std::wstring lastold, lastnew;
+
+   while (haveold || havenew)
+   {
+      if ((haveold && oldrec.m_Key < lastold) || (havenew && newrec.m_Key < lastnew))
+      {
+         wprintf(L"Records are not sorted by key near '%s'; use the 'unsorted' option.\n",
+                 (haveold && oldrec.m_Key < lastold) ? oldrec.m_Key.c_str() : newrec.m_Key.c_str());
+         return false;
+      }
+
+      if (haveold && (!havenew || oldrec.m_Key < newrec.m_Key))
+      {
+         ReportDifference(&oldrec, nullptr);
+         lastold = oldrec.m_Key;
+         haveold = oldreader.Next(oldrec);
+      }
+      else if (havenew && (!haveold || newrec.m_Key < oldrec.m_Key))
+      {
+         ReportDifference(nullptr, &newrec);
+         lastnew = newrec.m_Key;
+         havenew = newreader.Next(newrec);
+      }
+      else
+      {
+         if (oldrec.m_Hash != newrec.m_Hash)
+            ReportDifference(&oldrec, &newrec);
+         lastold = oldrec.m_Key;
+         lastnew = newrec.m_Key;
+         haveold = oldreader.Next(oldrec);
+         havenew = newreader.Next(newrec);
+      }
+   }
+
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Write {record} to temporary file {fp}.  Returns true if successful.
+//--------------------------------------------------------------------
+static bool WriteSummary(FILE *fp, const RecordSummary &record)
+{
+   size_t keylen = record.m_Key.size();
+   return fwrite(&keylen, sizeof(keylen), 1, fp) == 1 &&
+          (keylen == 0 || fwrite(record.m_Key.data(), sizeof(wchar_t), keylen, fp) == keylen) &&
+          fwrite(&record.m_Hash, sizeof(record.m_Hash), 1, fp) == 1 &&
+          fwrite(&record.m_Offset, sizeof(record.m_Offset), 1, fp) == 1 &&
+          fwrite(&record.m_Length, sizeof(record.m_Length), 1, fp) == 1;
+}
+
+//--------------------------------------------------------------------
+// Read the next record summary from temporary file {fp} into
+// {record}.  Returns false if error or no more summaries.
+//--------------------------------------------------------------------
+static bool ReadSummary(FILE *fp, RecordSummary &record)
+{
+   size_t keylen = 0;
+   if (fread(&keylen, sizeof(keylen), 1, fp) != 1)
+      return false;
+   record.m_Key.resize(keylen);
+   return (keylen == 0 || fread(&record.m_Key[0], sizeof(wchar_t), keylen, fp) == keylen) &&
+          fread(&record.m_Hash, sizeof(record.m_Hash), 1, fp) == 1 &&
+          fread(&record.m_Offset, sizeof(record.m_Offset), 1, fp) == 1 &&
+          fread(&record.m_Length, sizeof(record.m_Length), 1, fp) == 1;
+}
+
+//--------------------------------------------------------------------
+// Spill the summaries of all records read by {reader} into the
+// temporary files {parts}, choosing the file by the hash of the
+// record's key.  Returns true if successful.
+//--------------------------------------------------------------------
+static bool SpillRecords(RecordReader &reader, std::vector<FILE *> &parts)
+{
+   std::hash<std::wstring> hasher;
+   RecordSummary record;
+   while (reader.Next(record))
+   {
+      if (!WriteSummary(parts[hasher(record.m_Key) % parts.size()], record))
+      {
+         wprintf(L"Failed writing temporary file.\n");
+         return false;
+      }
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Compare two files whose records may be in any order.  Memory use
+// is limited to the summaries of one partition of the old file at a
+// time.  Returns true if successful.
+//--------------------------------------------------------------------
+static bool DiffUnsorted(nomxml::XmlParser &oldxml, const wchar_t *oldname,
+                         nomxml::XmlParser &newxml, const wchar_t *newname,
+                         const wchar_t *recordname, const wchar_t *keyattr)
+{
+   std::vector<FILE *> oldparts, newparts;
+   bool ok = true;
+   for (size_t index = 0; index < numPartitions && ok; ++index)
+   {
+      FILE *fpold = tmpfile();
+      FILE *fpnew = tmpfile();
+      if (fpold)
+         oldparts.push_back(fpold);
+      if (fpnew)
+         newparts.push_back(fpnew);
+      if (!fpold || !fpnew)
+      {
+         wprintf(L"Failed creating temporary file.\n");
+         ok = false;
+      }
+   }
+
+   if (ok)
+   {
+      RecordReader oldreader(oldxml, recordname, keyattr);
+      RecordReader newreader(newxml, recordname, keyattr);
+      ok = SpillRecords(oldreader, oldparts) && !ReportParseError(oldxml, oldname) &&
+           SpillRecords(newreader, newparts) && !ReportParseError(newxml, newname);
+   }
+
+   for (size_t index = 0; index < oldparts.size() && index < newparts.size() && ok; ++index)
+   {
+      // Load this partition of the old file, then match the new
+      // file's records from the same partition against it.  Records
+      // were spilled in document order, so the old records with each
+      // key are queued in the order they appear.
+      std::unordered_map<std::wstring, std::deque<RecordSummary>> oldrecs;
+      RecordSummary record;
+      rewind(oldparts[index]);
+      while (ReadSummary(oldparts[index], record))
+         oldrecs[record.m_Key].push_back(record);
+
+      rewind(newparts[index]);
+      while (ReadSummary(newparts[index], record))
+      {
+         auto iter = oldrecs.find(record.m_Key);
+         if (iter == oldrecs.end())
+         {
+            ReportDifference(nullptr, &record);
+            continue;
+         }
+         const RecordSummary &oldrec = iter->second.front();
+         if (oldrec.m_Hash != record.m_Hash)
+            ReportDifference(&oldrec, &record);
+         iter->second.pop_front();
+         if (iter->second.empty())
+            oldrecs.erase(iter);
+      }
+
+      for (auto iter = oldrecs.begin(); iter != oldrecs.end(); ++iter)
+         for (auto recp = iter->second.begin(); recp != iter->second.end(); ++recp)
+            ReportDifference(&*recp, nullptr);
+   }
+
+   for (auto fpp = oldparts.begin(); fpp != oldparts.end(); ++fpp)
+      fclose(*fpp);
+   for (auto fpp = newparts.begin(); fpp != newparts.end(); ++fpp)
+      fclose(*fpp);
+
+   return ok;
+}
+
+//--------------------------------------------------------------------
+// Program entry point.  Takes standard args from the command line and
+// returns EXIT_SUCCESS if no errors.
+//--------------------------------------------------------------------
+int wmain(int argc, wchar_t **argv)
+{
+   if (argc < 5 || argc > 6 || (argc == 6 && _wcsicmp(argv[5], L"unsorted") != 0))
+   {
+      // The user needs command line help.
+      wprintf(L"Usage:  xmldiff old.xml new.xml recordname keyattrib [unsorted]\n");
+      return EXIT_FAILURE;
+   }
+
+   const wchar_t *oldname = argv[1];
+   const wchar_t *newname = argv[2];
+   const wchar_t *recordname = argv[3];
+   const wchar_t *keyattr = argv[4];
+   bool unsorted = (argc == 6);
+
+   try
+   {
+      nomxml::XmlParser oldxml, newxml;
+      if (!oldxml.BeginParsingFromFile(oldname))
+      {
+         wprintf(L"Failed to begin parsing file:  %s\n", oldname);
+         return EXIT_FAILURE;
+      }
+      if (!newxml.BeginParsingFromFile(newname))
+      {
+         wprintf(L"Failed to begin parsing file:  %s\n", newname);
+         return EXIT_FAILURE;
+      }
+
+      bool ok = unsorted ? DiffUnsorted(oldxml, oldname, newxml, newname, recordname, keyattr)
+                         : DiffSorted(oldxml, newxml, recordname, keyattr);
+      if (!ok || ReportParseError(oldxml, oldname) || ReportParseError(newxml, newname))
+      {
+         wprintf(L"Terminating with error.\n");
+         return EXIT_FAILURE;
+      }
+   }
+   catch(...)
+   {
+      wprintf(L"Exception!  Sorry, something bad happened and XmlDiff has to shut down.\n");
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
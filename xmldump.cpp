@@ -73,6 +73,11 @@
 #include "nomxml.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 //--------------------------------------------------------------------
 // Indent the given number of tabular levels to the console.
@@ -85,12 +90,12 @@ static void indent(size_t level)
 }
 
 //--------------------------------------------------------------------
-// Parse XML using the given parser, sending the parsed information
-// to stdout.  Returns true if successful.
+// Parse XML using the given parser, such as an XmlParser, sending the parsed information to stdout.  Returns
+// true if successful.
 //--------------------------------------------------------------------
-bool parse(nomxml::XmlParser &xml)
+template <class Parser>
+bool parse(Parser &xml)
 {
-   size_t nestlevel = 1;
    std::unique_ptr<nomxml::XmlNodeBase> node(nullptr);
 
    while (xml.NextNode(node))
@@ -111,14 +116,13 @@ bool parse(nomxml::XmlParser &xml)
                printf("Node type said XmlNodeType_Begin but dynamic cast failed!\n");
                return false;
             }
-            indent(nestlevel);
+            indent(p->m_Depth + 1);
             wprintf(L"BEGIN '%s', offset=%Iu\n", p->m_Name.c_str(), p->m_Offset);
             for (size_t iter = 0; iter < p->m_Attribs.size(); ++iter)
             {
-               indent(nestlevel + 1);
+               indent(p->m_Depth + 2);
                wprintf(L"ATTRIBUTE %Iu:  '%s'='%s'\n", iter, p->m_Attribs[iter].m_Name.c_str(), p->m_Attribs[iter].m_Value.c_str());
             }
-            ++nestlevel;
             break;
          }
 
@@ -130,7 +134,7 @@ bool parse(nomxml::XmlParser &xml)
                printf("Node type said XmlNodeType_Value but dynamic cast failed!\n");
                return false;
             }
-            indent(nestlevel);
+            indent(p->m_Depth + 2);
             wprintf(L"NAME '%s', VALUE '%s'\n", p->m_Name.c_str(), p->m_Value.c_str());
             break;
          }
@@ -143,8 +147,7 @@ bool parse(nomxml::XmlParser &xml)
                printf("Node type said XmlNodeType_End but dynamic cast failed!\n");
                return false;
             }
-            --nestlevel;
-            indent(nestlevel);
+            indent(p->m_Depth + 1);
             wprintf(L"END '%s'\n", p->m_Name.c_str());
             break;
          }
@@ -167,6 +170,32 @@ bool parse(nomxml::XmlParser &xml)
    return true;
 }
 
+//--------------------------------------------------------------------
+// Lets parse() dump the byte nodes of an XmlByteParser, widening each
+// one as it's retrieved.
+//--------------------------------------------------------------------
+class ByteNodeReader
+{
+public:
+   explicit ByteNodeReader(nomxml::XmlByteParser &xml) : m_Xml(xml) { }
+
+   bool NextNode(std::unique_ptr<nomxml::XmlNodeBase> &ptrref)
+   {
+      ptrref.reset(nullptr);
+      if (!m_Xml.NextNode(m_Node))
+         return false;
+      m_Node.Widen(ptrref);
+      return true;
+   }
+
+   void ErrorInfo(std::wstring &errorinfo) { m_Xml.ErrorInfo(errorinfo); }
+   size_t CurPosition(void) { return m_Xml.CurPosition(); }
+
+private:
+   nomxml::XmlByteParser &m_Xml;
+   nomxml::XmlByteNode m_Node;
+};
+
 //--------------------------------------------------------------------
 // Interface object for reading characters from an XML file on disk.
 // This demonstrates how to hook up the XmlParser to caller-supplied
@@ -190,9 +219,8 @@ public:
    {
       if (!m_File)
          return 0;
-      fseek(m_File, 0, SEEK_END);
-      size_t length = ftell(m_File);
-      fseek(m_File, 0, SEEK_SET);
+      size_t length = nomxml::XmlFileLength(m_File);
+      nomxml::XmlSeekFile(m_File, 0);
       return length;
    }
 
@@ -202,7 +230,7 @@ public:
    {
       if (!m_File)
          return false;
-      return (fseek(m_File, static_cast<long>(offset), SEEK_SET) == 0);   // Zero indicates success.
+      return nomxml::XmlSeekFile(m_File, offset);
    }
 
    // Read the next character from the file.
@@ -253,8 +281,7 @@ std::vector<char> LoadFileToMemory(const wchar_t *filename)
       return buffer;
    }
 
-   fseek(fp, 0, SEEK_END);
-   size_t length = ftell(fp);
+   size_t length = nomxml::XmlFileLength(fp);
    if (length < 1)
    {
       wprintf(L"File is empty:  %s\n", filename);
@@ -272,8 +299,6 @@ std::vector<char> LoadFileToMemory(const wchar_t *filename)
       buffer.clear();
       return buffer;
    }
-   fseek(fp, 0, SEEK_SET);
-
    if (fread(buffer.data(), length, 1, fp) != 1)
    {
       wprintf(L"Failed reading data from file:  %s\n", filename);
@@ -285,16 +310,731 @@ std::vector<char> LoadFileToMemory(const wchar_t *filename)
    return buffer;
 }
 
+//--------------------------------------------------------------------
+// Split the comma separated list {text} into {items}.
+//--------------------------------------------------------------------
+static void splitList(const wchar_t *text, std::vector<std::wstring> &items)
+{
+   items.clear();
+   std::wstring item;
+   for (const wchar_t *p = text; ; ++p)
+   {
+      if (*p == ',' || *p == 0)
+      {
+         if (!item.empty())
+            items.push_back(item);
+         item.clear();
+         if (*p == 0)
+            break;
+      }
+      else
+      {
+         item += *p;
+      }
+   }
+}
+
+//--------------------------------------------------------------------
+// Aggregate the records named {recordname} in file {filename}, grouped
+// by the comma separated field paths in {keylist}, computing the comma
+// separated aggregates in {aggregatelist}, and output the groups.  The
+// file is divided into {numthreads} ranges of whole records, each
+// aggregated on its own thread, and the partial results are merged.
+// Returns true if successful.
+//--------------------------------------------------------------------
+static bool groupRecords(const wchar_t *filename, const wchar_t *recordname,
+                         const wchar_t *keylist, const wchar_t *aggregatelist, size_t numthreads)
+{
+   std::vector<std::wstring> keypaths;
+   std::vector<std::wstring> aggregates;
+   splitList(keylist, keypaths);
+   splitList(aggregatelist, aggregates);
+
+   std::wstring errorinfo;
+   std::vector<nomxml::XmlGroupBy> partials(numthreads);
+   for (auto iter = partials.begin(); iter != partials.end(); ++iter)
+   {
+      if (!iter->Configure(recordname, keypaths, aggregates))
+      {
+         iter->ErrorInfo(errorinfo);
+         wprintf(L"%s\n", errorinfo.c_str());
+         return false;
+      }
+   }
+
+   FILE *fp = nullptr;
+   if (_wfopen_s(&fp, filename, L"rb") || fp == nullptr)
+   {
+      wprintf(L"Failed opening file:  %s\n", filename);
+      return false;
+   }
+   size_t filelength = nomxml::XmlFileLength(fp);
+   fclose(fp);
+
+   // Each range after the first begins with the first record at or
+   // after an even division of the file.
+   nomxml::XmlParser xml;
+   if (!xml.BeginParsingFromFile(filename))
+   {
+      wprintf(L"Failed to begin parsing file:  %s\n", filename);
+      return false;
+   }
+   std::vector<size_t> bounds(1, 0);
+   for (size_t part = 1; part < numthreads; ++part)
+   {
+      nomxml::XmlRecordSpan span;
+      if (xml.FindNextRecord(recordname, filelength / numthreads * part, span) &&
+          span.m_Offset > bounds[bounds.size() - 1])
+         bounds.push_back(span.m_Offset);
+   }
+   bounds.push_back(filelength);
+   xml.Reset();
+
+   std::vector<std::thread> threads;
+   std::vector<char> results(bounds.size() - 1, false);
+   for (size_t part = 0; part + 1 < bounds.size(); ++part)
+   {
+      threads.push_back(std::thread([&, part]()
+      {
+         nomxml::XmlParser partxml;
+         results[part] = partxml.BeginParsingFromFile(filename) &&
+                         partxml.BeginParsingRange(bounds[part], bounds[part + 1], std::vector<nomxml::XmlBeginNode>()) &&
+                         partials[part].Aggregate(partxml);
+      }));
+   }
+   for (auto iter = threads.begin(); iter != threads.end(); ++iter)
+      iter->join();
+
+   for (size_t part = 0; part < results.size(); ++part)
+   {
+      if (!results[part])
+      {
+         partials[part].ErrorInfo(errorinfo);
+         wprintf(L"Failed aggregating file:  %s  %s\n", filename, errorinfo.c_str());
+         return false;
+      }
+      if (part > 0)
+         partials[0].Merge(partials[part]);
+   }
+
+   std::vector<nomxml::XmlGroupBy::Group> groups;
+   partials[0].Results(groups);
+   wprintf(L"BEGIN GROUPS OF FILE '%s'\n", filename);
+   for (auto group = groups.begin(); group != groups.end(); ++group)
+   {
+      wprintf(L"GROUP");
+      for (auto key = group->m_Keys.begin(); key != group->m_Keys.end(); ++key)
+         wprintf(L" '%s'", key->c_str());
+      for (size_t index = 0; index < aggregates.size(); ++index)
+      {
+         if (isnan(group->m_Results[index]))
+            wprintf(L", %s=none", aggregates[index].c_str());
+         else
+            wprintf(L", %s=%.15g", aggregates[index].c_str(), group->m_Results[index]);
+      }
+      wprintf(L"\n");
+   }
+   wprintf(L"END GROUPS OF FILE '%s'\n", filename);
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Parse the XML document in {data}, describing every node and any
+// error in {nodes}.
+//--------------------------------------------------------------------
+static void describeNodes(std::vector<char> &data, std::wstring &nodes)
+{
+   nomxml::XmlParser xml;
+   std::unique_ptr<nomxml::XmlNodeBase> node;
+
+   nodes.clear();
+   if (xml.BeginParsingFromMemory(data.data(), data.size()))
+   {
+      while (xml.NextNode(node))
+      {
+         nodes += std::to_wstring(node->m_Type);
+         nodes += L":";
+         nodes += node->m_Name;
+         if (node->m_Type == nomxml::XmlNodeBase::XmlNodeType_Begin)
+         {
+            const nomxml::XmlBeginNode *p = static_cast<const nomxml::XmlBeginNode *>(node.get());
+            nodes += L"@" + std::to_wstring(p->m_Offset);
+            for (auto attribp = p->m_Attribs.begin(); attribp != p->m_Attribs.end(); ++attribp)
+               nodes += L" " + attribp->m_Name + L"=" + attribp->m_Value;
+         }
+         else if (node->m_Type == nomxml::XmlNodeBase::XmlNodeType_Value)
+         {
+            nodes += L"=" + static_cast<const nomxml::XmlValueNode *>(node.get())->m_Value;
+         }
+         nodes += L"\n";
+      }
+   }
+
+   std::wstring errtext;
+   xml.ErrorInfo(errtext);
+   nodes += L"Error:  " + errtext + L" near offset " + std::to_wstring(xml.CurPosition());
+}
+
+//--------------------------------------------------------------------
+// Check that every version of the parser's vectorized kernels that
+// this CPU supports agrees with the scalar version on the file named
+// {filename}, both kernel by kernel and over a whole parse of the
+// file.  Returns true if they all agree.
+//--------------------------------------------------------------------
+static bool verifySimd(const wchar_t *filename)
+{
+   std::vector<char> data = LoadFileToMemory(filename);
+   if (data.empty())
+      return false;
+
+   std::wstring errtext;
+   if (!nomxml::XmlSimdVerify(data.data(), data.size(), errtext))
+   {
+      wprintf(L"Error:  %s\n", errtext.c_str());
+      return false;
+   }
+
+   std::vector<std::wstring> names;
+   nomxml::XmlSimdSupported(names);
+   std::wstring expected, nodes;
+   bool same = true;
+   for (auto namep = names.begin(); namep != names.end(); ++namep)
+   {
+      nomxml::XmlSimdForce(namep->c_str());
+      describeNodes(data, nodes);
+      if (namep == names.begin())
+         expected = nodes;
+      else if (nodes != expected)
+      {
+         wprintf(L"Error:  Parsing with the %s kernels differs from parsing with the scalar kernels.\n", namep->c_str());
+         same = false;
+      }
+   }
+   nomxml::XmlSimdForce(nullptr);
+
+   if (same)
+      wprintf(L"SIMD kernels verified on file '%s'\n", filename);
+   return same;
+}
+
+// Name of the lexer this program was built with, for telling the
+// results of the xmldump and xmldump_baseline builds apart.
+#ifdef NOMXML_BASELINE_LEXER
+const wchar_t lexerName[] = L"baseline";
+#else
+const wchar_t lexerName[] = L"table";
+#endif
+
+//--------------------------------------------------------------------
+// Time how fast the file named {filename} parses from memory with
+// each version of the parser's vectorized kernels, reporting the
+// results to stdout.  Comparing the results with those of the
+// xmldump_baseline build measures the lexer itself.  Returns true if
+// successful.
+//--------------------------------------------------------------------
+static bool benchParse(const wchar_t *filename)
+{
+   std::vector<char> data = LoadFileToMemory(filename);
+   if (data.empty())
+      return false;
+
+   // Parse the file enough times to take a measurable amount of time.
+   const size_t minbytes = 16 * 1024 * 1024;
+   const size_t passes = std::max<size_t>(1, minbytes / data.size());
+
+   std::vector<std::wstring> names;
+   nomxml::XmlSimdSupported(names);
+   for (auto namep = names.begin(); namep != names.end(); ++namep)
+   {
+      nomxml::XmlSimdForce(namep->c_str());
+
+      size_t numnodes = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t pass = 0; pass < passes; ++pass)
+      {
+         nomxml::XmlParser xml;
+         std::unique_ptr<nomxml::XmlNodeBase> node;
+         if (!xml.BeginParsingFromMemory(data.data(), data.size()))
+         {
+            wprintf(L"Failed to begin parsing file:  %s\n", filename);
+            nomxml::XmlSimdForce(nullptr);
+            return false;
+         }
+         while (xml.NextNode(node))
+            ++numnodes;
+      }
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      double megabytes = static_cast<double>(data.size()) * passes / (1024.0 * 1024.0);
+      wprintf(L"BENCH '%s' %s lexer, %s:  %Iu nodes, %.1f MB/s\n", filename, lexerName, namep->c_str(),
+              numnodes / passes, megabytes / std::max(elapsed.count(), 1e-9));
+   }
+   nomxml::XmlSimdForce(nullptr);
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Append the name of every element under {elm} to {names}.
+//--------------------------------------------------------------------
+static void collectNames(const nomxml::XmlElementTree &elm, std::vector<std::wstring> &names)
+{
+   for (auto childp = elm.m_Children.begin(); childp != elm.m_Children.end(); ++childp)
+   {
+      names.push_back(childp->m_Begin.m_Name);
+      collectNames(*childp, names);
+   }
+}
+
+//--------------------------------------------------------------------
+// Look up every element of {doc} by each of the {names}, reading each
+// element's value and attributes into {checksum}.  Returns the number
+// of elements read.
+//--------------------------------------------------------------------
+static size_t readFrozen(const nomxml::XmlFrozenDocument &doc, const std::vector<std::wstring> &names, size_t &checksum)
+{
+   std::vector<const nomxml::XmlElementTree *> elements;
+   size_t numread = 0;
+   for (auto namep = names.begin(); namep != names.end(); ++namep)
+   {
+      doc.FindElements(*namep, elements);
+      for (auto elmp = elements.begin(); elmp != elements.end(); ++elmp)
+      {
+         checksum += (*elmp)->m_Value.m_Value.size();
+         for (auto attribp = (*elmp)->m_Begin.m_Attribs.begin(); attribp != (*elmp)->m_Begin.m_Attribs.end(); ++attribp)
+            checksum += attribp->m_Value.size();
+      }
+      numread += elements.size();
+   }
+   return numread;
+}
+
+//--------------------------------------------------------------------
+// Time how fast the file named {filename} can be read once parsed into
+// an XmlFrozenDocument, on one thread and then on each number of
+// threads up to {maxthreads}, all reading the same document at once.
+// Reports the results to stdout.  Returns true if successful.
+//--------------------------------------------------------------------
+static bool benchFrozen(const wchar_t *filename, size_t maxthreads)
+{
+   nomxml::XmlParser xml;
+   nomxml::XmlElementTree root;
+   if (!xml.BeginParsingFromFile(filename) || !xml.ParseTree(root))
+   {
+      std::wstring errorinfo;
+      xml.ErrorInfo(errorinfo);
+      wprintf(L"Failed parsing file:  %s  %s\n", filename, errorinfo.c_str());
+      return false;
+   }
+
+   std::vector<std::wstring> names;
+   collectNames(root, names);
+   size_t numelements = names.size();
+   std::sort(names.begin(), names.end());
+   names.erase(std::unique(names.begin(), names.end()), names.end());
+   const nomxml::XmlFrozenDocument doc(std::move(root));
+
+   // Read the document once to build its index and learn what every
+   // reader should find, then enough times per thread to take a
+   // measurable amount of time.
+   size_t expected = 0;
+   readFrozen(doc, names, expected);
+   const size_t minelements = 4 * 1024 * 1024;
+   const size_t passes = std::max<size_t>(1, minelements / std::max<size_t>(numelements, 1));
+
+   double single = 0;
+   for (size_t numthreads = 1; numthreads <= maxthreads; ++numthreads)
+   {
+      std::vector<std::thread> threads;
+      std::vector<size_t> numread(numthreads, 0);
+      std::vector<char> agreed(numthreads, false);
+      auto start = std::chrono::steady_clock::now();
+      for (size_t part = 0; part < numthreads; ++part)
+      {
+         threads.push_back(std::thread([&, part]()
+         {
+            bool same = true;
+            for (size_t pass = 0; pass < passes; ++pass)
+            {
+               size_t checksum = 0;
+               numread[part] += readFrozen(doc, names, checksum);
+               same = same && checksum == expected;
+            }
+            agreed[part] = same;
+         }));
+      }
+      for (auto iter = threads.begin(); iter != threads.end(); ++iter)
+         iter->join();
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      size_t total = 0;
+      for (size_t part = 0; part < numthreads; ++part)
+      {
+         if (!agreed[part])
+         {
+            wprintf(L"FROZEN '%s' %Iu threads:  a reader saw different contents\n", filename, numthreads);
+            return false;
+         }
+         total += numread[part];
+      }
+
+      double rate = total / std::max(elapsed.count(), 1e-9) / 1e6;
+      if (numthreads == 1)
+         single = rate;
+      wprintf(L"FROZEN '%s' %Iu threads:  %.1f M elements/s, %.2fx\n", filename, numthreads,
+              rate, rate / std::max(single, 1e-9));
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Implements XmlStreamOutputInterface by writing to stdout.
+//--------------------------------------------------------------------
+class MyStdoutOutputInterface : public nomxml::XmlStreamOutputInterface
+{
+public:
+   // Write {length} bytes from {data} to stdout.
+   // Returns true if successful.
+   bool Write(const char *data, size_t length)
+   {
+      return fwrite(data, 1, length, stdout) == length;
+   }
+};
+
+//--------------------------------------------------------------------
+// Write the canonical form of the file named {filename} to stdout,
+// or if {hash} is true, output the SHA-256 digest of the canonical
+// form instead.  Since stdout carries the document itself when not
+// hashing, errors go to stderr.  Returns true if successful.
+//--------------------------------------------------------------------
+static bool canonicalize(const wchar_t *filename, bool hash)
+{
+   nomxml::XmlParser xml;
+   xml.KeepAllText(true);
+   if (!xml.BeginParsingFromFile(filename))
+   {
+      fwprintf(stderr, L"Failed to begin parsing file:  %s\n", filename);
+      return false;
+   }
+
+   MyStdoutOutputInterface out;
+   nomxml::XmlSha256 digest;
+   nomxml::XmlCanonicalWriter writer(hash ? static_cast<nomxml::XmlStreamOutputInterface &>(digest) : out);
+   std::unique_ptr<nomxml::XmlNodeBase> node;
+   std::wstring errorinfo;
+   while (xml.NextNode(node))
+   {
+      if (!writer.Write(*node))
+      {
+         writer.ErrorInfo(errorinfo);
+         fwprintf(stderr, L"Error:  %s\n", errorinfo.c_str());
+         return false;
+      }
+   }
+
+   xml.ErrorInfo(errorinfo);
+   if (!errorinfo.empty())
+   {
+      fwprintf(stderr, L"Error:  %s\n", errorinfo.c_str());
+      return false;
+   }
+   if (!writer.Finish())
+   {
+      writer.ErrorInfo(errorinfo);
+      fwprintf(stderr, L"Error:  %s\n", errorinfo.c_str());
+      return false;
+   }
+
+   if (hash)
+   {
+      std::wstring hex;
+      digest.Finish(hex);
+      wprintf(L"SHA256 %s  %s\n", hex.c_str(), filename);
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Append the {length} bytes at {text} to {wide} as Latin-1 characters.
+//--------------------------------------------------------------------
+static void widen(const char *text, size_t length, std::wstring &wide)
+{
+   for (size_t index = 0; index < length; ++index)
+      wide += static_cast<wchar_t>(static_cast<unsigned char>(text[index]));
+}
+
+//--------------------------------------------------------------------
+// Dump the file named {filename} like the "bytes" read mode does, but
+// retrieving the nodes a batch of events at a time.  Returns true if
+// successful.
+//--------------------------------------------------------------------
+static bool dumpEvents(const wchar_t *filename)
+{
+   nomxml::XmlByteParser xml;
+   if (!xml.BeginParsingFromFile(filename))
+   {
+      wprintf(L"Failed to begin parsing file:  %s\n", filename);
+      return false;
+   }
+
+   wprintf(L"BEGIN DUMP OF FILE '%s'\n", filename);
+   nomxml::XmlEventBatch batch;
+   std::wstring name, value;
+   size_t numattribs = 0;
+   while (xml.NextBatch(batch, 1024))
+   {
+      for (auto eventp = batch.m_Events.begin(); eventp != batch.m_Events.end(); ++eventp)
+      {
+         const std::string &bytename = batch.m_Names[eventp->m_NameId];
+         name.clear();
+         widen(bytename.data(), bytename.size(), name);
+         value.clear();
+         widen(batch.Text(*eventp), eventp->m_TextLength, value);
+
+         switch (eventp->m_Type)
+         {
+            case nomxml::XmlEvent::XmlEvent_Begin:
+               indent(eventp->m_Depth + 1);
+               wprintf(L"BEGIN '%s', offset=%Iu\n", name.c_str(), static_cast<size_t>(eventp->m_Offset));
+               numattribs = 0;
+               break;
+
+            case nomxml::XmlEvent::XmlEvent_Attribute:
+               indent(eventp->m_Depth + 2);
+               wprintf(L"ATTRIBUTE %Iu:  '%s'='%s'\n", numattribs++, name.c_str(), value.c_str());
+               break;
+
+            case nomxml::XmlEvent::XmlEvent_Value:
+               indent(eventp->m_Depth + 2);
+               wprintf(L"NAME '%s', VALUE '%s'\n", name.c_str(), value.c_str());
+               break;
+
+            case nomxml::XmlEvent::XmlEvent_End:
+               indent(eventp->m_Depth + 1);
+               wprintf(L"END '%s'\n", name.c_str());
+               break;
+         }
+      }
+   }
+
+   std::wstring errtext;
+   xml.ErrorInfo(errtext);
+   if (!errtext.empty())
+   {
+      wprintf(L"Error:  %s\n", errtext.c_str());
+      wprintf(L"Near offset:  %Iu\n", xml.CurPosition());
+      wprintf(L"Terminating with error.\n");
+      return false;
+   }
+   wprintf(L"END DUMP OF FILE '%s'\n", filename);
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Implements XmlParseHandler by accepting every node.
+//--------------------------------------------------------------------
+class MyNullParseHandler : public nomxml::XmlParseHandler
+{
+public:
+   bool Node(const nomxml::XmlNodeBase &)
+   {
+      return true;
+   }
+};
+
+//--------------------------------------------------------------------
+// Check that a document of {numbytes} bytes, consisting of {prefix},
+// a single huge {kind} of filler, and {suffix}, stops parsing in an
+// XmlParsePool soon after its deadline.  Returns true if it does.
+//--------------------------------------------------------------------
+static bool checkDeadline(nomxml::XmlParsePool &pool, const wchar_t *kind, const char *prefix, const char *suffix,
+                          size_t numbytes)
+{
+   std::vector<char> data(numbytes, 'x');
+   std::copy(prefix, prefix + strlen(prefix), data.begin());
+   std::copy(suffix, suffix + strlen(suffix), data.end() - strlen(suffix));
+
+   // Even the fastest scan of the document takes well over this long.
+   const unsigned timeoutms = 5;
+   MyNullParseHandler handler;
+   auto start = std::chrono::steady_clock::now();
+   std::shared_ptr<nomxml::XmlParseJob> job = pool.ParseMemory(data.data(), data.size(), handler, timeoutms);
+   nomxml::XmlParseResult result = job->m_Result.get();
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+   // Allow plenty of time past the deadline for a busy machine, but
+   // far less than parsing the whole document would take.
+   if (result.m_Success || elapsed.count() > 1.0)
+   {
+      wprintf(L"Error:  Parsing a %Iu byte %s took %.3f seconds with a %u ms deadline.\n",
+              numbytes, kind, elapsed.count(), timeoutms);
+      return false;
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Check that the file named {filename} parses the same in an
+// XmlParsePool from memory and from the file, and that the pool's
+// deadlines and cancellation stop parsing inside huge nodes in
+// memory.  Returns true if all is well.
+//--------------------------------------------------------------------
+static bool checkLimits(const wchar_t *filename)
+{
+   std::vector<char> data = LoadFileToMemory(filename);
+   if (data.empty())
+      return false;
+
+   nomxml::XmlParsePool pool(2);
+   MyNullParseHandler handler;
+   nomxml::XmlParseResult frommemory = pool.ParseMemory(data.data(), data.size(), handler)->m_Result.get();
+   nomxml::XmlParseResult fromfile = pool.ParseFile(filename, handler)->m_Result.get();
+   if (frommemory.m_Success != fromfile.m_Success || frommemory.m_NumNodes != fromfile.m_NumNodes ||
+       frommemory.m_ErrorInfo != fromfile.m_ErrorInfo)
+   {
+      wprintf(L"Error:  Parsing in a pool from memory differs from parsing from the file.\n");
+      return false;
+   }
+
+   const size_t hugebytes = 256 * 1024 * 1024;
+   if (!checkDeadline(pool, L"text node", "<r>", "</r>", hugebytes) ||
+       !checkDeadline(pool, L"comment", "<r><!--", "--></r>", hugebytes))
+      return false;
+
+   // Cancelling part way through a node must stop parsing within the
+   // check interval, wherever the node's end is.
+   const size_t checkbytes = 64 * 1024;
+   std::vector<char> text(16 * 1024 * 1024, 'x');
+   memcpy(text.data(), "<r>", 3);
+   memcpy(text.data() + text.size() - 4, "</r>", 4);
+   std::atomic<bool> cancel(false);
+   nomxml::XmlParser xml;
+   xml.SetLimits(&cancel, std::chrono::steady_clock::time_point::max(), checkbytes);
+   std::unique_ptr<nomxml::XmlNodeBase> node;
+   if (!xml.BeginParsingFromMemory(text.data(), text.size()) || !xml.NextNode(node))
+   {
+      wprintf(L"Error:  Failed to begin parsing a huge text node.\n");
+      return false;
+   }
+   cancel = true;
+   if (xml.NextNode(node) || xml.CurPosition() > 2 * checkbytes)
+   {
+      wprintf(L"Error:  Cancelled parsing went on to offset %Iu.\n", xml.CurPosition());
+      return false;
+   }
+
+   wprintf(L"Parse limits verified on file '%s'\n", filename);
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Append every element under {elm} other than processing instructions
+// to {elements}, in document order.
+//--------------------------------------------------------------------
+static void listElements(nomxml::XmlElementTree &elm, std::vector<nomxml::XmlElementTree *> &elements)
+{
+   for (auto childp = elm.m_Children.begin(); childp != elm.m_Children.end(); ++childp)
+   {
+      if (!childp->m_Begin.m_Instruction)
+         elements.push_back(&*childp);
+      listElements(*childp, elements);
+   }
+}
+
+//--------------------------------------------------------------------
+// Returns true if the trees {a} and {b} hold the same elements, with
+// the same text, depths and offsets.
+//--------------------------------------------------------------------
+static bool sameTree(const nomxml::XmlElementTree &a, const nomxml::XmlElementTree &b)
+{
+   if (a.m_Begin.m_Name != b.m_Begin.m_Name || a.m_Value.m_Value != b.m_Value.m_Value ||
+       a.m_Begin.m_Depth != b.m_Begin.m_Depth || a.m_Value.m_Depth != b.m_Value.m_Depth ||
+       a.m_End.m_Depth != b.m_End.m_Depth || a.m_Begin.m_Offset != b.m_Begin.m_Offset ||
+       a.m_End.m_Offset != b.m_End.m_Offset || a.m_Children.size() != b.m_Children.size())
+      return false;
+   for (size_t index = 0; index < a.m_Children.size(); ++index)
+      if (!sameTree(a.m_Children[index], b.m_Children[index]))
+         return false;
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Check that XmlParser::ReparseEdit keeps a tree of the file named
+// {filename} the same as parsing the edited document afresh, by
+// inserting a child element into elements spread through the file
+// one at a time.  Returns true if all is well.
+//--------------------------------------------------------------------
+static bool checkReparse(const wchar_t *filename)
+{
+   std::vector<char> data = LoadFileToMemory(filename);
+   if (data.empty())
+      return false;
+
+   nomxml::XmlParser xml;
+   nomxml::XmlElementTree root;
+   if (!xml.BeginParsingFromMemory(data.data(), data.size()) || !xml.ParseTree(root))
+   {
+      wprintf(L"Failed parsing file:  %s\n", filename);
+      return false;
+   }
+
+   const char insert[] = "<edit a=\"1\">x</edit>";
+   const size_t numedits = 20;
+   size_t edited = 0;
+   for (size_t edit = 0; edit < numedits; ++edit)
+   {
+      // Insert right after the begin tag of an element that has an
+      // end tag of its own.
+      std::vector<nomxml::XmlElementTree *> elements;
+      listElements(root, elements);
+      if (elements.empty())
+         break;
+      const nomxml::XmlElementTree &elm = *elements[elements.size() * edit / numedits];
+      size_t offset = elm.m_Begin.m_Offset;
+      while (offset < data.size() && data[offset] != '>')
+         ++offset;
+      if (offset >= data.size() || data[offset - 1] == '/')
+         continue;
+      ++offset;
+
+      data.insert(data.begin() + offset, insert, insert + sizeof(insert) - 1);
+      nomxml::XmlElementTree fresh;
+      nomxml::XmlParser freshxml;
+      if (!xml.ReparseEdit(root, data.data(), data.size(), offset, 0, sizeof(insert) - 1) ||
+          !freshxml.BeginParsingFromMemory(data.data(), data.size()) || !freshxml.ParseTree(fresh))
+      {
+         wprintf(L"Error:  Failed reparsing an edit at offset %Iu.\n", offset);
+         return false;
+      }
+      if (!sameTree(root, fresh))
+      {
+         wprintf(L"Error:  Reparsed tree differs from a fresh parse after an edit at offset %Iu.\n", offset);
+         return false;
+      }
+      ++edited;
+   }
+
+   wprintf(L"Reparsed %Iu edits of file '%s'\n", edited, filename);
+   return true;
+}
+
 //--------------------------------------------------------------------
 // Program entry point.  Takes standard args from the command line and
 // returns EXIT_SUCCESS if no errors.
 //--------------------------------------------------------------------
 int wmain(int argc, wchar_t **argv)
 {
-   if (argc < 2 || argc > 3)
+   if ((argc < 2 || argc > 3) &&
+       !(argc == 5 && _wcsicmp(argv[2], L"last") == 0) &&
+       !((argc == 5 || argc == 6) && _wcsicmp(argv[2], L"sample") == 0) &&
+       !((argc == 6 || argc == 7) && _wcsicmp(argv[2], L"group") == 0) &&
+       !(argc == 4 && _wcsicmp(argv[2], L"frozen") == 0))
    {
       // The user needs command line help.
-      wprintf(L"Usage:  xmldump filename.xml [file|memory|interface]\n");
+      wprintf(L"Usage:  xmldump filename.xml [file|memory|bytes|events|interface|follow|verify|bench|limits|reparse|c14n|sha256]\n");
+      wprintf(L"        xmldump filename.xml last recordname count\n");
+      wprintf(L"        xmldump filename.xml sample recordname count [seed]\n");
+      wprintf(L"        xmldump filename.xml group recordname keypaths aggregates [numthreads]\n");
+      wprintf(L"        xmldump filename.xml frozen [maxthreads]\n");
       return EXIT_FAILURE;
    }
 
@@ -326,6 +1066,33 @@ int wmain(int argc, wchar_t **argv)
             return EXIT_FAILURE;
          }
       }
+      else if (_wcsicmp(readmode, L"bytes") == 0)
+      {
+         // Parse the file into byte nodes, widening them again for
+         // output.
+         nomxml::XmlByteParser bytexml;
+         if (!bytexml.BeginParsingFromFile(filename))
+         {
+            wprintf(L"Failed to begin parsing file:  %s\n", filename);
+            return EXIT_FAILURE;
+         }
+
+         wprintf(L"BEGIN DUMP OF FILE '%s'\n", filename);
+         ByteNodeReader reader(bytexml);
+         if (!parse(reader))
+         {
+            wprintf(L"Terminating with error.\n");
+            return EXIT_FAILURE;
+         }
+         wprintf(L"END DUMP OF FILE '%s'\n", filename);
+         return EXIT_SUCCESS;
+      }
+      else if (_wcsicmp(readmode, L"events") == 0)
+      {
+         // Same as "bytes", but retrieving batches of events instead
+         // of one node at a time.
+         return dumpEvents(filename) ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
       else if (_wcsicmp(readmode, L"file") == 0)
       {
          // Parse the XML file directly from the file instead of from memory.
@@ -335,6 +1102,95 @@ int wmain(int argc, wchar_t **argv)
             return EXIT_FAILURE;
          }
       }
+      else if (_wcsicmp(readmode, L"follow") == 0)
+      {
+         // Parse the XML file as it grows, like "tail -f".  Stops after
+         // nothing has been appended to the file for ten seconds.
+         if (!xml.BeginFollowingFile(filename, 100, 10000))
+         {
+            wprintf(L"Failed to begin parsing file:  %s\n", filename);
+            return EXIT_FAILURE;
+         }
+      }
+      else if (_wcsicmp(readmode, L"last") == 0 || _wcsicmp(readmode, L"sample") == 0)
+      {
+         // Dump only the last few records at the end of the file, or a
+         // few records chosen at random from anywhere in the file,
+         // without parsing the rest of the file.
+         nomxml::XmlRecordIndex index;
+         size_t count = static_cast<size_t>(_wtoi(argv[4]));
+         bool found = xml.BeginParsingFromFile(filename);
+         if (found && _wcsicmp(readmode, L"last") == 0)
+            found = xml.FindLastRecords(argv[3], count, index);
+         else if (found)
+         {
+            // The same seed always dumps the same records.
+            unsigned seed = (argc > 5) ? static_cast<unsigned>(_wtoi(argv[5])) : 0;
+            found = xml.SampleRecords(argv[3], count, seed, index);
+         }
+         if (!found)
+         {
+            wprintf(L"Failed to begin parsing file:  %s\n", filename);
+            return EXIT_FAILURE;
+         }
+
+         wprintf(L"BEGIN DUMP OF FILE '%s'\n", filename);
+         for (auto spanp = index.m_Records.begin(); spanp != index.m_Records.end(); ++spanp)
+         {
+            if (!xml.BeginParsingRange(spanp->m_Offset, spanp->m_Offset + spanp->m_Length, index.m_Contexts[spanp->m_Context]) ||
+                !parse(xml))
+            {
+               wprintf(L"Terminating with error.\n");
+               return EXIT_FAILURE;
+            }
+         }
+         wprintf(L"END DUMP OF FILE '%s'\n", filename);
+         return EXIT_SUCCESS;
+      }
+      else if (_wcsicmp(readmode, L"group") == 0)
+      {
+         // Output sums, counts, minimums or maximums of fields of the
+         // records, grouped by other fields, instead of the nodes.
+         int numthreads = (argc > 6) ? _wtoi(argv[6]) : 1;
+         if (!groupRecords(filename, argv[3], argv[4], argv[5], static_cast<size_t>(std::max(numthreads, 1))))
+            return EXIT_FAILURE;
+         return EXIT_SUCCESS;
+      }
+      else if (_wcsicmp(readmode, L"verify") == 0)
+      {
+         // Check the parser's vectorized kernels against the scalar
+         // versions on this file instead of dumping it.
+         return verifySimd(filename) ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+      else if (_wcsicmp(readmode, L"limits") == 0)
+      {
+         // Check the parse pool's limits instead of dumping the file.
+         return checkLimits(filename) ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+      else if (_wcsicmp(readmode, L"reparse") == 0)
+      {
+         // Check reparsing edits against parsing afresh instead of
+         // dumping the file.
+         return checkReparse(filename) ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+      else if (_wcsicmp(readmode, L"bench") == 0)
+      {
+         // Time parsing the file instead of dumping it.
+         return benchParse(filename) ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+      else if (_wcsicmp(readmode, L"frozen") == 0)
+      {
+         // Time reading the file as a frozen document on more and more
+         // threads at once instead of dumping it.
+         int maxthreads = (argc > 3) ? _wtoi(argv[3]) : static_cast<int>(std::thread::hardware_concurrency());
+         return benchFrozen(filename, static_cast<size_t>(std::max(maxthreads, 1))) ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+      else if (_wcsicmp(readmode, L"c14n") == 0 || _wcsicmp(readmode, L"sha256") == 0)
+      {
+         // Output the file's canonical form, or a digest of it,
+         // instead of dumping it.
+         return canonicalize(filename, _wcsicmp(readmode, L"sha256") == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
       else if (_wcsicmp(readmode, L"interface") == 0)
       {
          // Process the XML file using the callback interface.
@@ -0,0 +1,380 @@
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// xmlfmt.cpp -- Source code example for using the NomXML library.
+//               This program minifies or pretty-prints an XML file.
+//
+// NomXML is a small, minimalist C++ library for extracting tags and data
+// from XML documents.  I wrote this for use in my own educational and
+// experimental programs, but you may also freely use it in yours as long
+// as you abide by the following terms and conditions.
+//
+// (C) Copyright 2008,2015 by Ammon R. Campbell.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * The names of the authors and contributors may not be used to endorse
+//       or promote products derived from this software without specific
+//       prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// Both modes divide the input into spans of markup and text with an
+// XmlMarkupScanner and copy the spans verbatim from the input, so nothing
+// is parsed into names and attributes or converted to wide characters.
+// Output is collected in memory and written in large blocks.
+//
+// "minify" drops comments and text that is only whitespace, such as the
+// line breaks and indentation between tags, and copies everything else.
+// A large input is divided into chunks that are minified at the same time
+// by separate threads.  Each chunk starts at a '<', which might turn out
+// to be inside a comment or CDATA section that began in the chunk before;
+// that's detected when the chunks are joined, and such a chunk is
+// minified again from where the chunk before it really ended.
+//
+// "pretty" puts each tag, comment and other markup on its own line,
+// indented by its depth, with an element's text on the same line as its
+// tags.  Whitespace around text is dropped, and whitespace-only text is
+// dropped entirely.
+//
+// For example:
+//
+//    xmlfmt big.kml small.kml minify 8
+//    xmlfmt small.kml readable.kml pretty 2
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+#include "nomxml.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+// Output is written once this much of it has been collected.
+const size_t outputBlockSize = 1024 * 1024;
+
+// Inputs are only divided among threads in chunks at least this big.
+const size_t minChunkSize = 1024 * 1024;
+
+//--------------------------------------------------------------------
+// Load the file named {filename} into {data}.  Returns false if error.
+//--------------------------------------------------------------------
+static bool LoadFile(const wchar_t *filename, std::vector<char> &data)
+{
+   FILE *fp = nullptr;
+   if (_wfopen_s(&fp, filename, L"rb") || fp == nullptr)
+   {
+      wprintf(L"Failed opening file:  %s\n", filename);
+      return false;
+   }
+
+   size_t length = nomxml::XmlFileLength(fp);
+   bool success = !ferror(fp);
+   if (success)
+   {
+      data.resize(length);
+      success = (fread(data.data(), 1, data.size(), fp) == data.size());
+   }
+   fclose(fp);
+
+   if (!success)
+      wprintf(L"Failed reading file:  %s\n", filename);
+   return success;
+}
+
+//--------------------------------------------------------------------
+// Report the error that stopped {scanner}.
+//--------------------------------------------------------------------
+static void ReportError(nomxml::XmlMarkupScanner &scanner)
+{
+   std::wstring errtext;
+   scanner.ErrorInfo(errtext);
+   wprintf(L"Error:  %s\n", errtext.c_str());
+   wprintf(L"Near offset:  %Iu\n", scanner.CurPosition());
+}
+
+//--------------------------------------------------------------------
+// One piece of a document being minified by its own thread.
+//--------------------------------------------------------------------
+struct MinifyChunk
+{
+   size_t m_Start;         // Offset of the first span to minify.
+   size_t m_Stop;          // No span starting at or after this is minified.
+   size_t m_End;           // Offset just past the last span minified.
+   std::string m_Output;   // The minified spans.
+   bool m_Ok;              // False if the markup was unterminated.
+};
+
+//--------------------------------------------------------------------
+// Minify the spans of the {numbytes} bytes at {data} that start in
+// {chunk}'s range into its output.  The last span may run past the
+// range, which is noted in chunk.m_End.
+//--------------------------------------------------------------------
+static void Minify(const char *data, size_t numbytes, MinifyChunk &chunk)
+{
+   nomxml::XmlMarkupScanner scanner;
+   nomxml::XmlMarkupSpan span;
+   scanner.BeginScanning(data, numbytes, chunk.m_Start);
+   chunk.m_Output.clear();
+   chunk.m_Output.reserve(chunk.m_Stop - chunk.m_Start);
+   chunk.m_Ok = true;
+   while (scanner.CurPosition() < chunk.m_Stop)
+   {
+      if (!scanner.NextSpan(span))
+      {
+         chunk.m_Ok = false;
+         break;
+      }
+      if (span.m_Type == nomxml::XmlMarkupSpan::XmlSpan_Comment || span.m_WhiteSpace)
+         continue;
+      chunk.m_Output.append(span.m_Data, span.m_Length);
+   }
+   chunk.m_End = scanner.CurPosition();
+}
+
+//--------------------------------------------------------------------
+// Minify {data} to {fp}, dividing it among {numthreads} threads.
+// Returns false if error.
+//--------------------------------------------------------------------
+static bool MinifyDocument(const std::vector<char> &data, FILE *fp, size_t numthreads)
+{
+   // Each chunk starts at the first '<' after an even division of the
+   // input.  Chunks that have no '<' of their own are dropped.
+   size_t numchunks = std::max<size_t>(1, std::min(numthreads, data.size() / minChunkSize));
+   std::vector<MinifyChunk> chunks;
+   for (size_t chunk = 0; chunk < numchunks; ++chunk)
+   {
+      size_t start = data.size() * chunk / numchunks;
+      if (chunk != 0)
+      {
+         const void *found = memchr(data.data() + start, '<', data.size() - start);
+         start = (found != nullptr) ? static_cast<const char *>(found) - data.data() : data.size();
+         if (start == chunks.back().m_Start)
+            continue;
+         chunks.back().m_Stop = start;
+      }
+      MinifyChunk piece;
+      piece.m_Start = start;
+      piece.m_Stop = data.size();
+      chunks.push_back(piece);
+   }
+
+   std::vector<std::thread> threads;
+   for (size_t chunk = 1; chunk < chunks.size(); ++chunk)
+      threads.push_back(std::thread(Minify, data.data(), data.size(), std::ref(chunks[chunk])));
+   Minify(data.data(), data.size(), chunks[0]);
+   for (auto threadp = threads.begin(); threadp != threads.end(); ++threadp)
+      threadp->join();
+
+   // Join the chunks, redoing any that started at the wrong place
+   // because the chunk before ended past their start.
+   size_t expected = 0;
+   for (auto chunkp = chunks.begin(); chunkp != chunks.end(); ++chunkp)
+   {
+      if (chunkp->m_Start != expected)
+      {
+         chunkp->m_Start = expected;
+         Minify(data.data(), data.size(), *chunkp);
+      }
+      if (!chunkp->m_Ok)
+      {
+         nomxml::XmlMarkupScanner scanner;
+         nomxml::XmlMarkupSpan span;
+         scanner.BeginScanning(data.data(), data.size(), chunkp->m_End);
+         scanner.NextSpan(span);
+         ReportError(scanner);
+         return false;
+      }
+      if (fwrite(chunkp->m_Output.data(), 1, chunkp->m_Output.size(), fp) != chunkp->m_Output.size())
+         return false;
+      expected = chunkp->m_End;
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Returns true if {c} is XML whitespace.
+//--------------------------------------------------------------------
+static bool IsSpace(char c)
+{
+   return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+//--------------------------------------------------------------------
+// Write {output} to {fp} and empty it.  Returns false if error.
+//--------------------------------------------------------------------
+static bool WriteOutput(FILE *fp, std::string &output)
+{
+   bool success = (fwrite(output.data(), 1, output.size(), fp) == output.size());
+   output.clear();
+   return success;
+}
+
+//--------------------------------------------------------------------
+// Pretty-print {data} to {fp}, indenting each level by {indentwidth}
+// spaces.  Returns false if error.
+//--------------------------------------------------------------------
+static bool PrettyPrintDocument(const std::vector<char> &data, FILE *fp, size_t indentwidth)
+{
+   // What the span written last was, which decides whether the next
+   // one starts a new line.
+   typedef enum { Prior_None, Prior_Begin, Prior_InlineText, Prior_Other } Prior;
+
+   // A line break followed by the indentation of the deepest level so
+   // far.  Each line starts with as much of it as its level needs.
+   std::string linestart = "\n";
+   std::string output;
+   nomxml::XmlMarkupScanner scanner;
+   nomxml::XmlMarkupSpan span;
+   size_t depth = 0;
+   Prior prior = Prior_None;
+   scanner.BeginScanning(data.data(), data.size());
+   while (scanner.NextSpan(span))
+   {
+      const char *text = span.m_Data;
+      size_t length = span.m_Length;
+      bool newline = (prior != Prior_None);
+      Prior next = Prior_Other;
+      switch (span.m_Type)
+      {
+         case nomxml::XmlMarkupSpan::XmlSpan_Text:
+         case nomxml::XmlMarkupSpan::XmlSpan_CData:
+            if (span.m_WhiteSpace)
+               continue;
+            if (span.m_Type == nomxml::XmlMarkupSpan::XmlSpan_Text)
+            {
+               for (; IsSpace(*text); ++text)
+                  --length;
+               while (IsSpace(text[length - 1]))
+                  --length;
+            }
+
+            // Text right after a begin tag stays on the tag's line.
+            if (prior == Prior_Begin)
+            {
+               newline = false;
+               next = Prior_InlineText;
+            }
+            break;
+
+         case nomxml::XmlMarkupSpan::XmlSpan_BeginTag:
+            next = Prior_Begin;
+            break;
+
+         case nomxml::XmlMarkupSpan::XmlSpan_EndTag:
+            depth = (depth > 0) ? depth - 1 : 0;
+            if (prior == Prior_Begin || prior == Prior_InlineText)
+               newline = false;
+            break;
+
+         default:
+            break;
+      }
+
+      if (newline)
+      {
+         size_t indent = depth * indentwidth;
+         if (linestart.size() < indent + 1)
+            linestart.resize(indent + 1, ' ');
+         output.append(linestart.data(), indent + 1);
+      }
+      output.append(text, length);
+      if (span.m_Type == nomxml::XmlMarkupSpan::XmlSpan_BeginTag)
+         ++depth;
+      prior = next;
+
+      if (output.size() >= outputBlockSize && !WriteOutput(fp, output))
+         return false;
+   }
+
+   std::wstring errtext;
+   scanner.ErrorInfo(errtext);
+   if (!errtext.empty())
+   {
+      ReportError(scanner);
+      return false;
+   }
+   if (prior != Prior_None)
+      output += '\n';
+   return WriteOutput(fp, output);
+}
+
+//--------------------------------------------------------------------
+// Program entry point.  Takes standard args from the command line and
+// returns EXIT_SUCCESS if no errors.
+//--------------------------------------------------------------------
+int wmain(int argc, wchar_t **argv)
+{
+   if (argc < 4 || argc > 5 ||
+       (_wcsicmp(argv[3], L"minify") != 0 && _wcsicmp(argv[3], L"pretty") != 0))
+   {
+      // The user needs command line help.
+      wprintf(L"Usage:  xmlfmt filename.xml outname.xml minify [numthreads]\n");
+      wprintf(L"        xmlfmt filename.xml outname.xml pretty [indentwidth]\n");
+      return EXIT_FAILURE;
+   }
+
+   const wchar_t *filename = argv[1];
+   const wchar_t *outname = argv[2];
+   bool minify = (_wcsicmp(argv[3], L"minify") == 0);
+
+   try
+   {
+      std::vector<char> data;
+      if (!LoadFile(filename, data))
+         return EXIT_FAILURE;
+
+      FILE *fp = nullptr;
+      if (_wfopen_s(&fp, outname, L"wb") || fp == nullptr)
+      {
+         wprintf(L"Failed creating file:  %s\n", outname);
+         return EXIT_FAILURE;
+      }
+
+      bool success;
+      if (minify)
+      {
+         int numthreads = (argc > 4) ? _wtoi(argv[4]) : static_cast<int>(std::thread::hardware_concurrency());
+         success = MinifyDocument(data, fp, static_cast<size_t>(std::max(numthreads, 1)));
+      }
+      else
+      {
+         int indentwidth = (argc > 4) ? _wtoi(argv[4]) : 2;
+         success = PrettyPrintDocument(data, fp, static_cast<size_t>(std::max(indentwidth, 0)));
+      }
+      size_t written = nomxml::XmlTellFile(fp);
+      if (ferror(fp))
+         success = false;
+      if (fclose(fp) != 0)
+         success = false;
+
+      if (!success)
+      {
+         wprintf(L"Terminating with error.\n");
+         return EXIT_FAILURE;
+      }
+      wprintf(L"Wrote %Iu bytes from %Iu to file:  %s\n", written, data.size(), outname);
+   }
+   catch(...)
+   {
+      wprintf(L"Exception!  Sorry, something bad happened and XmlFmt has to shut down.\n");
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// xmljoin.cpp -- Source code example for using the NomXML library.
+//                This program matches the records of two XML files that
+//                share the same key, and writes each matching pair to a
+//                new XML file.
+//
+// NomXML is a small, minimalist C++ library for extracting tags and data
+// from XML documents.  I wrote this for use in my own educational and
+// experimental programs, but you may also freely use it in yours as long
+// as you abide by the following terms and conditions.
+//
+// (C) Copyright 2008,2015 by Ammon R. Campbell.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * The names of the authors and contributors may not be used to endorse
+//       or promote products derived from this software without specific
+//       prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// A "record" is any element with the tag name given on the command line,
+// such as "gml:featureMember" or "Placemark".  Each file's key is a field
+// of its records, named by a path relative to the record, such as "@gml:id"
+// for the record's attribute "gml:id" or "ref/@href" for the attribute
+// "href" of its child element <ref>.  The two files may use different
+// record names and key fields.
+//
+// The records of the smaller file are read into a hash table of keys and
+// byte ranges, spilling to temporary files if there are too many.  The
+// larger file is then read one record at a time and each record's key is
+// looked up in the table.  Each match is written as a <match> element
+// holding verbatim copies of the record from the first file and the record
+// from the second file, in that order.  For example:
+//
+//    xmljoin roads.xml gml:featureMember @gml:id
+//            refs.xml ref @target  joined.xml
+//
+// writes something like this to joined.xml:
+//
+//    <?xml version="1.0"?>
+//    <join>
+//    <match>
+//    <gml:featureMember gml:id="r17">...</gml:featureMember>
+//    <ref target="r17">...</ref>
+//    </match>
+//    </join>
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+#include "nomxml.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+//--------------------------------------------------------------------
+// Writes each pair of matching records to the output file.
+//--------------------------------------------------------------------
+class MatchWriter : public nomxml::XmlJoinHandler
+{
+public:
+   // {firstfp} and {secondfp} are the two input files, and {buildfirst}
+   // tells whether the build side of the join is the first file.
+   MatchWriter(FILE *firstfp, FILE *secondfp, bool buildfirst, FILE *out) :
+      m_FirstFp(firstfp), m_SecondFp(secondfp), m_BuildFirst(buildfirst), m_Out(out), m_Count(0)
+   {
+   }
+
+   bool Match(const std::wstring &/*key*/, const nomxml::XmlRecordSpan &build, const nomxml::XmlRecordSpan &probe)
+   {
+      const nomxml::XmlRecordSpan &first = m_BuildFirst ? build : probe;
+      const nomxml::XmlRecordSpan &second = m_BuildFirst ? probe : build;
+      ++m_Count;
+      return fputs("<match>\n", m_Out) >= 0 &&
+             nomxml::XmlCopyBytes(m_FirstFp, first.m_Offset, first.m_Length, m_Out) &&
+             fputs("\n", m_Out) >= 0 &&
+             nomxml::XmlCopyBytes(m_SecondFp, second.m_Offset, second.m_Length, m_Out) &&
+             fputs("\n</match>\n", m_Out) >= 0;
+   }
+
+   // Returns the number of pairs written.
+   size_t Count(void) const { return m_Count; }
+
+private:
+   FILE *m_FirstFp;
+   FILE *m_SecondFp;
+   bool m_BuildFirst;
+   FILE *m_Out;
+   size_t m_Count;
+
+   MatchWriter & operator=(const MatchWriter &);
+};
+
+//--------------------------------------------------------------------
+// Output an error message for {xml} and {join}, whichever has one.
+//--------------------------------------------------------------------
+static void ReportJoinError(nomxml::XmlParser &xml, const nomxml::XmlHashJoin &join, const wchar_t *filename)
+{
+   std::wstring errtext;
+   xml.ErrorInfo(errtext);
+   if (errtext.empty())
+      join.ErrorInfo(errtext);
+   wprintf(L"Error in file '%s':  %s\n", filename, errtext.c_str());
+   wprintf(L"Near offset:  %Iu\n", xml.CurPosition());
+}
+
+//--------------------------------------------------------------------
+// Join the records of the two files whose names are in {filenames}
+// and which are open as {in}, writing the matches to {out}.
+// Returns true if successful.
+//--------------------------------------------------------------------
+static bool JoinFiles(const wchar_t *filenames[2], const wchar_t *recordnames[2],
+                      const wchar_t *keypaths[2], FILE *in[2], FILE *out)
+{
+   // The smaller file goes in the hash table.
+   size_t build = (nomxml::XmlFileLength(in[1]) < nomxml::XmlFileLength(in[0])) ? 1 : 0;
+   size_t probe = 1 - build;
+
+   nomxml::XmlHashJoin join;
+   nomxml::XmlParser xml;
+   if (!xml.BeginParsingFromFile(filenames[build]))
+   {
+      wprintf(L"Failed to begin parsing file:  %s\n", filenames[build]);
+      return false;
+   }
+   if (!join.Build(xml, recordnames[build], keypaths[build]))
+   {
+      ReportJoinError(xml, join, filenames[build]);
+      return false;
+   }
+
+   fputs("<?xml version=\"1.0\"?>\n<join>\n", out);
+   MatchWriter writer(in[0], in[1], build == 0, out);
+   if (!xml.BeginParsingFromFile(filenames[probe]))
+   {
+      wprintf(L"Failed to begin parsing file:  %s\n", filenames[probe]);
+      return false;
+   }
+   if (!join.Probe(xml, recordnames[probe], keypaths[probe], writer))
+   {
+      ReportJoinError(xml, join, filenames[probe]);
+      return false;
+   }
+   fputs("</join>\n", out);
+
+   wprintf(L"Wrote %Iu matching pairs.\n", writer.Count());
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Program entry point.  Takes standard args from the command line and
+// returns EXIT_SUCCESS if no errors.
+//--------------------------------------------------------------------
+int wmain(int argc, wchar_t **argv)
+{
+   if (argc != 8)
+   {
+      // The user needs command line help.
+      wprintf(L"Usage:  xmljoin first.xml recordname keypath second.xml recordname keypath output.xml\n");
+      return EXIT_FAILURE;
+   }
+
+   const wchar_t *filenames[2] = { argv[1], argv[4] };
+   const wchar_t *recordnames[2] = { argv[2], argv[5] };
+   const wchar_t *keypaths[2] = { argv[3], argv[6] };
+   const wchar_t *outname = argv[7];
+
+   FILE *in[2] = { nullptr, nullptr };
+   FILE *out = nullptr;
+   int result = EXIT_FAILURE;
+
+   try
+   {
+      // Open the input files, for copying records, and the output file.
+      if (_wfopen_s(&in[0], filenames[0], L"rb") || in[0] == nullptr)
+         wprintf(L"Failed opening file:  %s\n", filenames[0]);
+      else if (_wfopen_s(&in[1], filenames[1], L"rb") || in[1] == nullptr)
+         wprintf(L"Failed opening file:  %s\n", filenames[1]);
+      else if (_wfopen_s(&out, outname, L"wb") || out == nullptr)
+         wprintf(L"Failed creating file:  %s\n", outname);
+      else if (JoinFiles(filenames, recordnames, keypaths, in, out))
+         result = EXIT_SUCCESS;
+   }
+   catch(...)
+   {
+      wprintf(L"Exception!  Sorry, something bad happened and XmlJoin has to shut down.\n");
+      result = EXIT_FAILURE;
+   }
+
+   for (size_t side = 0; side < 2; ++side)
+      if (in[side] != nullptr)
+         fclose(in[side]);
+   if (out != nullptr && fclose(out) != 0)
+      result = EXIT_FAILURE;
+   return result;
+}
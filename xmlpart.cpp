@@ -0,0 +1,447 @@
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// xmlpart.cpp -- Source code example for using the NomXML library.
+//                This program divides a large XML file into byte ranges
+//                that can be parsed by separate processes at once.
+//
+// NomXML is a small, minimalist C++ library for extracting tags and data
+// from XML documents.  I wrote this for use in my own educational and
+// experimental programs, but you may also freely use it in yours as long
+// as you abide by the following terms and conditions.
+//
+// (C) Copyright 2008,2015 by Ammon R. Campbell.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * The names of the authors and contributors may not be used to endorse
+//       or promote products derived from this software without specific
+//       prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// Parsing a very large XML file can be spread over several processes,
+// on one machine or on several machines sharing a filesystem, without
+// physically splitting the file.  This program has three modes:
+//
+//    xmlpart plan filename.xml recordname numparts manifest.txt
+//
+//       Finds the records in the file (elements with the given tag name,
+//       such as "gml:featureMember") and divides them into the given
+//       number of byte ranges, each holding a run of whole records.
+//       The ranges, and the elements enclosing the first record of each
+//       range, are written to the manifest file.
+//
+//    xmlpart work manifest.txt partnumber
+//
+//       Parses only the one range of the file given by {partnumber},
+//       starting with the enclosing elements already open, and writes
+//       the partial results to "manifest.txt.{partnumber}.out".  Each
+//       part can be worked on by a separate process at the same time.
+//
+//    xmlpart merge manifest.txt
+//
+//       Combines the partial results of all the parts and outputs the
+//       totals to the console.
+//
+// The partial results in this example are simply counts of how many
+// elements of each tag name were found.  The counts are per part, and
+// the merged counts are their totals.  The ranges hold whole records,
+// so no element is counted twice.  But the elements enclosing the
+// records, and anything outside the records, such as before the first
+// record or between two parts, are in no range and aren't counted, so
+// the totals aren't counts for the whole file.
+//
+// The manifest is a text file that looks something like this:
+//
+//    NOMXMLPARTS 1
+//    FILE big.gml
+//    CONTEXT 0 0 osgb:FeatureCollection 402 osgb:featureMember
+//    RANGE 0 1017 88321 0
+//    RANGE 1 88321 170095 0
+//
+// Each CONTEXT line holds a context number followed by pairs of byte
+// offsets and tag names for the enclosing elements, outermost first.
+// Each RANGE line holds the part number, the starting and ending byte
+// offsets, and the context number.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+#include "nomxml.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+
+//--------------------------------------------------------------------
+// One range of the file, as read from the manifest.
+//--------------------------------------------------------------------
+struct PartRange
+{
+   size_t m_Begin;      // Byte offset where the range begins.
+   size_t m_End;        // Byte offset just past the end of the range.
+   size_t m_Context;    // Index of the enclosing elements in Manifest::m_Contexts.
+};
+
+//--------------------------------------------------------------------
+// Contents of a manifest file.
+//--------------------------------------------------------------------
+struct Manifest
+{
+   std::wstring m_Filename;
+   std::vector<std::vector<nomxml::XmlBeginNode> > m_Contexts;
+   std::vector<PartRange> m_Ranges;
+};
+
+// Tag at the top of each manifest file.
+const wchar_t manifestTag[] = L"NOMXMLPARTS 1";
+
+//--------------------------------------------------------------------
+// Write wide string {text} to {fp} as 8-bit characters.
+//--------------------------------------------------------------------
+static void WriteText(FILE *fp, const std::wstring &text)
+{
+   for (auto iter = text.begin(); iter != text.end(); ++iter)
+      fputc((*iter < 256) ? static_cast<int>(*iter) : '?', fp);
+}
+
+//--------------------------------------------------------------------
+// Read one line of text from {fp} into {line}, without the line
+// terminator.  Returns false if no more lines.
+//--------------------------------------------------------------------
+static bool ReadLine(FILE *fp, std::wstring &line)
+{
+   line.clear();
+   int c;
+   while ((c = fgetc(fp)) != EOF && c != '\n')
+   {
+      if (c != '\r')
+         line += static_cast<wchar_t>(static_cast<unsigned char>(c));
+   }
+   return (c != EOF || !line.empty());
+}
+
+//--------------------------------------------------------------------
+// Remove the next space-delimited word from the front of {line} and
+// return it.
+//--------------------------------------------------------------------
+static std::wstring NextWord(std::wstring &line)
+{
+   size_t start = line.find_first_not_of(L' ');
+   if (start == std::wstring::npos)
+   {
+      line.clear();
+      return std::wstring();
+   }
+   size_t end = line.find(L' ', start);
+   std::wstring word = line.substr(start, end - start);
+   line.erase(0, (end == std::wstring::npos) ? line.size() : end);
+   return word;
+}
+
+//--------------------------------------------------------------------
+// Remove the next space-delimited number from the front of {line}
+// and return it.
+//--------------------------------------------------------------------
+static size_t NextNumber(std::wstring &line)
+{
+   return static_cast<size_t>(wcstoull(NextWord(line).c_str(), nullptr, 10));
+}
+
+//--------------------------------------------------------------------
+// Output an error message for the given parser, if it has one.
+// Returns true if there was an error.
+//--------------------------------------------------------------------
+static bool ReportParseError(nomxml::XmlParser &xml)
+{
+   std::wstring errtext;
+   xml.ErrorInfo(errtext);
+   if (errtext.empty())
+      return false;
+   wprintf(L"Error:  %s\n", errtext.c_str());
+   wprintf(L"Near offset:  %Iu\n", xml.CurPosition());
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Load manifest file {filename} into {manifest}.  Returns true if
+// successful.  Any error message is sent to the console.
+//--------------------------------------------------------------------
+static bool LoadManifest(const wchar_t *filename, Manifest &manifest)
+{
+   FILE *fp = nullptr;
+   if (_wfopen_s(&fp, filename, L"rb") || fp == nullptr)
+   {
+      wprintf(L"Failed opening file:  %s\n", filename);
+      return false;
+   }
+
+   std::wstring line;
+   bool ok = ReadLine(fp, line) && line == manifestTag;
+   while (ok && ReadLine(fp, line))
+   {
+      std::wstring keyword = NextWord(line);
+      if (keyword == L"FILE")
+      {
+         manifest.m_Filename = line.substr(line.find_first_not_of(L' '));
+      }
+      else if (keyword == L"CONTEXT")
+      {
+         ok = (NextNumber(line) == manifest.m_Contexts.size());
+         std::vector<nomxml::XmlBeginNode> context;
+         while (ok && !line.empty())
+         {
+            nomxml::XmlBeginNode begin;
+            begin.m_Offset = NextNumber(line);
+            begin.m_Name = NextWord(line);
+            context.push_back(begin);
+         }
+         manifest.m_Contexts.push_back(context);
+      }
+      else if (keyword == L"RANGE")
+      {
+         ok = (NextNumber(line) == manifest.m_Ranges.size());
+         PartRange range;
+         range.m_Begin = NextNumber(line);
+         range.m_End = NextNumber(line);
+         range.m_Context = NextNumber(line);
+         ok = ok && range.m_Context < manifest.m_Contexts.size() && range.m_Begin <= range.m_End;
+         manifest.m_Ranges.push_back(range);
+      }
+      else if (!keyword.empty())
+      {
+         ok = false;
+      }
+   }
+   fclose(fp);
+
+   if (!ok || manifest.m_Filename.empty())
+   {
+      wprintf(L"Invalid manifest file:  %s\n", filename);
+      return false;
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Divide the records of {filename} into {numparts} ranges and write
+// them to {manifestname}.  Returns true if successful.
+//--------------------------------------------------------------------
+static bool Plan(const wchar_t *filename, const wchar_t *recordname, size_t numparts, const wchar_t *manifestname)
+{
+   nomxml::XmlParser xml;
+   nomxml::XmlRecordIndex index;
+   if (!xml.BeginParsingFromFile(filename))
+   {
+      wprintf(L"Failed to begin parsing file:  %s\n", filename);
+      return false;
+   }
+   if (!xml.IndexRecords(recordname, index))
+   {
+      ReportParseError(xml);
+      return false;
+   }
+   if (index.m_Records.empty())
+   {
+      wprintf(L"No '%s' records found in file:  %s\n", recordname, filename);
+      return false;
+   }
+   numparts = std::min(numparts, index.m_Records.size());
+
+   FILE *fp = nullptr;
+   if (_wfopen_s(&fp, manifestname, L"wb") || fp == nullptr)
+   {
+      wprintf(L"Failed creating file:  %s\n", manifestname);
+      return false;
+   }
+
+   WriteText(fp, manifestTag);
+   fputs("\nFILE ", fp);
+   WriteText(fp, filename);
+   fputc('\n', fp);
+
+   for (size_t context = 0; context < index.m_Contexts.size(); ++context)
+   {
+      fprintf(fp, "CONTEXT %llu", static_cast<unsigned long long>(context));
+      for (auto beginp = index.m_Contexts[context].begin(); beginp != index.m_Contexts[context].end(); ++beginp)
+      {
+         fprintf(fp, " %llu ", static_cast<unsigned long long>(beginp->m_Offset));
+         WriteText(fp, beginp->m_Name);
+      }
+      fputc('\n', fp);
+   }
+
+   // Each range runs from the start of its first record to the end of
+   // its last record, including anything between the records.
+   for (size_t part = 0; part < numparts; ++part)
+   {
+      const nomxml::XmlRecordSpan &first = index.m_Records[index.m_Records.size() * part / numparts];
+      const nomxml::XmlRecordSpan &last = index.m_Records[index.m_Records.size() * (part + 1) / numparts - 1];
+      fprintf(fp, "RANGE %llu %llu %llu %llu\n", static_cast<unsigned long long>(part),
+              static_cast<unsigned long long>(first.m_Offset),
+              static_cast<unsigned long long>(last.m_Offset + last.m_Length),
+              static_cast<unsigned long long>(first.m_Context));
+   }
+
+   bool ok = (ferror(fp) == 0);
+   if (fclose(fp) != 0 || !ok)
+   {
+      wprintf(L"Failed writing file:  %s\n", manifestname);
+      return false;
+   }
+
+   wprintf(L"Divided %Iu records into %Iu parts.\n", index.m_Records.size(), numparts);
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Parse range number {part} from the manifest {manifestname} and write
+// the partial results.  Returns true if successful.
+//--------------------------------------------------------------------
+static bool Work(const wchar_t *manifestname, size_t part)
+{
+   Manifest manifest;
+   if (!LoadManifest(manifestname, manifest))
+      return false;
+   if (part >= manifest.m_Ranges.size())
+   {
+      wprintf(L"No part %Iu in manifest:  %s\n", part, manifestname);
+      return false;
+   }
+   const PartRange &range = manifest.m_Ranges[part];
+
+   nomxml::XmlParser xml;
+   if (!xml.BeginParsingFromFile(manifest.m_Filename.c_str()) ||
+       !xml.BeginParsingRange(range.m_Begin, range.m_End, manifest.m_Contexts[range.m_Context]))
+   {
+      wprintf(L"Failed to begin parsing file:  %s\n", manifest.m_Filename.c_str());
+      ReportParseError(xml);
+      return false;
+   }
+
+   std::map<std::wstring, size_t> counts;
+   std::unique_ptr<nomxml::XmlNodeBase> node;
+   while (xml.NextNode(node))
+   {
+      if (node->m_Type == nomxml::XmlNodeBase::XmlNodeType_Begin)
+         ++counts[node->m_Name];
+   }
+   if (ReportParseError(xml))
+      return false;
+
+   std::wstring outname = std::wstring(manifestname) + L"." + std::to_wstring(part) + L".out";
+   FILE *fp = nullptr;
+   if (_wfopen_s(&fp, outname.c_str(), L"wb") || fp == nullptr)
+   {
+      wprintf(L"Failed creating file:  %s\n", outname.c_str());
+      return false;
+   }
+   for (auto iter = counts.begin(); iter != counts.end(); ++iter)
+   {
+      fprintf(fp, "%llu ", static_cast<unsigned long long>(iter->second));
+      WriteText(fp, iter->first);
+      fputc('\n', fp);
+   }
+   bool ok = (ferror(fp) == 0);
+   if (fclose(fp) != 0 || !ok)
+   {
+      wprintf(L"Failed writing file:  %s\n", outname.c_str());
+      return false;
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Combine the partial results of all parts in manifest {manifestname}
+// and output them to the console.  The results are totals of the
+// per-part counts, which only cover the parts' ranges.  Returns true
+// if successful.
+//--------------------------------------------------------------------
+static bool Merge(const wchar_t *manifestname)
+{
+   Manifest manifest;
+   if (!LoadManifest(manifestname, manifest))
+      return false;
+
+   std::map<std::wstring, size_t> counts;
+   for (size_t part = 0; part < manifest.m_Ranges.size(); ++part)
+   {
+      std::wstring partname = std::wstring(manifestname) + L"." + std::to_wstring(part) + L".out";
+      FILE *fp = nullptr;
+      if (_wfopen_s(&fp, partname.c_str(), L"rb") || fp == nullptr)
+      {
+         wprintf(L"Missing results for part %Iu:  %s\n", part, partname.c_str());
+         return false;
+      }
+      std::wstring line;
+      while (ReadLine(fp, line))
+      {
+         size_t count = NextNumber(line);
+         counts[NextWord(line)] += count;
+      }
+      fclose(fp);
+   }
+
+   wprintf(L"Totals of the counts within the ranges of %Iu parts:\n", manifest.m_Ranges.size());
+   for (auto iter = counts.begin(); iter != counts.end(); ++iter)
+      wprintf(L"%Iu '%s'\n", iter->second, iter->first.c_str());
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Program entry point.  Takes standard args from the command line and
+// returns EXIT_SUCCESS if no errors.
+//--------------------------------------------------------------------
+int wmain(int argc, wchar_t **argv)
+{
+   bool ok = false;
+   try
+   {
+      if (argc == 6 && _wcsicmp(argv[1], L"plan") == 0 && _wtoi(argv[4]) > 0)
+      {
+         ok = Plan(argv[2], argv[3], static_cast<size_t>(_wtoi(argv[4])), argv[5]);
+      }
+      else if (argc == 4 && _wcsicmp(argv[1], L"work") == 0)
+      {
+         ok = Work(argv[2], static_cast<size_t>(_wtoi(argv[3])));
+      }
+      else if (argc == 3 && _wcsicmp(argv[1], L"merge") == 0)
+      {
+         ok = Merge(argv[2]);
+      }
+      else
+      {
+         // The user needs command line help.
+         wprintf(L"Usage:  xmlpart plan filename.xml recordname numparts manifest.txt\n");
+         wprintf(L"        xmlpart work manifest.txt partnumber\n");
+         wprintf(L"        xmlpart merge manifest.txt\n");
+         return EXIT_FAILURE;
+      }
+   }
+   catch(...)
+   {
+      wprintf(L"Exception!  Sorry, something bad happened and XmlPart has to shut down.\n");
+      return EXIT_FAILURE;
+   }
+
+   if (!ok)
+   {
+      wprintf(L"Terminating with error.\n");
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
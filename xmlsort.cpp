@@ -0,0 +1,386 @@
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// xmlsort.cpp -- Source code example for using the NomXML library.
+//                This program reorders the records of an XML file by
+//                the value of a key field, even if the file is too big
+//                to fit in memory.
+//
+// NomXML is a small, minimalist C++ library for extracting tags and data
+// from XML documents.  I wrote this for use in my own educational and
+// experimental programs, but you may also freely use it in yours as long
+// as you abide by the following terms and conditions.
+//
+// (C) Copyright 2008,2015 by Ammon R. Campbell.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * The names of the authors and contributors may not be used to endorse
+//       or promote products derived from this software without specific
+//       prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// A "record" is any element with the tag name given on the command line,
+// such as "gml:featureMember" or "Placemark".  The key is a field of each
+// record, named by a path relative to the record, such as "name" for the
+// value of its child element <name> or "@gml:id" for its attribute
+// "gml:id".  Records without the field have an empty key.
+//
+// The input file is parsed once, keeping only each record's key and byte
+// range.  The keys are sorted in memory, or if there are too many of
+// them, in sorted runs spilled to temporary files which are then merged.
+// The output is written by copying the bytes of each record verbatim in
+// key order.  Everything outside of the records stays where it was, and
+// the records fill the places of the original records in turn, so when
+// all the records share one parent element the output is that element
+// with its children sorted.  Records with equal keys keep their original
+// order.  With the "numeric" option, keys are compared as numbers, with
+// keys that aren't numbers placed after all of those that are.
+//
+// For example:
+//
+//    xmlsort big.kml Placemark name sorted.kml
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+#include "nomxml.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+// Approximate number of bytes of keys held in memory before they are
+// sorted and spilled to a temporary file as one run.
+const size_t maxRunBytes = 64 * 1024 * 1024;
+
+//--------------------------------------------------------------------
+// Key and location of one record from the input file.
+//--------------------------------------------------------------------
+struct SortItem
+{
+   std::wstring m_Key;     // Value of the record's key field.
+   double m_Number;        // Value of the key as a number, or NaN if not a number.
+   size_t m_Offset;        // Byte offset of the record's begin tag.
+   size_t m_Length;        // Length of the record in bytes.
+
+   SortItem() : m_Number(NAN), m_Offset(0), m_Length(0) { }
+};
+
+//--------------------------------------------------------------------
+// Orders records by key, then by their position in the input file.
+//--------------------------------------------------------------------
+class SortOrder
+{
+public:
+   explicit SortOrder(bool numeric) : m_Numeric(numeric) { }
+
+   // Returns true if {a} belongs before {b}.
+   bool operator()(const SortItem &a, const SortItem &b) const
+   {
+      if (m_Numeric)
+      {
+         bool anumber = !isnan(a.m_Number);
+         bool bnumber = !isnan(b.m_Number);
+         if (anumber != bnumber)
+            return anumber;
+         if (anumber && a.m_Number != b.m_Number)
+            return a.m_Number < b.m_Number;
+      }
+      int compare = a.m_Key.compare(b.m_Key);
+      if (compare != 0)
+         return compare < 0;
+      return a.m_Offset < b.m_Offset;
+   }
+
+private:
+   bool m_Numeric;
+};
+
+//--------------------------------------------------------------------
+// Write {item} to temporary file {fp}.  Returns true if successful.
+//--------------------------------------------------------------------
+static bool WriteItem(FILE *fp, const SortItem &item)
+{
+   size_t keylen = item.m_Key.size();
+   return fwrite(&keylen, sizeof(keylen), 1, fp) == 1 &&
+          (keylen == 0 || fwrite(item.m_Key.data(), sizeof(wchar_t), keylen, fp) == keylen) &&
+          fwrite(&item.m_Number, sizeof(item.m_Number), 1, fp) == 1 &&
+          fwrite(&item.m_Offset, sizeof(item.m_Offset), 1, fp) == 1 &&
+          fwrite(&item.m_Length, sizeof(item.m_Length), 1, fp) == 1;
+}
+
+//--------------------------------------------------------------------
+// Read the next item from temporary file {fp} into {item}.
+// Returns false if error or no more items.
+//--------------------------------------------------------------------
+static bool ReadItem(FILE *fp, SortItem &item)
+{
+   size_t keylen = 0;
+   if (fread(&keylen, sizeof(keylen), 1, fp) != 1)
+      return false;
+   item.m_Key.resize(keylen);
+   return (keylen == 0 || fread(&item.m_Key[0], sizeof(wchar_t), keylen, fp) == keylen) &&
+          fread(&item.m_Number, sizeof(item.m_Number), 1, fp) == 1 &&
+          fread(&item.m_Offset, sizeof(item.m_Offset), 1, fp) == 1 &&
+          fread(&item.m_Length, sizeof(item.m_Length), 1, fp) == 1;
+}
+
+//--------------------------------------------------------------------
+// Produces the records in key order, either from one sorted array in
+// memory or by merging sorted runs from temporary files.
+//--------------------------------------------------------------------
+class SortedItems
+{
+public:
+   explicit SortedItems(const SortOrder &order) : m_Order(order), m_Bytes(0), m_Next(0) { }
+
+   ~SortedItems()
+   {
+      for (auto runp = m_Runs.begin(); runp != m_Runs.end(); ++runp)
+         fclose(*runp);
+   }
+
+   // Add the record {item}.  Returns false if error.
+   bool Add(const SortItem &item)
+   {
+      m_Items.push_back(item);
+      m_Bytes += sizeof(SortItem) + item.m_Key.size() * sizeof(wchar_t);
+      return m_Bytes < maxRunBytes || Spill();
+   }
+
+   // Finish adding records and prepare to retrieve them in order.
+   // Returns false if error.
+   bool Finish(void)
+   {
+      if (m_Runs.empty())
+      {
+         std::sort(m_Items.begin(), m_Items.end(), m_Order);
+         m_Next = 0;
+         return true;
+      }
+
+      // Prime the merge with the first item from each run.
+      if (!m_Items.empty() && !Spill())
+         return false;
+      m_Heads.resize(m_Runs.size());
+      for (size_t run = 0; run < m_Runs.size(); ++run)
+      {
+         rewind(m_Runs[run]);
+         if (!ReadItem(m_Runs[run], m_Heads[run]))
+            return false;
+         m_Active.push_back(run);
+      }
+      return true;
+   }
+
+   // Retrieve the next record in key order into {item}.
+   // Returns false if there are no more records.
+   bool Next(SortItem &item)
+   {
+      if (m_Runs.empty())
+      {
+         if (m_Next >= m_Items.size())
+            return false;
+         item = m_Items[m_Next++];
+         return true;
+      }
+
+      // Take the smallest head among the runs that aren't used up.
+      // There are few runs, so a linear search is fast enough.
+      if (m_Active.empty())
+         return false;
+      size_t best = 0;
+      for (size_t index = 1; index < m_Active.size(); ++index)
+         if (m_Order(m_Heads[m_Active[index]], m_Heads[m_Active[best]]))
+            best = index;
+      size_t run = m_Active[best];
+      item = m_Heads[run];
+      if (!ReadItem(m_Runs[run], m_Heads[run]))
+         m_Active.erase(m_Active.begin() + best);
+      return true;
+   }
+
+private:
+   SortOrder m_Order;
+   std::vector<SortItem> m_Items;
+   size_t m_Bytes;
+   size_t m_Next;
+   std::vector<FILE *> m_Runs;
+   std::vector<SortItem> m_Heads;
+   std::vector<size_t> m_Active;
+
+   // Sort the items in memory and write them to a new run file.
+   // Returns false if error.
+   bool Spill(void)
+   {
+      FILE *fp = tmpfile();
+      if (fp == nullptr)
+         return false;
+      m_Runs.push_back(fp);
+
+      std::sort(m_Items.begin(), m_Items.end(), m_Order);
+      for (auto itemp = m_Items.begin(); itemp != m_Items.end(); ++itemp)
+         if (!WriteItem(fp, *itemp))
+            return false;
+      m_Items.clear();
+      m_Bytes = 0;
+      return true;
+   }
+
+   SortedItems(const SortedItems &);
+   SortedItems & operator=(const SortedItems &);
+};
+
+//--------------------------------------------------------------------
+// Write the input file {in} of {filelength} bytes to {out}, with the
+// records whose original locations are listed in temporary file
+// {places} replaced in turn by the records from {sorted}.
+// Returns true if successful.
+//--------------------------------------------------------------------
+static bool WriteSorted(FILE *in, size_t filelength, FILE *places, SortedItems &sorted, FILE *out)
+{
+   rewind(places);
+   size_t copied = 0;
+   size_t place[2];
+   SortItem item;
+   while (fread(place, sizeof(place), 1, places) == 1)
+   {
+      if (!sorted.Next(item) ||
+          !nomxml::XmlCopyBytes(in, copied, place[0] - copied, out) ||
+          !nomxml::XmlCopyBytes(in, item.m_Offset, item.m_Length, out))
+         return false;
+      copied = place[0] + place[1];
+   }
+   return nomxml::XmlCopyBytes(in, copied, filelength - copied, out);
+}
+
+//--------------------------------------------------------------------
+// Program entry point.  Takes standard args from the command line and
+// returns EXIT_SUCCESS if no errors.
+//--------------------------------------------------------------------
+int wmain(int argc, wchar_t **argv)
+{
+   if ((argc != 5 && argc != 6) || (argc == 6 && _wcsicmp(argv[5], L"numeric") != 0))
+   {
+      // The user needs command line help.
+      wprintf(L"Usage:  xmlsort filename.xml recordname keypath output.xml [numeric]\n");
+      return EXIT_FAILURE;
+   }
+
+   const wchar_t *filename = argv[1];
+   const wchar_t *recordname = argv[2];
+   const wchar_t *keypath = argv[3];
+   const wchar_t *outname = argv[4];
+   bool numeric = (argc == 6);
+
+   FILE *in = nullptr;
+   FILE *out = nullptr;
+   FILE *places = nullptr;
+   int result = EXIT_FAILURE;
+
+   try
+   {
+      // Read the key and location of every record.  The original
+      // locations are kept in a temporary file, in document order.
+      nomxml::XmlParser xml;
+      if (!xml.BeginParsingFromFile(filename))
+      {
+         wprintf(L"Failed to begin parsing file:  %s\n", filename);
+         return EXIT_FAILURE;
+      }
+      places = tmpfile();
+      if (places == nullptr)
+      {
+         wprintf(L"Failed creating temporary file.\n");
+         return EXIT_FAILURE;
+      }
+
+      SortedItems sorted((SortOrder(numeric)));
+      nomxml::XmlRecordReader reader(xml, recordname, std::vector<std::wstring>(1, keypath));
+      nomxml::XmlRecordSpan span;
+      std::vector<std::vector<std::wstring> > fields;
+      size_t numrecords = 0;
+      while (reader.Next(span, fields))
+      {
+         SortItem item;
+         if (!fields[0].empty())
+            item.m_Key = fields[0][0];
+         double number = 0;
+         if (numeric && nomxml::XmlParseNumber(item.m_Key, number))
+            item.m_Number = number;
+         item.m_Offset = span.m_Offset;
+         item.m_Length = span.m_Length;
+
+         size_t place[2] = { span.m_Offset, span.m_Length };
+         if (fwrite(place, sizeof(place), 1, places) != 1 || !sorted.Add(item))
+         {
+            wprintf(L"Failed writing temporary file.\n");
+            fclose(places);
+            return EXIT_FAILURE;
+         }
+         ++numrecords;
+      }
+
+      std::wstring errtext;
+      reader.ErrorInfo(errtext);
+      if (!errtext.empty())
+      {
+         wprintf(L"Error:  %s\n", errtext.c_str());
+         wprintf(L"Near offset:  %Iu\n", xml.CurPosition());
+         fclose(places);
+         return EXIT_FAILURE;
+      }
+      xml.Reset();
+
+      // Copy the records to the output file in key order.
+      if (_wfopen_s(&in, filename, L"rb") || in == nullptr)
+      {
+         wprintf(L"Failed opening file:  %s\n", filename);
+      }
+      else if (_wfopen_s(&out, outname, L"wb") || out == nullptr)
+      {
+         wprintf(L"Failed creating file:  %s\n", outname);
+      }
+      else
+      {
+         size_t filelength = nomxml::XmlFileLength(in);
+         if (!sorted.Finish() || !WriteSorted(in, filelength, places, sorted, out))
+         {
+            wprintf(L"Failed writing file:  %s\n", outname);
+         }
+         else
+         {
+            wprintf(L"Sorted %Iu records.\n", numrecords);
+            result = EXIT_SUCCESS;
+         }
+      }
+   }
+   catch(...)
+   {
+      wprintf(L"Exception!  Sorry, something bad happened and XmlSort has to shut down.\n");
+      result = EXIT_FAILURE;
+   }
+
+   if (in != nullptr)
+      fclose(in);
+   if (out != nullptr && fclose(out) != 0)
+      result = EXIT_FAILURE;
+   if (places != nullptr)
+      fclose(places);
+   return result;
+}
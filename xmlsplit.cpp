@@ -0,0 +1,256 @@
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// xmlsplit.cpp -- Source code example for using the NomXML library.
+//                 This program splits a large XML file into several
+//                 smaller well-formed XML files by record.
+//
+// NomXML is a small, minimalist C++ library for extracting tags and data
+// from XML documents.  I wrote this for use in my own educational and
+// experimental programs, but you may also freely use it in yours as long
+// as you abide by the following terms and conditions.
+//
+// (C) Copyright 2008,2015 by Ammon R. Campbell.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * The names of the authors and contributors may not be used to endorse
+//       or promote products derived from this software without specific
+//       prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// A "record" is any element with the tag name given on the command line,
+// such as "gml:featureMember" or "Placemark".  The input file is first
+// parsed once to find the byte range of every record.  The records are
+// then divided as evenly as possible among the requested number of output
+// files, which are written at the same time by separate threads.
+//
+// Each output file is a complete, well-formed XML document.  It starts
+// with a verbatim copy of whatever precedes the document's root element
+// (such as the "<?xml ... ?>" declaration), followed by the begin tags of
+// the elements enclosing its records, the records themselves copied
+// verbatim, and the matching end tags.  Anything in the input that is
+// outside of all records, other than the enclosing tags, is not copied.
+//
+// For example, splitting a KML file into 3 pieces:
+//
+//    xmlsplit big.kml Placemark 3 piece
+//
+// produces piece.0.xml, piece.1.xml, and piece.2.xml, each of which can
+// be handed to a separate process for parsing.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+#include "nomxml.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <thread>
+
+//--------------------------------------------------------------------
+// Write wide string {text} to {fp} as 8-bit characters.
+//--------------------------------------------------------------------
+static void WriteText(FILE *fp, const std::wstring &text)
+{
+   for (auto iter = text.begin(); iter != text.end(); ++iter)
+      fputc((*iter < 256) ? static_cast<int>(*iter) : '?', fp);
+}
+
+//--------------------------------------------------------------------
+// Write a begin tag for the element that began with {begin} to {fp}.
+//--------------------------------------------------------------------
+static void WriteBeginTag(FILE *fp, const nomxml::XmlBeginNode &begin)
+{
+   fputc('<', fp);
+   WriteText(fp, begin.m_Name);
+   for (auto attribp = begin.m_Attribs.begin(); attribp != begin.m_Attribs.end(); ++attribp)
+   {
+      // The parser has removed the quotes from around the value, so
+      // choose quotes that don't appear in the value itself.
+      wchar_t quote = (attribp->m_Value.find(L'"') == std::wstring::npos) ? L'"' : L'\'';
+      fputc(' ', fp);
+      WriteText(fp, attribp->m_Name);
+      fputc('=', fp);
+      fputc(quote, fp);
+      WriteText(fp, attribp->m_Value);
+      fputc(quote, fp);
+   }
+   fputs(">\n", fp);
+}
+
+//--------------------------------------------------------------------
+// Write the end tags for the elements in {context}, innermost first,
+// down to but not including level {keep}.
+//--------------------------------------------------------------------
+static void WriteEndTags(FILE *fp, const std::vector<nomxml::XmlBeginNode> &context, size_t keep)
+{
+   for (size_t level = context.size(); level > keep; --level)
+   {
+      fputs("</", fp);
+      WriteText(fp, context[level - 1].m_Name);
+      fputs(">\n", fp);
+   }
+}
+
+//--------------------------------------------------------------------
+// Write one output file {outname} from the input file {inname},
+// containing the records numbered {first} up to but not including
+// {last} in {index}.  The first {prolog} bytes of the input are
+// copied to the start of the output.  Sets {ok} to false if error.
+//--------------------------------------------------------------------
+static void WriteShard(const std::wstring &inname, const std::wstring &outname,
+                       const nomxml::XmlRecordIndex &index, size_t first, size_t last,
+                       size_t prolog, char &ok)
+{
+   ok = false;
+
+   FILE *fpin = nullptr;
+   if (_wfopen_s(&fpin, inname.c_str(), L"rb") || fpin == nullptr)
+   {
+      wprintf(L"Failed opening file:  %s\n", inname.c_str());
+      return;
+   }
+   FILE *fpout = nullptr;
+   if (_wfopen_s(&fpout, outname.c_str(), L"wb") || fpout == nullptr)
+   {
+      wprintf(L"Failed creating file:  %s\n", outname.c_str());
+      fclose(fpin);
+      return;
+   }
+
+   bool success = nomxml::XmlCopyBytes(fpin, 0, prolog, fpout);
+   const std::vector<nomxml::XmlBeginNode> empty;
+   const std::vector<nomxml::XmlBeginNode> *open = &empty;
+   for (size_t record = first; record < last && success; ++record)
+   {
+      const nomxml::XmlRecordSpan &span = index.m_Records[record];
+      const std::vector<nomxml::XmlBeginNode> &context = index.m_Contexts[span.m_Context];
+      if (&context != open)
+      {
+         // Close the elements that don't enclose this record, and open
+         // the ones that do.  Each element is identified by its offset.
+         size_t shared = 0;
+         while (shared < open->size() && shared < context.size() &&
+                (*open)[shared].m_Offset == context[shared].m_Offset)
+            ++shared;
+         WriteEndTags(fpout, *open, shared);
+         for (size_t level = shared; level < context.size(); ++level)
+            WriteBeginTag(fpout, context[level]);
+         open = &context;
+      }
+
+      success = nomxml::XmlCopyBytes(fpin, span.m_Offset, span.m_Length, fpout);
+      fputc('\n', fpout);
+   }
+   WriteEndTags(fpout, *open, 0);
+
+   if (ferror(fpout))
+      success = false;
+   if (fclose(fpout) != 0)
+      success = false;
+   fclose(fpin);
+
+   if (!success)
+      wprintf(L"Failed writing file:  %s\n", outname.c_str());
+   ok = success ? 1 : 0;
+}
+
+//--------------------------------------------------------------------
+// Program entry point.  Takes standard args from the command line and
+// returns EXIT_SUCCESS if no errors.
+//--------------------------------------------------------------------
+int wmain(int argc, wchar_t **argv)
+{
+   if (argc != 5 || _wtoi(argv[3]) < 1)
+   {
+      // The user needs command line help.
+      wprintf(L"Usage:  xmlsplit filename.xml recordname numpieces outprefix\n");
+      return EXIT_FAILURE;
+   }
+
+   const wchar_t *filename = argv[1];
+   const wchar_t *recordname = argv[2];
+   size_t numshards = static_cast<size_t>(_wtoi(argv[3]));
+   const wchar_t *outprefix = argv[4];
+
+   try
+   {
+      // Find all of the records.
+      nomxml::XmlParser xml;
+      nomxml::XmlRecordIndex index;
+      if (!xml.BeginParsingFromFile(filename))
+      {
+         wprintf(L"Failed to begin parsing file:  %s\n", filename);
+         return EXIT_FAILURE;
+      }
+      if (!xml.IndexRecords(recordname, index))
+      {
+         std::wstring errtext;
+         xml.ErrorInfo(errtext);
+         wprintf(L"Error:  %s\n", errtext.c_str());
+         wprintf(L"Near offset:  %Iu\n", xml.CurPosition());
+         return EXIT_FAILURE;
+      }
+      xml.Reset();
+
+      if (index.m_Records.empty())
+      {
+         wprintf(L"No '%s' records found in file:  %s\n", recordname, filename);
+         return EXIT_FAILURE;
+      }
+
+      // Everything before the root element, or before the first record
+      // if records are at the top level, is copied to every piece.
+      const nomxml::XmlRecordSpan &firstspan = index.m_Records[0];
+      const std::vector<nomxml::XmlBeginNode> &firstcontext = index.m_Contexts[firstspan.m_Context];
+      size_t prolog = firstcontext.empty() ? firstspan.m_Offset : firstcontext[0].m_Offset;
+
+      // Write all of the pieces at once, one per thread.
+      numshards = std::min(numshards, index.m_Records.size());
+      std::vector<std::thread> threads;
+      std::vector<char> results(numshards, 0);
+      for (size_t shard = 0; shard < numshards; ++shard)
+      {
+         size_t first = index.m_Records.size() * shard / numshards;
+         size_t last = index.m_Records.size() * (shard + 1) / numshards;
+         std::wstring outname = std::wstring(outprefix) + L"." + std::to_wstring(shard) + L".xml";
+         threads.push_back(std::thread(WriteShard, std::wstring(filename), outname,
+                                       std::cref(index), first, last, prolog, std::ref(results[shard])));
+      }
+      for (auto threadp = threads.begin(); threadp != threads.end(); ++threadp)
+         threadp->join();
+
+      for (size_t shard = 0; shard < numshards; ++shard)
+      {
+         if (!results[shard])
+         {
+            wprintf(L"Terminating with error.\n");
+            return EXIT_FAILURE;
+         }
+      }
+
+      wprintf(L"Wrote %Iu records to %Iu files.\n", index.m_Records.size(), numshards);
+   }
+   catch(...)
+   {
+      wprintf(L"Exception!  Sorry, something bad happened and XmlSplit has to shut down.\n");
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}